@@ -14,6 +14,12 @@
 #include <stdlib.h>   /* for the declaration of malloc */
 #include <string.h>   /* for bcopy, memcopy */
 #include <unistd.h>   /* for dup, dup2; perhaps isatty */
+#include <pthread.h>  /* 2.4 for render_batch */
+#include <time.h>     /* 2.4 for clock_gettime */
+#include <stdatomic.h> /* 2.4 for the stats seqlock */
+#include <fcntl.h>    /* 2.4 for the SoundFont cache */
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* ----------- from http://fluidsynth.sourceforge.net/api/ ---------- */
 #include <fluidsynth.h>
@@ -28,6 +34,10 @@
 
 /* fprintf("C: FLUID_OK = %d\n",FLUID_OK); should be defined in misc.h, no? */
 
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#endif
+
 /* FILE * tmpfile (void) declared in stdio.h.
    char * tmpnam (char *result)
     Warning: Between the time the pathname is constructed and the file is
@@ -40,10 +50,156 @@
     not: dup2(fileno(stderr), fileno(tmpfile()));  :-(
 */
 int save_stderr = -1;
-fluid_synth_t* synths[128] = { 0 };   /* 2.0 to keep ptrs inside the C code */
-fluid_settings_t* settingses[128] = { 0 };     /* 2.0 to keep ptrs inside C */
-fluid_player_t* players[128] = { 0 }; /* 2.0 to keep ptrs inside the C code */
-fluid_audio_driver_t* audio_drivers[128] = { 0 };  /* 2.0 to keep ptrs in C */
+/* 2.4 the handles are full userdata with a __gc metamethod, instead of
+   indexes into fixed synths[128], settingses[128], players[128] and
+   audio_drivers[128] arrays.  Each synth has exactly one settings and
+   at most one audio_driver, so those live inside the synth's userdata.
+   One synth may have several players, so those are separate userdata,
+   linked from their synth so that they can be deleted before it is.
+*/
+#define SYNTH_METATABLE  "fluidsynth.synth"
+#define PLAYER_METATABLE "fluidsynth.player"
+typedef struct player_handle player_handle;
+/* 2.4 the performance counters, kept for each synth by the audio
+   callback or by the render functions, and read by stats.  Only the
+   one thread rendering writes them, and seq makes it a seqlock, so
+   that stats can take a consistent copy without blocking the audio */
+#define STATS_NBLOCKS 1024   /* the recent blocks for the percentiles */
+typedef struct synth_stats {
+	atomic_uint seq;         /* odd while note_block is writing */
+	long  frames;
+	long  blocks;
+	long  polyphony_hits;    /* blocks that ended with every voice busy */
+	int   last_nframes;
+	float block_us[STATS_NBLOCKS];   /* a ring of render times */
+} synth_stats;
+typedef struct synth_handle {
+	fluid_settings_t*     settings;
+	fluid_synth_t*        synth;
+	fluid_audio_driver_t* audio_driver;
+	player_handle*        players;      /* linked list of live players */
+	fluid_sequencer_t*    sequencer;    /* made by the first queue_events */
+	fluid_seq_id_t        synth_seq_id;
+	synth_stats           stats;
+	long                  reset_frames, reset_blocks, reset_hits;
+	int                   untimed;      /* its audio_driver can't call back */
+	struct sfc_sfont*     sfc_unloaded; /* freed after the synth, see below */
+} synth_handle;
+struct player_handle {
+	fluid_player_t*       player;
+	synth_handle*         owner;
+	player_handle*        next;
+};
+
+struct sfc_sfont;   /* see below */
+static void add_sfc_loader(fluid_synth_t* synth, struct sfc_sfont** unloaded);
+static void sfc_free_unloaded(struct sfc_sfont** unloaded);
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1.0e-9*(double)ts.tv_nsec;
+}
+static void note_block(synth_stats* st, fluid_synth_t* synth,
+  int nframes, double started) {
+	/* called after each block is rendered; no Lua and no locks here,
+	   because it runs in the audio thread.  st may be NULL */
+	unsigned int seq;
+	float us;
+	int   hit;
+	if (!st) { return; }
+	us  = (float)(1.0e6 * (now_seconds() - started));
+	hit = fluid_synth_get_active_voice_count(synth)
+	  >= fluid_synth_get_polyphony(synth);
+	seq = atomic_load_explicit(&(st->seq), memory_order_relaxed);
+	atomic_store_explicit(&(st->seq), seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	st->block_us[st->blocks % STATS_NBLOCKS] = us;
+	st->blocks++;
+	st->frames += nframes;
+	st->last_nframes = nframes;
+	if (hit) { st->polyphony_hits++; }
+	atomic_store_explicit(&(st->seq), seq+2, memory_order_release);
+}
+static void read_stats(synth_stats* st, synth_stats* copy) {
+	/* the other side of the seqlock: copies until nothing was written
+	   during the copy */
+	unsigned int seq;
+	do {
+		seq = atomic_load_explicit(&(st->seq), memory_order_acquire);
+		copy->frames         = st->frames;
+		copy->blocks         = st->blocks;
+		copy->polyphony_hits = st->polyphony_hits;
+		copy->last_nframes   = st->last_nframes;
+		memcpy(copy->block_us, st->block_us, sizeof(copy->block_us));
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1)
+	  || seq != atomic_load_explicit(&(st->seq), memory_order_relaxed));
+}
+
+static synth_handle* check_synth_handle(lua_State *L, int index) {
+	return (synth_handle*)luaL_checkudata(L, index, SYNTH_METATABLE);
+}
+static fluid_settings_t* check_settings(lua_State *L, int index) {
+	synth_handle* h = check_synth_handle(L, index);
+	if (!h->settings) { luaL_argerror(L, index, "synth has been deleted"); }
+	return h->settings;
+}
+static fluid_synth_t* check_synth(lua_State *L, int index) {
+	synth_handle* h = check_synth_handle(L, index);
+	if (!h->synth) { luaL_argerror(L, index, "synth has been deleted"); }
+	return h->synth;
+}
+static player_handle* check_player_handle(lua_State *L, int index) {
+	return (player_handle*)luaL_checkudata(L, index, PLAYER_METATABLE);
+}
+static fluid_player_t* check_player(lua_State *L, int index) {
+	player_handle* h = check_player_handle(L, index);
+	if (!h->player) { luaL_argerror(L, index, "player has been deleted"); }
+	return h->player;
+}
+
+static void free_player(player_handle* h) {
+	player_handle** pp;
+	if (!h->player) { return; }
+	fluid_player_stop(h->player);
+	delete_fluid_player(h->player);   /* always returns FLUID_OK */
+	h->player = NULL;
+	for (pp = &(h->owner->players); *pp; pp = &((*pp)->next)) {
+		if (*pp == h) { *pp = h->next; break; }
+	}
+	h->owner = NULL;
+	h->next  = NULL;
+}
+static void free_audio_driver(synth_handle* h) {
+	if (h->audio_driver) {
+		delete_fluid_audio_driver(h->audio_driver);   /* returns nothing */
+		h->audio_driver = NULL;
+		h->untimed = 0;
+	}
+}
+static void free_synth(synth_handle* h) {
+	/* the players and audio_driver must go before the synth they use */
+	while (h->players) { free_player(h->players); }
+	free_audio_driver(h);
+	if (h->sequencer) {   /* this unregisters the synth from it */
+		delete_fluid_sequencer(h->sequencer); h->sequencer = NULL;
+	}
+	if (h->synth) { delete_fluid_synth(h->synth); h->synth = NULL; }
+	sfc_free_unloaded(&(h->sfc_unloaded));   /* no voice can play them now */
+}
+static void free_settings(synth_handle* h) {
+	free_synth(h);
+	if (h->settings) { delete_fluid_settings(h->settings); h->settings=NULL; }
+}
+static int c_synth_gc(lua_State *L) {   /* reclaims leaked synths */
+	free_settings(check_synth_handle(L, 1));
+	return 0;
+}
+static int c_player_gc(lua_State *L) {
+	free_player(check_player_handle(L, 1));
+	return 0;
+}
 
 static int c_redirect_stderr(lua_State *L) {
 	save_stderr = dup(fileno(stderr));
@@ -63,25 +219,35 @@ static int c_restore_stderr() {
 	return 0;
 }
 
-static int c_new_fluid_settings(lua_State *L) {  /* synthnum */
-	int               synthnum = (int)(int)luaL_checkinteger(L, 1);
-	fluid_settings_t* settings = new_fluid_settings();  /* api */
+static int c_new_fluid_settings(lua_State *L) {  /* returns a new synth */
+	synth_handle* h = (synth_handle*)lua_newuserdata(L, sizeof(synth_handle));
+	h->settings     = NULL;
+	h->synth        = NULL;
+	h->audio_driver = NULL;
+	h->players      = NULL;
+	h->sequencer    = NULL;
+	h->untimed      = 0;
+	h->sfc_unloaded = NULL;
+	memset(&(h->stats), 0, sizeof(synth_stats));
+	atomic_init(&(h->stats.seq), 0);
+	h->reset_frames = h->reset_blocks = h->reset_hits = 0;
+	luaL_getmetatable(L, SYNTH_METATABLE);
+	lua_setmetatable(L, -2);
+	h->settings = new_fluid_settings();  /* api */
 	/* redirect_stderr is called from lua so fluidsynth knows tmp_file */
-	settingses[synthnum] = settings;
-	lua_pushinteger(L, synthnum); 
+	if (!h->settings) { lua_pushnil(L); return 1; }
 	return 1;
 }
 
-static int c_delete_fluid_settings(lua_State *L) {  /* settingsnum */
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
-	delete_fluid_settings(settings);   /* void; returns nothing */
+static int c_delete_fluid_settings(lua_State *L) {  /* synth */
+	free_settings(check_synth_handle(L, 1));
 	if (save_stderr != -1) { c_restore_stderr(); }
    	lua_pushinteger(L, 0);   /* FLUID_OK */
 	return 1;
 }
 
-static int c_fluid_settings_setint(lua_State *L) {  /* settingsnum,key,val */
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
+static int c_fluid_settings_setint(lua_State *L) {  /* synth,key,val */
+	fluid_settings_t* settings = check_settings(L, 1);
 	const char *key = lua_tostring(L, 2);
 	lua_Integer val = lua_tointeger(L, 3);
     int rc = fluid_settings_setint(settings, key, val);
@@ -89,8 +255,8 @@ static int c_fluid_settings_setint(lua_State *L) {  /* settingsnum,key,val */
 	return 1;
 }
 
-static int c_fluid_settings_setnum(lua_State *L) {  /* settings,key,val */
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
+static int c_fluid_settings_setnum(lua_State *L) {  /* synth,key,val */
+	fluid_settings_t* settings = check_settings(L, 1);
 	const char *key = lua_tostring(L, 2);
 	lua_Number  val = lua_tonumber(L, 3);
     int rc = fluid_settings_setnum(settings, key, val);
@@ -98,8 +264,8 @@ static int c_fluid_settings_setnum(lua_State *L) {  /* settings,key,val */
 	return 1;
 }
 
-static int c_fluid_settings_setstr(lua_State *L) {  /* settings,key,val */
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
+static int c_fluid_settings_setstr(lua_State *L) {  /* synth,key,val */
+	fluid_settings_t* settings = check_settings(L, 1);
 	const char *key = lua_tostring(L, 2);
 	const char *val = lua_tostring(L, 3);
     int rc = fluid_settings_setstr(settings, key, val);
@@ -108,64 +274,80 @@ static int c_fluid_settings_setstr(lua_State *L) {  /* settings,key,val */
 }
 
 /* http://fluidsynth.sourceforge.net/api/synth_8h.html */
-static int c_new_fluid_synth(lua_State *L) {  /* synthnum */
-	int               synthnum = (int)luaL_checkinteger(L, 1);
-	fluid_settings_t* settings = settingses[synthnum];
+static int c_new_fluid_synth(lua_State *L) {  /* synth */
+	synth_handle*     h        = check_synth_handle(L, 1);
+	fluid_settings_t* settings = check_settings(L, 1);
 	fluid_synth_t*    synth    = new_fluid_synth(settings);
-	if ((long int)synth == FLUID_FAILED) { lua_pushnil(L); return 1; }
-	synths[synthnum] = synth;
-    lua_pushinteger(L, synthnum); 
+	if (!synth) { lua_pushnil(L); return 1; }
+	h->synth = synth;
+	add_sfc_loader(synth, &(h->sfc_unloaded));   /* 2.4 */
+	lua_pushvalue(L, 1);
     return 1;
 }
 
-static int c_delete_fluid_synth(lua_State *L) {  /* synthnum */
-	/* fluid_settings_t* settings = (fluid_settings_t*)lua_tointeger(L, 1); */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
-	/* int rc = delete_fluid_synth(synth);   returns void
-   	lua_pushinteger(L, rc); */
-	delete_fluid_synth(synth);
+static int c_delete_fluid_synth(lua_State *L) {  /* synth */
+	free_synth(check_synth_handle(L, 1));   /* delete_fluid_synth is void */
    	lua_pushinteger(L, 1);
 	return 1;
 }
 
-static int c_new_fluid_audio_driver(lua_State *L) {  /* synthnum */
-	int               synthnum = (int)luaL_checkinteger(L, 1);
-	fluid_synth_t*    synth    = synths[synthnum];
-	fluid_settings_t* settings = settingses[synthnum];
-	fluid_audio_driver_t* audio_driver=new_fluid_audio_driver(settings,synth);
-	if ((long int)audio_driver == FLUID_FAILED) { lua_pushnil(L); return 1; }
-	audio_drivers[synthnum] = audio_driver;
-    lua_pushinteger(L, synthnum);
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+static int audio_callback(void* data, int len,
+  int nfx, float* fx[], int nout, float* out[]) {
+	/* 2.4 the audio driver calls this, so that it can be timed */
+	synth_handle* h = (synth_handle*)data;
+	double started  = now_seconds();
+	int rc = fluid_synth_process(h->synth, len, nfx, fx, nout, out);
+	note_block(&(h->stats), h->synth, len, started);
+	return rc;
+}
+#endif
+static int c_new_fluid_audio_driver(lua_State *L) {  /* synth */
+	synth_handle*     h        = check_synth_handle(L, 1);
+	fluid_synth_t*    synth    = check_synth(L, 1);
+	fluid_audio_driver_t* audio_driver;
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+	audio_driver = new_fluid_audio_driver2(h->settings, audio_callback, h);
+	if (!audio_driver) {   /* file, portaudio, sdl2 and dart can't call back */
+		audio_driver = new_fluid_audio_driver(h->settings, synth);
+		if (audio_driver) { h->untimed = 1; }
+	}
+#else
+	audio_driver = new_fluid_audio_driver(h->settings, synth);
+#endif
+	if (!audio_driver) { lua_pushnil(L); return 1; }
+	h->audio_driver = audio_driver;
+	lua_pushvalue(L, 1);
 	return 1;
 }
 
-static int c_delete_fluid_audio_driver(lua_State *L) {  /* audio_driver */
-	int               synthnum = (int)luaL_checkinteger(L, 1);
-	fluid_audio_driver_t* audio_driver = audio_drivers[synthnum];
-	if (audio_driver) {  /* 2.0 absent AudioDriver2synth, must defend */
-		delete_fluid_audio_driver(audio_driver);   /* returns nothing */
-		audio_drivers[synthnum] = 0;
-	}
+static int c_delete_fluid_audio_driver(lua_State *L) {  /* synth */
+	/* 2.0 absent AudioDriver2synth, must defend */
+	free_audio_driver(check_synth_handle(L, 1));
 	return 0;
 }
 
-static int c_new_fluid_player(lua_State *L) {  /* synthnum,playernum */
-	int           synthnum = (int)luaL_checkinteger(L, 1);
-	int          playernum = (int)luaL_checkinteger(L, 2);
-	fluid_synth_t*  synth  = synths[synthnum];
-	fluid_player_t* player = new_fluid_player(synth);
-	if ((long int)player == FLUID_FAILED) { lua_pushnil(L); return 1; }
-	players[playernum] = player;
-	lua_pushinteger(L, playernum);
+static int c_new_fluid_player(lua_State *L) {  /* synth */
+	synth_handle*   owner  = check_synth_handle(L, 1);
+	fluid_synth_t*  synth  = check_synth(L, 1);
+	player_handle*  h
+	  = (player_handle*)lua_newuserdata(L, sizeof(player_handle));
+	h->player = NULL;
+	h->owner  = NULL;
+	h->next   = NULL;
+	luaL_getmetatable(L, PLAYER_METATABLE);
+	lua_setmetatable(L, -2);
+	h->player = new_fluid_player(synth);
+	if (!h->player) { lua_pushnil(L); return 1; }
+	h->owner  = owner;
+	h->next   = owner->players;
+	owner->players = h;
 	return 1;
 }
 
-static int c_delete_fluid_player(lua_State *L) {  /* playernum */
-	int              playernum = (int)luaL_checkinteger(L, 1);
-	fluid_player_t* player = players[playernum];
-	delete_fluid_player(player);   /* always returns FLUID_OK */
-	players[playernum] = 0;
-	return 1;
+static int c_delete_fluid_player(lua_State *L) {  /* player */
+	free_player(check_player_handle(L, 1));
+	return 0;
 }
 
 /*
@@ -207,15 +389,677 @@ bank select message is normally sent using a control change message).
 */
 /*   20201104 2.3 fluid_synth_error is now being removed from libfluidsynth
 static int c_fluid_synth_error(lua_State *L) {  // synth
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	const char* msg = fluid_synth_error(synth);
    	lua_pushstring(L, msg);
 	return 1;
 }
 */
 
+/* 2.4 the shared SoundFont cache.  fluid_synth_sfload() makes each
+   synth parse the whole .sf2 file and copy all its sample data, so
+   sixteen synths hold sixteen copies.  Instead, each synth gets the
+   sfc_load loader, which fluidsynth tries before its default one.
+   It keeps one parsed copy of each file, keyed by its real path and
+   its mtime, whose sample data is read (or mmap'd) once and is used in
+   place by every synth.  Each synth still gets its own fluid_sfont_t,
+   fluid_preset_t's and fluid_sample_t's, since fluidsynth counts the
+   voices using a sample without any locking, and synths may run in
+   different threads; so sf_ids and program changes work as before.
+   When a synth unloads a SoundFont, voices may still be playing its
+   samples, and fluidsynth doesn't say when they stop; so the samples,
+   and the synth's hold on the copy, are kept until the synth itself
+   is deleted.  The copy is freed when no synth holds it.
+   Files it can't handle, such as compressed .sf3, are left to the
+   default loader.
+*/
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+#define SFC_NGENS 61   /* the generators of SoundFont 2.04 */
+typedef struct sfc_gen {
+	int gen;
+	short amount;
+} sfc_gen;
+typedef struct sfc_zone {
+	int keylo, keyhi, vello, velhi;   /* -1 if not given */
+	int link;        /* index of the instrument, or of the sample */
+	int ngens;
+	sfc_gen* gens;
+	int nmods;
+	fluid_mod_t** mods;   /* owned by the entry's allmods */
+} sfc_zone;
+typedef struct sfc_inst {
+	int nzones;
+	sfc_zone* zones;
+} sfc_inst;
+typedef struct sfc_preset {
+	char name[21];
+	int  bank, num;
+	int  nzones;
+	sfc_zone* zones;
+} sfc_preset;
+typedef struct sfc_sample {   /* what each synth's fluid_sample_t needs */
+	int    ok;             /* 0 for ROM or broken samples */
+	char   name[21];
+	short* data;           /* in place, in the file's sample data */
+	char*  data24;
+	unsigned int nframes, rate, loopstart, loopend;
+	int    pitch, pitchadj;
+} sfc_sample;
+typedef struct sfc_entry {
+	char*  path;
+	time_t mtime;
+	off_t  size;
+	int    refcount;
+	int    is_mmap;
+	char*  data;          /* the whole file */
+	size_t length;
+	short* swapped;       /* the samples, on big-endian machines */
+	int    nsamples;
+	sfc_sample* samples;
+	int    ninsts;
+	sfc_inst* insts;
+	int    npresets;
+	sfc_preset* presets;
+	int    nallmods, allmods_size;
+	fluid_mod_t** allmods;
+	struct sfc_entry* next;
+} sfc_entry;
+typedef struct sfc_sfont {   /* one of these for each synth */
+	sfc_entry* entry;
+	fluid_preset_t** presets;
+	fluid_sample_t** samples;   /* NULL for ROM or broken samples */
+	int iter;
+	struct sfc_sfont** unloaded;   /* the synth's list, for when it's freed */
+	struct sfc_sfont*  next;
+} sfc_sfont;
+static sfc_entry* sfc_entries = NULL;
+static pthread_mutex_t sfc_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* not 'm' by default, because rewriting a file in place while it's
+   mapped can change the notes, or if it shrinks, SIGBUS the process */
+static int sfc_mode = 'r';   /* 'm'map, 'r'ead, or 'o'ff */
+
+static unsigned int sfc_u16(const unsigned char* p) {
+	return p[0] | (p[1]<<8);
+}
+static short sfc_s16(const unsigned char* p) {
+	return (short)(p[0] | (p[1]<<8));
+}
+static unsigned long sfc_u32(const unsigned char* p) {
+	return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned long)p[3]<<24);
+}
+
+static fluid_mod_t* sfc_new_mod(sfc_entry* e, const unsigned char* p) {
+	/* p is a 10-byte pmod or imod record; returns NULL if it is one
+	   that fluidsynth would ignore too */
+	int srcs[2], flags[2], i;
+	unsigned int oper[2];
+	int dest = sfc_u16(p+2);
+	fluid_mod_t* mod;
+	oper[0] = sfc_u16(p);  oper[1] = sfc_u16(p+6);
+	if (dest >= SFC_NGENS || sfc_u16(p+8) != 0) { return NULL; }
+	for (i = 0; i < 2; i++) {
+		int index = oper[i] & 0x7F;
+		int type  = oper[i] >> 10;
+		if (type > 3) { return NULL; }
+		flags[i] = ((oper[i] & 0x100) ? FLUID_MOD_NEGATIVE : FLUID_MOD_POSITIVE)
+		  | ((oper[i] & 0x200) ? FLUID_MOD_BIPOLAR : FLUID_MOD_UNIPOLAR)
+		  | (type << 2);   /* LINEAR, CONCAVE, CONVEX, SWITCH */
+		if (oper[i] & 0x80) {
+			if (index==0 || index==6 || index==32 || index==38
+			  || (index>=98 && index<=101) || index>=120) { return NULL; }
+			flags[i] |= FLUID_MOD_CC;
+		} else {
+			if (index!=0 && index!=2 && index!=3 && index!=10
+			  && index!=13 && index!=14 && index!=16) { return NULL; }
+			flags[i] |= FLUID_MOD_GC;
+		}
+		srcs[i] = index;
+	}
+	if (srcs[0] == FLUID_MOD_NONE && !(flags[0] & FLUID_MOD_CC)) {
+		return NULL;   /* no primary source, so it does nothing */
+	}
+	if (e->nallmods == e->allmods_size) {
+		int new_size = e->allmods_size ? 2*e->allmods_size : 64;
+		fluid_mod_t** new_allmods
+		  = realloc(e->allmods, new_size*sizeof(fluid_mod_t*));
+		if (!new_allmods) { return NULL; }
+		e->allmods = new_allmods;
+		e->allmods_size = new_size;
+	}
+	mod = new_fluid_mod();
+	if (!mod) { return NULL; }
+	fluid_mod_set_source1(mod, srcs[0], flags[0]);
+	fluid_mod_set_source2(mod, srcs[1], flags[1]);
+	fluid_mod_set_dest(mod, dest);
+	fluid_mod_set_amount(mod, (double)sfc_s16(p+4));
+	e->allmods[e->nallmods++] = mod;
+	return mod;
+}
+
+static int sfc_is_additive(int gen) {   /* SF2.04 section 8.5 */
+	switch (gen) {
+		case 0: case 1: case 2: case 3: case 4: case 12:
+		case 45: case 46: case 47: case 50: case 54: case 57: case 58:
+			return 0;
+	}
+	return 1;
+}
+
+static int sfc_zones(sfc_entry* e,
+  const unsigned char* bag, int bag0, int bag1,
+  const unsigned char* gen, int ngen, const unsigned char* mod, int nmod,
+  int link_gen, int nlinks, int is_preset, int* nzonesp, sfc_zone** zonesp) {
+	/* parses the zones bag0..bag1-1 of one preset or instrument, and
+	   merges its global zone, if any, into each of the others */
+	sfc_zone  global;
+	sfc_zone* zones;
+	int have_global = 0, nzones = 0, b, i, j;
+	*nzonesp = 0;  *zonesp = NULL;
+	if (bag1 <= bag0) { return 0; }
+	zones = calloc(bag1-bag0, sizeof(sfc_zone));
+	if (!zones) { return -1; }
+	memset(&global, 0, sizeof(global));
+	for (b = bag0; b < bag1; b++) {
+		int g0 = sfc_u16(bag+4*b),   g1 = sfc_u16(bag+4*b+4);
+		int m0 = sfc_u16(bag+4*b+2), m1 = sfc_u16(bag+4*b+6);
+		sfc_zone* z = &zones[nzones];
+		if (g1 < g0 || g1 > ngen || m1 < m0 || m1 > nmod) { continue; }
+		z->keylo = z->keyhi = z->vello = z->velhi = -1;
+		z->link  = -1;
+		z->gens  = calloc(g1-g0+1, sizeof(sfc_gen));
+		z->mods  = calloc(m1-m0+1, sizeof(fluid_mod_t*));
+		if (!z->gens || !z->mods) { free(z->gens); free(z->mods); break; }
+		for (i = g0; i < g1; i++) {
+			const unsigned char* p = gen + 4*i;
+			int oper = sfc_u16(p);
+			if (oper == 43)      { z->keylo = p[2]; z->keyhi = p[3]; }
+			else if (oper == 44) { z->vello = p[2]; z->velhi = p[3]; }
+			else if (oper == link_gen) { z->link = sfc_u16(p+2); break; }
+			else if (oper < SFC_NGENS && oper != 41 && oper != 53
+			  && (!is_preset || sfc_is_additive(oper))) {
+				for (j = 0; j < z->ngens; j++) {
+					if (z->gens[j].gen == oper) { break; }
+				}
+				z->gens[j].gen    = oper;
+				z->gens[j].amount = sfc_s16(p+2);
+				if (j == z->ngens) { z->ngens++; }
+			}
+		}
+		for (i = m0; i < m1; i++) {
+			fluid_mod_t* m = sfc_new_mod(e, mod + 10*i);
+			if (!m) { continue; }
+			for (j = 0; j < z->nmods; j++) {   /* duplicates are ignored */
+				if (fluid_mod_test_identity(z->mods[j], m)) { break; }
+			}
+			if (j == z->nmods) { z->mods[z->nmods++] = m; }
+		}
+		if (z->link < 0 && b == bag0) {   /* the global zone */
+			global = *z;  have_global = 1;
+			memset(z, 0, sizeof(sfc_zone));
+		} else if (z->link < 0 || z->link >= nlinks) {
+			free(z->gens); free(z->mods);   /* ignored */
+			memset(z, 0, sizeof(sfc_zone));
+		} else {
+			nzones++;
+		}
+	}
+	for (i = 0; i < nzones; i++) {
+		sfc_zone* z = &zones[i];
+		if (have_global) {
+			sfc_gen* gens = realloc(z->gens,
+			  (z->ngens+global.ngens+1)*sizeof(sfc_gen));
+			fluid_mod_t** mods = realloc(z->mods,
+			  (z->nmods+global.nmods+1)*sizeof(fluid_mod_t*));
+			int n;
+			if (gens) { z->gens = gens; }
+			if (mods) { z->mods = mods; }
+			if (z->keylo < 0) { z->keylo = global.keylo; z->keyhi = global.keyhi; }
+			if (z->vello < 0) { z->vello = global.vello; z->velhi = global.velhi; }
+			for (n = 0; gens && n < global.ngens; n++) {
+				for (j = 0; j < z->ngens; j++) {
+					if (z->gens[j].gen == global.gens[n].gen) { break; }
+				}
+				if (j == z->ngens) { z->gens[z->ngens++] = global.gens[n]; }
+			}
+			for (n = 0; mods && n < global.nmods; n++) {
+				for (j = 0; j < z->nmods; j++) {
+					if (fluid_mod_test_identity(z->mods[j], global.mods[n])) {
+						break;
+					}
+				}
+				if (j == z->nmods) { z->mods[z->nmods++] = global.mods[n]; }
+			}
+		}
+		if (z->keylo < 0) { z->keylo = 0; z->keyhi = 127; }
+		if (z->vello < 0) { z->vello = 0; z->velhi = 127; }
+	}
+	free(global.gens); free(global.mods);
+	*nzonesp = nzones;  *zonesp = zones;
+	return 0;
+}
+
+static int sfc_parse(sfc_entry* e) {
+	/* fills in the samples, instruments and presets from e->data */
+	static const char* names[] = { "ifil", "smpl", "sm24", "phdr", "pbag",
+	  "pmod", "pgen", "inst", "ibag", "imod", "igen", "shdr", NULL };
+	static const int record_sizes[] = { 4,2,1, 38,4,10,4, 22,4,10,4, 46 };
+	enum { IFIL,SMPL,SM24, PHDR,PBAG,PMOD,PGEN, INST,IBAG,IMOD,IGEN, SHDR };
+	const unsigned char* chunk[12];
+	unsigned long nchunk[12];
+	const unsigned char* d = (const unsigned char*)e->data;
+	const unsigned short one = 1;
+	unsigned long riff_end, pos, list_end, nframes;
+	const short* smpl;
+	int i, j;
+	memset(chunk, 0, sizeof(chunk));
+	memset(nchunk, 0, sizeof(nchunk));
+	if (e->length < 12 || memcmp(d, "RIFF", 4) || memcmp(d+8, "sfbk", 4)) {
+		return -1;
+	}
+	riff_end = 8 + sfc_u32(d+4);
+	if (riff_end > e->length) { return -1; }
+	for (pos = 12; pos + 12 <= riff_end; pos = list_end + (list_end & 1)) {
+		unsigned long sub;
+		list_end = pos + 8 + sfc_u32(d+pos+4);
+		if (list_end > riff_end) { return -1; }
+		if (memcmp(d+pos, "LIST", 4)) { continue; }
+		for (sub = pos+12; sub + 8 <= list_end; ) {
+			unsigned long size = sfc_u32(d+sub+4);
+			if (sub + 8 + size > list_end) { return -1; }
+			for (i = 0; names[i]; i++) {
+				if (!memcmp(d+sub, names[i], 4)) {
+					chunk[i]  = d + sub + 8;
+					nchunk[i] = size / record_sizes[i];
+				}
+			}
+			sub += 8 + size + (size & 1);
+		}
+	}
+	if (!chunk[IFIL] || sfc_u16(chunk[IFIL]) != 2) { return -1; } /* .sf3 */
+	if (!chunk[SMPL]) { return -1; }
+	for (i = PHDR; i <= SHDR; i++) { if (nchunk[i] < 1) { return -1; } }
+	/* the sample data is used in place, if it is already little-endian */
+	nframes = nchunk[SMPL];
+	smpl = (const short*)chunk[SMPL];
+	if (*(const unsigned char*)&one != 1) {
+		e->swapped = malloc(nframes * sizeof(short) + 1);
+		if (!e->swapped) { return -1; }
+		for (i = 0; i < (long)nframes; i++) {
+			e->swapped[i] = sfc_s16(chunk[SMPL] + 2*i);
+		}
+		smpl = e->swapped;
+	}
+	if (chunk[SM24] && (sfc_u16(chunk[IFIL]+2) < 4
+	  || nchunk[SM24] < nframes)) { chunk[SM24] = NULL; }
+	e->nsamples = nchunk[SHDR] - 1;
+	e->samples  = calloc(e->nsamples+1, sizeof(sfc_sample));
+	if (!e->samples) { return -1; }
+	for (i = 0; i < e->nsamples; i++) {
+		const unsigned char* p = chunk[SHDR] + 46*i;
+		unsigned long start = sfc_u32(p+20), end = sfc_u32(p+24);
+		unsigned long loopstart = sfc_u32(p+28), loopend = sfc_u32(p+32);
+		unsigned long rate = sfc_u32(p+36);
+		int pitch = p[40];
+		sfc_sample* sample = &(e->samples[i]);
+		if ((sfc_u16(p+44) & 0x8000) || end <= start || end > nframes) {
+			continue;   /* ROM samples and broken ones are left out */
+		}
+		memcpy(sample->name, p, 20);  sample->name[20] = '\0';
+		sample->data    = (short*)(smpl + start);
+		sample->data24  = chunk[SM24] ? (char*)(chunk[SM24] + start) : NULL;
+		sample->nframes = end - start;
+		sample->rate    = rate ? rate : 44100;
+		if (loopstart < start || loopstart > end) { loopstart = start; }
+		if (loopend < loopstart || loopend > end) { loopend = end; }
+		sample->loopstart = loopstart - start;
+		sample->loopend   = loopend - start;
+		sample->pitch     = pitch > 127 ? 60 : pitch;
+		sample->pitchadj  = (signed char)p[41];
+		sample->ok = 1;
+	}
+	e->ninsts = nchunk[INST] - 1;
+	e->insts  = calloc(e->ninsts+1, sizeof(sfc_inst));
+	if (!e->insts) { return -1; }
+	for (i = 0; i < e->ninsts; i++) {
+		int bag0 = sfc_u16(chunk[INST] + 22*i + 20);
+		int bag1 = sfc_u16(chunk[INST] + 22*i + 42);
+		if (bag1 > (int)nchunk[IBAG]-1) { bag1 = nchunk[IBAG]-1; }
+		if (sfc_zones(e, chunk[IBAG], bag0, bag1, chunk[IGEN], nchunk[IGEN],
+		  chunk[IMOD], nchunk[IMOD], 53, e->nsamples, 0,
+		  &(e->insts[i].nzones), &(e->insts[i].zones))) { return -1; }
+	}
+	e->npresets = nchunk[PHDR] - 1;
+	e->presets  = calloc(e->npresets+1, sizeof(sfc_preset));
+	if (!e->presets) { return -1; }
+	for (i = 0; i < e->npresets; i++) {
+		const unsigned char* p = chunk[PHDR] + 38*i;
+		sfc_preset* preset = &(e->presets[i]);
+		int bag0 = sfc_u16(p+24), bag1 = sfc_u16(p+38+24);
+		if (bag1 > (int)nchunk[PBAG]-1) { bag1 = nchunk[PBAG]-1; }
+		memcpy(preset->name, p, 20);  preset->name[20] = '\0';
+		preset->num  = sfc_u16(p+20);
+		preset->bank = sfc_u16(p+22);
+		if (sfc_zones(e, chunk[PBAG], bag0, bag1, chunk[PGEN], nchunk[PGEN],
+		  chunk[PMOD], nchunk[PMOD], 41, e->ninsts, 1,
+		  &(preset->nzones), &(preset->zones))) { return -1; }
+	}
+	/* the first of two presets with the same bank and number wins */
+	for (i = 1; i < e->npresets; i++) {
+		for (j = 0; j < i; j++) {
+			if (e->presets[j].bank == e->presets[i].bank
+			  && e->presets[j].num == e->presets[i].num) {
+				e->presets[i].bank = -1; break;
+			}
+		}
+	}
+	return 0;
+}
+
+static void sfc_free_entry(sfc_entry* e) {
+	int i, j;
+	for (i = 0; e->insts && i < e->ninsts; i++) {
+		for (j = 0; j < e->insts[i].nzones; j++) {
+			free(e->insts[i].zones[j].gens); free(e->insts[i].zones[j].mods);
+		}
+		free(e->insts[i].zones);
+	}
+	for (i = 0; e->presets && i < e->npresets; i++) {
+		for (j = 0; j < e->presets[i].nzones; j++) {
+			free(e->presets[i].zones[j].gens); free(e->presets[i].zones[j].mods);
+		}
+		free(e->presets[i].zones);
+	}
+	for (i = 0; i < e->nallmods; i++) { delete_fluid_mod(e->allmods[i]); }
+	if (e->data) {
+		if (e->is_mmap) { munmap(e->data, e->length); } else { free(e->data); }
+	}
+	free(e->allmods); free(e->presets); free(e->insts); free(e->samples);
+	free(e->swapped); free(e->path); free(e);
+}
+
+static sfc_entry* sfc_acquire(const char* filename) {
+	/* finds the file in the cache, or loads it; NULL if it can't */
+	struct stat st;
+	sfc_entry* e;
+	char* path;
+	int fd;
+	if (stat(filename, &st) || !S_ISREG(st.st_mode)) { return NULL; }
+	path = realpath(filename, NULL);
+	if (!path) { return NULL; }
+	pthread_mutex_lock(&sfc_mutex);
+	for (e = sfc_entries; e; e = e->next) {
+		if (e->mtime == st.st_mtime && e->size == st.st_size
+		  && !strcmp(e->path, path)) { break; }
+	}
+	if (e) {
+		e->refcount++;
+		pthread_mutex_unlock(&sfc_mutex);
+		free(path);
+		return e;
+	}
+	e = calloc(1, sizeof(sfc_entry));
+	fd = open(path, O_RDONLY);
+	if (!e || fd < 0) {
+		pthread_mutex_unlock(&sfc_mutex);
+		if (fd >= 0) { close(fd); }
+		free(e); free(path);
+		return NULL;
+	}
+	e->path   = path;
+	e->mtime  = st.st_mtime;
+	e->size   = st.st_size;
+	e->length = st.st_size;
+	if (sfc_mode == 'm') {
+		e->data = mmap(NULL, e->length, PROT_READ, MAP_SHARED, fd, 0);
+		if (e->data == MAP_FAILED) { e->data = NULL; } else { e->is_mmap = 1; }
+	}
+	if (!e->data) {   /* sfc_mode 'r', or mmap failed */
+		e->data = malloc(e->length + 1);
+		if (e->data && read(fd, e->data, e->length) != (ssize_t)e->length) {
+			free(e->data); e->data = NULL;
+		}
+	}
+	close(fd);
+	if (!e->data || sfc_parse(e)) {
+		pthread_mutex_unlock(&sfc_mutex);
+		sfc_free_entry(e);
+		return NULL;
+	}
+	e->refcount = 1;
+	e->next = sfc_entries;
+	sfc_entries = e;
+	pthread_mutex_unlock(&sfc_mutex);
+	return e;
+}
+static void sfc_release(sfc_entry* e) {
+	sfc_entry** ep;
+	pthread_mutex_lock(&sfc_mutex);
+	if (--(e->refcount) > 0) { pthread_mutex_unlock(&sfc_mutex); return; }
+	for (ep = &sfc_entries; *ep; ep = &((*ep)->next)) {
+		if (*ep == e) { *ep = e->next; break; }
+	}
+	pthread_mutex_unlock(&sfc_mutex);
+	sfc_free_entry(e);
+}
+
+static const char* sfc_preset_get_name(fluid_preset_t* preset) {
+	return ((sfc_preset*)fluid_preset_get_data(preset))->name;
+}
+static int sfc_preset_get_banknum(fluid_preset_t* preset) {
+	return ((sfc_preset*)fluid_preset_get_data(preset))->bank;
+}
+static int sfc_preset_get_num(fluid_preset_t* preset) {
+	return ((sfc_preset*)fluid_preset_get_data(preset))->num;
+}
+static void sfc_preset_free(fluid_preset_t* preset) {
+	delete_fluid_preset(preset);
+}
+static int sfc_preset_noteon(fluid_preset_t* preset, fluid_synth_t* synth,
+  int chan, int key, int vel) {
+	/* as fluid_defpreset_noteon: instrument generators and modulators
+	   replace the defaults, and the preset's are then added to them */
+	sfc_preset* p = (sfc_preset*)fluid_preset_get_data(preset);
+	sfc_sfont* sf = (sfc_sfont*)fluid_sfont_get_data(
+	  fluid_preset_get_sfont(preset));
+	sfc_entry*  e = sf->entry;
+	int i, j, k;
+	for (i = 0; i < p->nzones; i++) {
+		sfc_zone* pz = &(p->zones[i]);
+		sfc_inst* inst;
+		if (key < pz->keylo || key > pz->keyhi
+		  || vel < pz->vello || vel > pz->velhi) { continue; }
+		inst = &(e->insts[pz->link]);
+		for (j = 0; j < inst->nzones; j++) {
+			sfc_zone* iz = &(inst->zones[j]);
+			fluid_sample_t* sample = sf->samples[iz->link];
+			fluid_voice_t*  voice;
+			if (!sample || key < iz->keylo || key > iz->keyhi
+			  || vel < iz->vello || vel > iz->velhi) { continue; }
+			voice = fluid_synth_alloc_voice(synth, sample, chan, key, vel);
+			if (!voice) { return FLUID_FAILED; }
+			for (k = 0; k < iz->ngens; k++) {
+				fluid_voice_gen_set(voice, iz->gens[k].gen, iz->gens[k].amount);
+			}
+			for (k = 0; k < iz->nmods; k++) {
+				fluid_voice_add_mod(voice, iz->mods[k], FLUID_VOICE_OVERWRITE);
+			}
+			for (k = 0; k < pz->ngens; k++) {
+				fluid_voice_gen_incr(voice, pz->gens[k].gen, pz->gens[k].amount);
+			}
+			for (k = 0; k < pz->nmods; k++) {
+				fluid_voice_add_mod(voice, pz->mods[k], FLUID_VOICE_ADD);
+			}
+			fluid_synth_start_voice(synth, voice);
+		}
+	}
+	return FLUID_OK;
+}
+
+static const char* sfc_sfont_get_name(fluid_sfont_t* sfont) {
+	return ((sfc_sfont*)fluid_sfont_get_data(sfont))->entry->path;
+}
+static fluid_preset_t* sfc_sfont_get_preset(fluid_sfont_t* sfont,
+  int bank, int num) {
+	sfc_sfont* sf = (sfc_sfont*)fluid_sfont_get_data(sfont);
+	int i;
+	for (i = 0; i < sf->entry->npresets; i++) {
+		if (sf->entry->presets[i].bank == bank
+		  && sf->entry->presets[i].num == num) { return sf->presets[i]; }
+	}
+	return NULL;
+}
+static void sfc_sfont_iteration_start(fluid_sfont_t* sfont) {
+	((sfc_sfont*)fluid_sfont_get_data(sfont))->iter = 0;
+}
+static fluid_preset_t* sfc_sfont_iteration_next(fluid_sfont_t* sfont) {
+	sfc_sfont* sf = (sfc_sfont*)fluid_sfont_get_data(sfont);
+	while (sf->iter < sf->entry->npresets) {
+		int i = sf->iter++;
+		if (sf->entry->presets[i].bank >= 0) { return sf->presets[i]; }
+	}
+	return NULL;
+}
+static void sfc_sfont_delete(sfc_sfont* sf) {   /* with its samples */
+	int i;
+	for (i = 0; sf->samples && i < sf->entry->nsamples; i++) {
+		if (sf->samples[i]) { delete_fluid_sample(sf->samples[i]); }
+	}
+	sfc_release(sf->entry);
+	free(sf->presets);
+	free(sf->samples);
+	free(sf);
+}
+static int sfc_sfont_free(fluid_sfont_t* sfont) {
+	/* fluidsynth only calls this once no channel uses the presets, but
+	   voices may still be playing the samples; so those are put on the
+	   synth's list, and freed after delete_fluid_synth */
+	sfc_sfont* sf = (sfc_sfont*)fluid_sfont_get_data(sfont);
+	int i;
+	for (i = 0; i < sf->entry->npresets; i++) {
+		if (sf->presets[i]) { sfc_preset_free(sf->presets[i]); }
+		sf->presets[i] = NULL;
+	}
+	delete_fluid_sfont(sfont);
+	pthread_mutex_lock(&sfc_mutex);
+	sf->next = *(sf->unloaded);
+	*(sf->unloaded) = sf;
+	pthread_mutex_unlock(&sfc_mutex);
+	return FLUID_OK;
+}
+static void sfc_free_unloaded(struct sfc_sfont** unloaded) {
+	sfc_sfont* sf;
+	pthread_mutex_lock(&sfc_mutex);
+	sf = *unloaded;
+	*unloaded = NULL;
+	pthread_mutex_unlock(&sfc_mutex);
+	while (sf) {
+		sfc_sfont* next = sf->next;
+		sfc_sfont_delete(sf);
+		sf = next;
+	}
+}
+
+static fluid_sfont_t* sfc_load(fluid_sfloader_t* loader,
+  const char* filename) {
+	sfc_sfont*     sf;
+	fluid_sfont_t* sfont;
+	sfc_entry*     e;
+	int i;
+	if (sfc_mode == 'o') { return NULL; }   /* the default loader will */
+	e = sfc_acquire(filename);
+	if (!e) { return NULL; }
+	sf = calloc(1, sizeof(sfc_sfont));
+	if (sf) {
+		sf->presets = calloc(e->npresets+1, sizeof(fluid_preset_t*));
+		sf->samples = calloc(e->nsamples+1, sizeof(fluid_sample_t*));
+	}
+	sfont = new_fluid_sfont(sfc_sfont_get_name, sfc_sfont_get_preset,
+	  sfc_sfont_iteration_start, sfc_sfont_iteration_next, sfc_sfont_free);
+	if (!sf || !sf->presets || !sf->samples || !sfont) {
+		if (sfont) { delete_fluid_sfont(sfont); }
+		if (sf) { free(sf->presets); free(sf->samples); }
+		free(sf);
+		sfc_release(e);
+		return NULL;
+	}
+	sf->entry = e;
+	sf->unloaded = (sfc_sfont**)fluid_sfloader_get_data(loader);
+	fluid_sfont_set_data(sfont, sf);
+	for (i = 0; i < e->nsamples; i++) {   /* wrapping the shared data */
+		sfc_sample* s = &(e->samples[i]);
+		fluid_sample_t* sample;
+		if (!s->ok) { continue; }
+		sample = new_fluid_sample();
+		if (!sample) { sfc_sfont_free(sfont); return NULL; }
+		sf->samples[i] = sample;
+		fluid_sample_set_name(sample, s->name);
+		fluid_sample_set_sound_data(sample, s->data, s->data24,
+		  s->nframes, s->rate, 0);
+		fluid_sample_set_loop(sample, s->loopstart, s->loopend);
+		fluid_sample_set_pitch(sample, s->pitch, s->pitchadj);
+		fluid_voice_optimize_sample(sample);
+	}
+	for (i = 0; i < e->npresets; i++) {
+		sf->presets[i] = new_fluid_preset(sfont, sfc_preset_get_name,
+		  sfc_preset_get_banknum, sfc_preset_get_num,
+		  sfc_preset_noteon, sfc_preset_free);
+		if (!sf->presets[i]) { sfc_sfont_free(sfont); return NULL; }
+		fluid_preset_set_data(sf->presets[i], &(e->presets[i]));
+	}
+	return sfont;
+}
+static void add_sfc_loader(fluid_synth_t* synth, sfc_sfont** unloaded) {
+	fluid_sfloader_t* loader = new_fluid_sfloader(sfc_load,
+	  delete_fluid_sfloader);
+	if (!loader) { return; }
+	fluid_sfloader_set_data(loader, unloaded);
+	fluid_synth_add_sfloader(synth, loader);
+}
+
+static int c_sf_cache(lua_State *L) {  /* mode */
+	/* sets the mode, if given; returns the old mode, and an array
+	   describing the SoundFonts now in the cache */
+	const char* old = sfc_mode=='m' ? "mmap" : sfc_mode=='r' ? "read" : "off";
+	sfc_entry* e;
+	int i = 0;
+	if (lua_isstring(L, 1)) {
+		const char* mode = lua_tostring(L, 1);
+		if (strcmp(mode,"mmap") && strcmp(mode,"read") && strcmp(mode,"off")) {
+			return luaL_error(L,
+			  "sf_cache: mode must be 'mmap', 'read' or 'off', not '%s'", mode);
+		}
+		sfc_mode = mode[0];
+	}
+	lua_pushstring(L, old);
+	lua_newtable(L);
+	pthread_mutex_lock(&sfc_mutex);
+	for (e = sfc_entries; e; e = e->next) {
+		lua_createtable(L, 0, 6);
+		lua_pushstring(L, e->path);           lua_setfield(L, -2, "filename");
+		lua_pushinteger(L, (lua_Integer)e->mtime); lua_setfield(L, -2, "mtime");
+		lua_pushinteger(L, (lua_Integer)e->size);  lua_setfield(L, -2, "size");
+		lua_pushinteger(L, e->refcount);      lua_setfield(L, -2, "refcount");
+		lua_pushinteger(L, e->npresets);      lua_setfield(L, -2, "presets");
+		lua_pushboolean(L, e->is_mmap);       lua_setfield(L, -2, "mmap");
+		lua_rawseti(L, -2, ++i);
+	}
+	pthread_mutex_unlock(&sfc_mutex);
+	return 2;
+}
+#else   /* fluidsynth 1, whose fluid_sfloader_t is quite different */
+static void add_sfc_loader(fluid_synth_t* synth, struct sfc_sfont** unloaded) {
+	(void)synth; (void)unloaded;
+}
+static void sfc_free_unloaded(struct sfc_sfont** unloaded) { (void)unloaded; }
+static int c_sf_cache(lua_State *L) {
+	lua_pushstring(L, "off");
+	lua_newtable(L);
+	return 2;
+}
+#endif
+
 static int c_fluid_synth_sfload(lua_State *L) {  /* synth,filename,reassign */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	const char* filename = lua_tostring(L, 2);
 	int reassign_presets = lua_toboolean(L, 3);
 	int rc = fluid_synth_sfload(synth, filename, reassign_presets);
@@ -225,7 +1069,7 @@ static int c_fluid_synth_sfload(lua_State *L) {  /* synth,filename,reassign */
 }
 
 static int c_fluid_synth_sfont_select(lua_State *L) {  /* synth,cha,sfid */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	lua_Integer channel = lua_tointeger(L, 2);
 	lua_Integer sf_id   = lua_tointeger(L, 3);
 	int rc = fluid_synth_sfont_select(synth, channel, sf_id);
@@ -235,15 +1079,15 @@ static int c_fluid_synth_sfont_select(lua_State *L) {  /* synth,cha,sfid */
 }
 
 static int c_fluid_player_add(lua_State *L) {  /* player,midifilename */
-	fluid_player_t* player = players[lua_tointeger(L, 1)];
+	fluid_player_t* player = check_player(L, 1);
 	const char* filename = lua_tostring(L, 2);
 	int rc = fluid_player_add(player, filename);
 	if (rc == FLUID_FAILED) { lua_pushnil(L); return 1; }
 	lua_pushinteger(L, rc);
 	return 1;
 }
-static int c_fluid_player_play(lua_State *L) {  /* playernum */
-	fluid_player_t* player = players[lua_tointeger(L, 1)];
+static int c_fluid_player_play(lua_State *L) {  /* player */
+	fluid_player_t* player = check_player(L, 1);
 	int rc = fluid_player_play(player);
    	lua_pushinteger(L, rc);
 	if (rc == FLUID_FAILED) { lua_pushnil(L); return 1; }
@@ -254,11 +1098,16 @@ static int c_fluid_player_play(lua_State *L) {  /* playernum */
 sourceforge.net/p/fluidsynth/code-git/ci/master/tree/fluidsynth/src/fluidsynth.c
 */
 static int c_fast_render_loop(lua_State *L) {
-	fluid_synth_t*       synth = synths[lua_tointeger(L, 1)];
-	fluid_player_t*     player = players[lua_tointeger(L, 2)];
+	fluid_synth_t*       synth = check_synth(L, 1);
+	fluid_player_t*     player = check_player(L, 2);
+	synth_stats*            st = &(check_synth_handle(L, 1)->stats);
+	int             block_size = 64;
 	fluid_file_renderer_t* renderer = new_fluid_file_renderer (synth);
 	if (!renderer) return 0;
+	fluid_settings_getint(check_settings(L, 1), "audio.period-size",
+	  &block_size);
 	while (fluid_player_get_status(player) == FLUID_PLAYER_PLAYING) {
+		double started = now_seconds();
 /*
    fluidsynth: error:
      fluid_rvoice_event_dispatch: Unknown method (nil) to dispatch!
@@ -266,20 +1115,443 @@ static int c_fast_render_loop(lua_State *L) {
    Should usleep here for 0.1 sec or so, no ?
 */
 		if (fluid_file_renderer_process_block(renderer) != FLUID_OK) { break; }
+		note_block(st, synth, block_size, started);
 	}
 	delete_fluid_file_renderer(renderer);
    	lua_pushboolean(L, 1);
 	return 1;
-} 
+}
+/* 2.4 rendering into memory instead of into audio.file.name.
+   The samples are interleaved left,right and are returned to Lua as a
+   string of native-endian floats (format "float") or int16s ("s16").
+*/
+static int render_frames(fluid_synth_t* synth, int is_float,
+  char* buffer, int nframes) {
+	if (is_float) {
+		return fluid_synth_write_float(synth, nframes,
+		  (float*)buffer, 0, 2, (float*)buffer, 1, 2);
+	}
+	return fluid_synth_write_s16(synth, nframes,
+	  (short*)buffer, 0, 2, (short*)buffer, 1, 2);
+}
+static int format_is_float(lua_State *L, int index) {
+	const char* format = luaL_optstring(L, index, "s16");
+	if (!strcmp(format, "float")) { return 1; }
+	if (!strcmp(format, "s16"))   { return 0; }
+	return luaL_error(L, "render: format must be 'float' or 's16', not '%s'",
+	  format);
+}
+static int c_render_block(lua_State *L) {  /* synth,nframes,format */
+	fluid_synth_t* synth = check_synth(L, 1);
+	int          nframes = (int)luaL_checkinteger(L, 2);
+	int         is_float = format_is_float(L, 3);
+	size_t  frame_length = is_float ? 2*sizeof(float) : 2*sizeof(short);
+	char* buffer;
+	double started;
+	if (nframes < 0) { lua_pushnil(L); return 1; }
+	buffer = malloc(frame_length * nframes + 1);
+	if (!buffer) { lua_pushnil(L); return 1; }
+	started = now_seconds();
+	if (render_frames(synth, is_float, buffer, nframes) != FLUID_OK) {
+		free(buffer); lua_pushnil(L); return 1;
+	}
+	note_block(&(check_synth_handle(L, 1)->stats), synth, nframes, started);
+	lua_pushlstring(L, buffer, frame_length * nframes);
+	free(buffer);
+	return 1;
+}
+static long render_player(fluid_synth_t* synth, fluid_settings_t* settings,
+  fluid_player_t* player, long max_frames, int is_float, char** bufferp,
+  synth_stats* st) {
+	/* renders player into a malloc'd buffer, until it stops or until
+	   max_frames (<0 means unlimited); returns nframes, or -1 if no memory.
+	   No Lua here, because the batch-rendering threads also use it */
+	size_t  frame_length = is_float ? 2*sizeof(float) : 2*sizeof(short);
+	int       block_size = 64;
+	long         nframes = 0;
+	long       allocated = 0;
+	char* buffer = NULL;
+	fluid_settings_getint(settings, "audio.period-size", &block_size);
+	if (block_size < 1) { block_size = 64; }
+	if (fluid_player_get_status(player) == FLUID_PLAYER_READY) {
+		fluid_player_play(player);
+	}
+	while (fluid_player_get_status(player) == FLUID_PLAYER_PLAYING) {
+		int n = block_size;
+		double started;
+		if (max_frames >= 0) {
+			if (nframes >= max_frames) { break; }
+			if (max_frames - nframes < n) { n = (int)(max_frames - nframes); }
+		}
+		if (nframes + n > allocated) {   /* grow geometrically */
+			long new_allocated = allocated ? 2*allocated : 16*block_size;
+			char* new_buffer;
+			while (new_allocated < nframes + n) { new_allocated *= 2; }
+			new_buffer = realloc(buffer, frame_length * new_allocated);
+			if (!new_buffer) { free(buffer); *bufferp = NULL; return -1; }
+			buffer = new_buffer;
+			allocated = new_allocated;
+		}
+		started = now_seconds();
+		if (render_frames(synth, is_float,
+		  buffer + frame_length*nframes, n) != FLUID_OK) { break; }
+		note_block(st, synth, n, started);
+		nframes += n;
+	}
+	*bufferp = buffer;
+	return nframes;
+}
+static int c_render_to_buffer(lua_State *L) {
+	/* synth,player,max_frames,format; max_frames<0 means unlimited */
+	fluid_synth_t*        synth = check_synth(L, 1);
+	fluid_player_t*      player = check_player(L, 2);
+	long             max_frames = (long)luaL_optinteger(L, 3, -1);
+	int                is_float = format_is_float(L, 4);
+	size_t         frame_length = is_float ? 2*sizeof(float) : 2*sizeof(short);
+	char* buffer = NULL;
+	long nframes = render_player(synth, check_settings(L, 1), player,
+	  max_frames, is_float, &buffer, &(check_synth_handle(L, 1)->stats));
+	if (nframes < 0) { lua_pushnil(L); return 1; }
+	lua_pushlstring(L, buffer ? buffer : "", frame_length * nframes);
+	lua_pushinteger(L, nframes);
+	free(buffer);
+	return 2;
+}
+/* 2.4 stats, to see how close a synth is to underrunning */
+static int compare_floats(const void* a, const void* b) {
+	float fa = *(const float*)a, fb = *(const float*)b;
+	return (fa > fb) - (fa < fb);
+}
+static int c_synth_stats(lua_State *L) {  /* synth,reset */
+	synth_handle*  h     = check_synth_handle(L, 1);
+	fluid_synth_t* synth = check_synth(L, 1);
+	synth_stats    st;
+	player_handle* p;
+	float  recent[STATS_NBLOCKS];
+	double sample_rate = 44100.0;
+	long   frames, blocks, hits, n, i;
+	int    nplaying = 0;
+	read_stats(&(h->stats), &st);
+	/* the audio thread owns the counters, so a reset only moves the
+	   baseline they are counted from */
+	frames = st.frames - h->reset_frames;
+	blocks = st.blocks - h->reset_blocks;
+	hits   = st.polyphony_hits - h->reset_hits;
+	n = blocks < STATS_NBLOCKS ? blocks : STATS_NBLOCKS;
+	for (i = 0; i < n; i++) {   /* the most recent first */
+		recent[i] = st.block_us[(st.blocks - 1 - i) % STATS_NBLOCKS];
+	}
+	if (lua_toboolean(L, 2)) {
+		h->reset_frames = st.frames;
+		h->reset_hits   = st.polyphony_hits;
+		h->reset_blocks = st.blocks;
+	}
+	fluid_settings_getnum(h->settings, "synth.sample-rate", &sample_rate);
+	for (p = h->players; p; p = p->next) {
+		if (fluid_player_get_status(p->player) == FLUID_PLAYER_PLAYING) {
+			nplaying++;
+		}
+	}
+	lua_createtable(L, 0, 14);
+	lua_pushnumber(L, fluid_synth_get_cpu_load(synth));
+	lua_setfield(L, -2, "cpu_load");
+	lua_pushinteger(L, fluid_synth_get_active_voice_count(synth));
+	lua_setfield(L, -2, "active_voices");
+	lua_pushinteger(L, fluid_synth_get_polyphony(synth));
+	lua_setfield(L, -2, "polyphony");
+	lua_pushinteger(L, hits);        lua_setfield(L, -2, "polyphony_hits");
+	lua_pushinteger(L, frames);      lua_setfield(L, -2, "frames");
+	lua_pushinteger(L, blocks);      lua_setfield(L, -2, "blocks");
+	lua_pushinteger(L, nplaying);    lua_setfield(L, -2, "playing");
+	if (h->untimed) { lua_pushboolean(L, 1); lua_setfield(L, -2, "untimed"); }
+	if (n > 0 && st.last_nframes > 0 && sample_rate > 0.0) {
+		lua_pushnumber(L, 1.0e6 * st.last_nframes / sample_rate);
+		lua_setfield(L, -2, "block_budget_us");
+	}
+	if (n > 0) {   /* percentiles of the recent render times */
+		qsort(recent, n, sizeof(float), compare_floats);
+		lua_pushnumber(L, recent[(n-1)*50/100]);
+		lua_setfield(L, -2, "block_us_p50");
+		lua_pushnumber(L, recent[(n-1)*90/100]);
+		lua_setfield(L, -2, "block_us_p90");
+		lua_pushnumber(L, recent[(n-1)*99/100]);
+		lua_setfield(L, -2, "block_us_p99");
+		lua_pushnumber(L, recent[n-1]);
+		lua_setfield(L, -2, "block_us_max");
+	}
+	return 1;
+}
+
+/* 2.4 render_batch renders many midi files at once, in a pool of
+   threads each with its own settings and synth.  All the strings and
+   settings are copied out of the Lua tables before the threads start,
+   and the results are pushed back after they have all been joined,
+   so the worker threads never touch the lua_State.
+*/
+typedef struct batch_setting {
+	const char* key;
+	int         type;       /* 'i', 'n' or 's' */
+	lua_Number  num;
+	const char* str;
+} batch_setting;
+typedef struct batch_job {
+	const char* midi;       /* a filename, or in-memory midi data */
+	size_t      midi_len;   /* 0 if midi is a filename */
+	const char* output;     /* a filename, or NULL to render into memory */
+	const char* error;      /* NULL if the job succeeded */
+	char*       pcm;
+	long        nframes;
+	double      seconds;
+	int         worker;
+} batch_job;
+typedef struct batch_t {
+	batch_job*      jobs;
+	int             njobs;
+	int             next_job;
+	pthread_mutex_t mutex;
+	batch_setting*  settings;
+	int             nsettings;
+	const char**    soundfonts;
+	int             nsoundfonts;
+	int             is_float;
+} batch_t;
+typedef struct batch_worker {
+	batch_t*  batch;
+	int       worker;
+	pthread_t thread;
+} batch_worker;
+
+static void render_batch_job(batch_t* b, batch_job* job,
+  fluid_settings_t* settings, fluid_synth_t* synth) {
+	fluid_player_t* player = new_fluid_player(synth);
+	int rc;
+	if (!player) { job->error = "new_fluid_player failed"; return; }
+	if (job->midi_len) {
+		rc = fluid_player_add_mem(player, job->midi, job->midi_len);
+	} else {
+		rc = fluid_player_add(player, job->midi);
+	}
+	if (rc == FLUID_FAILED) {
+		job->error = "fluid_player_add failed";
+	} else if (job->output) {   /* like fast_render_loop */
+		fluid_file_renderer_t* renderer;
+		int block_size = 64;
+		fluid_settings_getint(settings, "audio.period-size", &block_size);
+		fluid_settings_setstr(settings, "audio.file.name", job->output);
+		renderer = new_fluid_file_renderer(synth);
+		if (!renderer) {
+			job->error = "new_fluid_file_renderer failed";
+		} else {
+			fluid_player_play(player);
+			while (fluid_player_get_status(player) == FLUID_PLAYER_PLAYING) {
+				if (fluid_file_renderer_process_block(renderer) != FLUID_OK) {
+					break;
+				}
+				job->nframes += block_size;
+			}
+			delete_fluid_file_renderer(renderer);
+		}
+	} else {
+		job->nframes = render_player(synth, settings, player, -1,
+		  b->is_float, &(job->pcm), NULL);
+		if (job->nframes < 0) {
+			job->nframes = 0; job->error = "out of memory";
+		}
+	}
+	fluid_player_stop(player);
+	delete_fluid_player(player);
+	fluid_synth_system_reset(synth);   /* don't let the tail leak over */
+}
+
+static void* batch_worker_main(void* arg) {
+	batch_worker*     w = (batch_worker*)arg;
+	batch_t*          b = w->batch;
+	fluid_settings_t* settings;
+	fluid_synth_t*    synth    = NULL;
+	const char*       error    = NULL;
+	struct sfc_sfont* unloaded = NULL;
+	int i;
+	/* the library's one-off initialisation is not thread-safe */
+	pthread_mutex_lock(&(b->mutex));
+	settings = new_fluid_settings();
+	if (!settings) {
+		error = "new_fluid_settings failed";
+	} else {
+		for (i = 0; i < b->nsettings; i++) {
+			batch_setting* bs = &(b->settings[i]);
+			if (!bs->key) { continue; }
+			if (bs->type == 's') {
+				fluid_settings_setstr(settings, bs->key, bs->str);
+			} else if (bs->type == 'n') {
+				fluid_settings_setnum(settings, bs->key, bs->num);
+			} else {
+				fluid_settings_setint(settings, bs->key, (int)bs->num);
+			}
+		}
+		/* the player must keep time with the rendering, not the clock */
+		fluid_settings_setstr(settings, "player.timing-source", "sample");
+		synth = new_fluid_synth(settings);
+		if (!synth) { error = "new_fluid_synth failed"; }
+		else { add_sfc_loader(synth, &unloaded); }   /* they share SoundFonts */
+	}
+	pthread_mutex_unlock(&(b->mutex));
+	for (i = 0; synth && i < b->nsoundfonts; i++) {
+		if (!b->soundfonts[i]
+		  || fluid_synth_sfload(synth, b->soundfonts[i], 1) == FLUID_FAILED) {
+			error = "fluid_synth_sfload failed";
+			break;
+		}
+	}
+	while (1) {
+		batch_job* job;
+		double started;
+		pthread_mutex_lock(&(b->mutex));
+		i = b->next_job++;
+		pthread_mutex_unlock(&(b->mutex));
+		if (i >= b->njobs) { break; }
+		job = &(b->jobs[i]);
+		job->worker = w->worker;
+		started = now_seconds();
+		if (error) { job->error = error; }
+		else if (!job->error) { render_batch_job(b, job, settings, synth); }
+		job->seconds = now_seconds() - started;
+	}
+	if (synth)    { delete_fluid_synth(synth); }
+	sfc_free_unloaded(&unloaded);
+	if (settings) { delete_fluid_settings(settings); }
+	return NULL;
+}
+
+static int c_render_batch(lua_State *L) {
+	/* jobs,settings,soundfonts,nthreads,format   where jobs is an array
+	   of {midi=,is_data=,output=}, and settings an array of {key,type,val}
+	   returns an array of {seconds=,frames=,worker=,pcm=|output=|error=}
+	   and the total elapsed seconds */
+	batch_t b;
+	batch_worker* workers;
+	int     nthreads = (int)luaL_optinteger(L, 4, 0);
+	size_t  frame_length;
+	double  started;
+	int i;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	b.is_float    = format_is_float(L, 5);
+	frame_length  = b.is_float ? 2*sizeof(float) : 2*sizeof(short);
+	b.njobs       = (int)lua_rawlen(L, 1);
+	b.nsettings   = (int)lua_rawlen(L, 2);
+	b.nsoundfonts = (int)lua_rawlen(L, 3);
+	b.next_job    = 0;
+	b.jobs       = calloc(b.njobs+1,       sizeof(batch_job));
+	b.settings   = calloc(b.nsettings+1,   sizeof(batch_setting));
+	b.soundfonts = calloc(b.nsoundfonts+1, sizeof(const char*));
+	if (!b.jobs || !b.settings || !b.soundfonts) {
+		free(b.jobs); free(b.settings); free(b.soundfonts);
+		lua_pushnil(L); return 1;
+	}
+	/* the strings stay valid because the tables stay on the stack; but
+	   only the values which are already strings, since lua_tostring
+	   converts a number in a copy which is popped straight away */
+	for (i = 0; i < b.njobs; i++) {
+		batch_job* job = &(b.jobs[i]);
+		lua_rawgeti(L, 1, i+1);
+		lua_getfield(L, -1, "midi");
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			job->midi = lua_tolstring(L, -1, &(job->midi_len));
+		}
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "is_data");
+		if (!lua_toboolean(L, -1)) { job->midi_len = 0; }
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "output");
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			job->output = lua_tostring(L, -1);
+		} else if (!lua_isnil(L, -1)) {
+			job->error = "output is not a string";
+		}
+		lua_pop(L, 2);
+		if (!job->midi) { job->error = "no midi"; }
+	}
+	for (i = 0; i < b.nsettings; i++) {
+		batch_setting* bs = &(b.settings[i]);
+		lua_rawgeti(L, 2, i+1);
+		lua_rawgeti(L, -1, 1);
+		if (lua_type(L, -1) == LUA_TSTRING) { bs->key = lua_tostring(L, -1); }
+		lua_rawgeti(L, -2, 2);
+		bs->type = 's';
+		if (lua_type(L, -1) == LUA_TSTRING) { bs->type = lua_tostring(L, -1)[0]; }
+		lua_rawgeti(L, -3, 3);
+		if (bs->type != 's') { bs->num = lua_tonumber(L, -1); }
+		else if (lua_type(L, -1) == LUA_TSTRING) { bs->str = lua_tostring(L, -1); }
+		else { bs->key = NULL; }   /* so it isn't set */
+		lua_pop(L, 4);
+	}
+	for (i = 0; i < b.nsoundfonts; i++) {
+		lua_rawgeti(L, 3, i+1);
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			b.soundfonts[i] = lua_tostring(L, -1);
+		}
+		lua_pop(L, 1);
+	}
+	if (nthreads < 1) { nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN); }
+	if (nthreads > b.njobs) { nthreads = b.njobs; }
+	if (nthreads < 1) { nthreads = 1; }
+	workers = calloc(nthreads, sizeof(batch_worker));
+	if (!workers) {
+		free(b.jobs); free(b.settings); free(b.soundfonts);
+		lua_pushnil(L); return 1;
+	}
+	pthread_mutex_init(&(b.mutex), NULL);
+	started = now_seconds();
+	for (i = 0; i < nthreads; i++) {
+		workers[i].batch  = &b;
+		workers[i].worker = i+1;
+		if (pthread_create(&(workers[i].thread), NULL,
+		  batch_worker_main, &(workers[i]))) {
+			workers[i].batch = NULL;   /* the others will do its jobs */
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (workers[i].batch) { pthread_join(workers[i].thread, NULL); }
+	}
+	if (b.next_job < b.njobs) {   /* no thread could be started */
+		workers[0].batch = &b;
+		workers[0].worker = 0;
+		batch_worker_main(&(workers[0]));
+	}
+	lua_createtable(L, b.njobs, 0);
+	for (i = 0; i < b.njobs; i++) {
+		batch_job* job = &(b.jobs[i]);
+		lua_createtable(L, 0, 4);
+		lua_pushnumber(L, job->seconds);   lua_setfield(L, -2, "seconds");
+		lua_pushinteger(L, job->nframes);  lua_setfield(L, -2, "frames");
+		lua_pushinteger(L, job->worker);   lua_setfield(L, -2, "worker");
+		if (job->error) {
+			lua_pushstring(L, job->error); lua_setfield(L, -2, "error");
+		} else if (job->output) {
+			lua_pushstring(L, job->output); lua_setfield(L, -2, "output");
+		} else {
+			lua_pushlstring(L, job->pcm ? job->pcm : "",
+			  frame_length * job->nframes);
+			lua_setfield(L, -2, "pcm");
+		}
+		free(job->pcm);
+		lua_rawseti(L, -2, i+1);
+	}
+	lua_pushnumber(L, now_seconds() - started);
+	pthread_mutex_destroy(&(b.mutex));
+	free(workers); free(b.jobs); free(b.settings); free(b.soundfonts);
+	return 2;
+}
 static int c_fluid_player_join(lua_State *L) {  /* player */
-	fluid_player_t* player = players[lua_tointeger(L, 1)];
+	fluid_player_t* player = check_player(L, 1);
 	int rc = fluid_player_join(player);
 	if (rc == FLUID_FAILED) { lua_pushnil(L); return 1; }
 	lua_pushinteger(L, rc);
 	return 1;
 }
 static int c_fluid_player_stop(lua_State *L) {  /* player */
-	fluid_player_t* player = players[lua_tointeger(L, 1)];
+	fluid_player_t* player = check_player(L, 1);
 	int rc = fluid_player_stop(player);
 	if (rc == FLUID_FAILED) { lua_pushnil(L); return 1; }
 	lua_pushinteger(L, rc);
@@ -287,7 +1559,7 @@ static int c_fluid_player_stop(lua_State *L) {  /* player */
 }
 
 static int c_fluid_synth_program_change(lua_State *L) { /* synth,cha,patch */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	lua_Integer channel = lua_tointeger(L, 2);
 	lua_Integer program = lua_tointeger(L, 3);
 	int rc = fluid_synth_program_change(synth, channel, program);
@@ -297,7 +1569,7 @@ static int c_fluid_synth_program_change(lua_State *L) { /* synth,cha,patch */
 }
 
 static int c_fluid_synth_cc(lua_State *L) { /* synth,cha,cc,val */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	lua_Integer cha = lua_tointeger(L, 2);
 	lua_Integer cc  = lua_tointeger(L, 3);
 	lua_Integer val = lua_tointeger(L, 4);
@@ -308,7 +1580,7 @@ static int c_fluid_synth_cc(lua_State *L) { /* synth,cha,cc,val */
 }
 
 static int c_fluid_synth_noteon(lua_State *L) { /* synth,cha,note,vel */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	int cha  = lua_tointeger(L, 2);
 	int note = lua_tointeger(L, 3);
 	int vel  = lua_tointeger(L, 4);
@@ -319,7 +1591,7 @@ static int c_fluid_synth_noteon(lua_State *L) { /* synth,cha,note,vel */
 }
 
 static int c_fluid_synth_noteoff(lua_State *L) {  /* synth,cha,note */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	lua_Integer cha  = lua_tointeger(L, 2);
 	lua_Integer note = lua_tointeger(L, 3);
 	int rc = fluid_synth_noteoff(synth, cha, note);
@@ -329,7 +1601,7 @@ static int c_fluid_synth_noteoff(lua_State *L) {  /* synth,cha,note */
 }
 
 static int c_fluid_synth_pitch_bend(lua_State *L) { /* synth,cha,val=0-16383 */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	lua_Integer cha  = lua_tointeger(L, 2);
 	lua_Integer val  = lua_tointeger(L, 3);
 	int rc = fluid_synth_pitch_bend(synth, cha, val);
@@ -339,7 +1611,7 @@ static int c_fluid_synth_pitch_bend(lua_State *L) { /* synth,cha,val=0-16383 */
 }
 
 static int c_fluid_synth_pitch_bend_sens(lua_State *L) { /* synth,cha,val */
-	fluid_synth_t* synth = synths[(int)luaL_checkinteger(L, 1)];
+	fluid_synth_t* synth = check_synth(L, 1);
 	lua_Integer cha  = lua_tointeger(L, 2);
 	lua_Integer val  = lua_tointeger(L, 3);
 	/* pitch wheel semi-range in semitones, default 2 semitones
@@ -350,6 +1622,193 @@ static int c_fluid_synth_pitch_bend_sens(lua_State *L) { /* synth,cha,val */
 	return 1;
 }
 
+/* 2.4 queue_events puts a whole array of timed events onto a
+   fluid_sequencer_t in one call, so that they are played by the synth's
+   own clock with no Lua on the way.  The sequencer does not use the
+   system timer; fluid_sequencer_register_fluidsynth then makes the synth
+   advance it as samples are rendered, which keeps the timing exact in
+   render_to_buffer and fast.render as well as with an audio driver.
+   Its time-scale is the default, 1000 ticks per second, ie. ms.
+*/
+static fluid_sequencer_t* synth_sequencer(synth_handle* h) {
+	if (h->sequencer || !h->synth) { return h->sequencer; }
+	h->sequencer = new_fluid_sequencer2(0);
+	if (!h->sequencer) { return NULL; }
+	h->synth_seq_id = fluid_sequencer_register_fluidsynth(h->sequencer,
+	  h->synth);
+	if (h->synth_seq_id == FLUID_FAILED) {
+		delete_fluid_sequencer(h->sequencer);
+		h->sequencer = NULL;
+	}
+	return h->sequencer;
+}
+/* the MIDI.lua event types that a synth can play */
+enum { EV_NONE, EV_NOTE, EV_NOTE_ON, EV_NOTE_OFF, EV_CONTROL_CHANGE,
+  EV_PATCH_CHANGE, EV_PITCH_WHEEL_CHANGE, EV_CHANNEL_AFTER_TOUCH,
+  EV_KEY_AFTER_TOUCH };
+static int get_midi_event(lua_State *L, int index, int* v) {
+	/* returns the type of the MIDI.lua event at index, and its fields
+	   after the time in v[0..3]; EV_NONE if it is not one a synth can
+	   play, eg. a set_tempo or a text_event */
+	const char* type;
+	int ev = EV_NONE, i;
+	lua_rawgeti(L, index, 1);
+	type = lua_tostring(L, -1);
+	lua_pop(L, 1);
+	if (!type) { return EV_NONE; }
+	switch (type[0]) {   /* don't strcmp all of them */
+		case 'n':
+			if      (!strcmp(type, "note"))     { ev = EV_NOTE; }
+			else if (!strcmp(type, "note_on"))  { ev = EV_NOTE_ON; }
+			else if (!strcmp(type, "note_off")) { ev = EV_NOTE_OFF; }
+			break;
+		case 'c':
+			if (!strcmp(type, "control_change")) { ev = EV_CONTROL_CHANGE; }
+			else if (!strcmp(type, "channel_after_touch")) {
+				ev = EV_CHANNEL_AFTER_TOUCH;
+			}
+			break;
+		case 'p':
+			if (!strcmp(type, "patch_change")) { ev = EV_PATCH_CHANGE; }
+			else if (!strcmp(type, "pitch_wheel_change")) {
+				ev = EV_PITCH_WHEEL_CHANGE;
+			}
+			break;
+		case 'k':
+			if (!strcmp(type, "key_after_touch")) { ev = EV_KEY_AFTER_TOUCH; }
+			break;
+	}
+	if (ev == EV_NONE) { return EV_NONE; }
+	for (i = 0; i < 4; i++) {
+		lua_rawgeti(L, index, i+3);
+		v[i] = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	if (ev == EV_NOTE_ON && v[2] == 0) { ev = EV_NOTE_OFF; }
+	return ev;
+}
+static int set_midi_event(lua_State *L, fluid_event_t* evt, int index) {
+	/* the MIDI.lua event at index into evt, or 0 if it can't be played */
+	int v[4];
+	switch (get_midi_event(L, index, v)) {
+		case EV_NOTE:   /* note, start, duration, cha, note, vel */
+			fluid_event_note(evt, v[1], (short)v[2], (short)v[3],
+			  (unsigned int)v[0]);
+			break;
+		case EV_NOTE_ON:
+			fluid_event_noteon(evt, v[0], (short)v[1], (short)v[2]);  break;
+		case EV_NOTE_OFF:
+			fluid_event_noteoff(evt, v[0], (short)v[1]);  break;
+		case EV_CONTROL_CHANGE:
+			fluid_event_control_change(evt, v[0], (short)v[1], v[2]);  break;
+		case EV_PATCH_CHANGE:
+			fluid_event_program_change(evt, v[0], v[1]);  break;
+		case EV_PITCH_WHEEL_CHANGE:   /* -8192..8191 */
+			fluid_event_pitch_bend(evt, v[0], v[1] + 8192);  break;
+		case EV_CHANNEL_AFTER_TOUCH:
+			fluid_event_channel_pressure(evt, v[0], v[1]);  break;
+		case EV_KEY_AFTER_TOUCH:
+			fluid_event_key_pressure(evt, v[0], (short)v[1], v[2]);  break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+/* 2.4 send_events plays a whole array of MIDI.lua events immediately,
+   with one crossing from Lua into C instead of one per event */
+static int c_send_events(lua_State *L) {  /* synth,events */
+	/* returns the number of events that failed, and the number sent;
+	   'note' events, and those a synth can't play, are skipped */
+	fluid_synth_t* synth = check_synth(L, 1);
+	int nfailed = 0, nsent = 0, i, nevents, rc, v[4];
+	luaL_checktype(L, 2, LUA_TTABLE);
+	nevents = (int)lua_rawlen(L, 2);
+	for (i = 1; i <= nevents; i++) {
+		lua_rawgeti(L, 2, i);
+		if (lua_type(L, -1) != LUA_TTABLE) { lua_pop(L, 1); continue; }
+		switch (get_midi_event(L, lua_gettop(L), v)) {
+			case EV_NOTE_ON:
+				rc = fluid_synth_noteon(synth, v[0], v[1], v[2]);  break;
+			case EV_NOTE_OFF:
+				rc = fluid_synth_noteoff(synth, v[0], v[1]);  break;
+			case EV_CONTROL_CHANGE:
+				rc = fluid_synth_cc(synth, v[0], v[1], v[2]);  break;
+			case EV_PATCH_CHANGE:
+				rc = fluid_synth_program_change(synth, v[0], v[1]);  break;
+			case EV_PITCH_WHEEL_CHANGE:
+				rc = fluid_synth_pitch_bend(synth, v[0], v[1] + 8192);  break;
+			case EV_CHANNEL_AFTER_TOUCH:
+				rc = fluid_synth_channel_pressure(synth, v[0], v[1]);  break;
+			case EV_KEY_AFTER_TOUCH:
+				rc = fluid_synth_key_pressure(synth, v[0], v[1], v[2]);  break;
+			default:
+				lua_pop(L, 1);
+				continue;
+		}
+		if (rc == FLUID_FAILED) { nfailed++; } else { nsent++; }
+		lua_pop(L, 1);
+	}
+	lua_pushinteger(L, nfailed);
+	lua_pushinteger(L, nsent);
+	return 2;
+}
+
+static int c_queue_events(lua_State *L) {  /* synth,events,start_ms */
+	/* events is an array of MIDI.lua events whose times are absolute
+	   ms after start_ms from now; returns the number of events queued
+	   and the number the sequencer refused */
+	synth_handle*      h   = check_synth_handle(L, 1);
+	lua_Integer      start = luaL_optinteger(L, 3, 0);
+	fluid_sequencer_t* seq;
+	fluid_event_t*     evt;
+	unsigned int       now;
+	int n = 0, nfailed = 0, i, nevents;
+	check_synth(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	seq = synth_sequencer(h);
+	if (!seq) { lua_pushnil(L); lua_pushstring(L, "no sequencer"); return 2; }
+	evt = new_fluid_event();
+	if (!evt) { lua_pushnil(L); lua_pushstring(L, "no event"); return 2; }
+	fluid_event_set_source(evt, -1);
+	fluid_event_set_dest(evt, h->synth_seq_id);
+	now = fluid_sequencer_get_tick(seq);
+	nevents = (int)lua_rawlen(L, 2);
+	for (i = 1; i <= nevents; i++) {
+		lua_Number t;
+		lua_rawgeti(L, 2, i);
+		if (lua_type(L, -1) != LUA_TTABLE) { lua_pop(L, 1); continue; }
+		lua_rawgeti(L, -1, 2);
+		t = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+		if (set_midi_event(L, evt, lua_gettop(L))) {
+			long when = (long)start + (long)(t + 0.5);
+			if (when < 0) { when = 0; }
+			if (fluid_sequencer_send_at(seq, evt, now + (unsigned int)when, 1)
+			  == FLUID_OK) { n++; } else { nfailed++; }
+		}
+		lua_pop(L, 1);
+	}
+	delete_fluid_event(evt);
+	lua_pushinteger(L, n);
+	lua_pushinteger(L, nfailed);
+	return 2;
+}
+static int c_queue_clear(lua_State *L) {  /* synth */
+	synth_handle* h = check_synth_handle(L, 1);
+	if (h->sequencer) {
+		fluid_sequencer_remove_events(h->sequencer, -1, h->synth_seq_id, -1);
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+static int c_queue_time(lua_State *L) {  /* synth */
+	synth_handle* h = check_synth_handle(L, 1);
+	check_synth(L, 1);
+	if (!synth_sequencer(h)) { lua_pushnil(L); return 1; }
+	lua_pushinteger(L, fluid_sequencer_get_tick(h->sequencer));
+	return 1;
+}
+
 static int c_fluid_is_soundfont(lua_State *L) { /* filename */
 	const char* filename = lua_tostring(L, 1);
 	lua_pushboolean(L, fluid_is_soundfont(filename));
@@ -380,7 +1839,7 @@ static int c_fluid_get_userconf(lua_State *L) { /* fluidsynth/shell.h */
 
 static int c_fluid_player_add_mem(lua_State *L) { /* fluidsynth/midi.h */
 	/* (fluid_player_t* player, const void *buffer, size_t len) */
-	fluid_player_t* player = players[lua_tointeger(L, 1)];
+	fluid_player_t* player = check_player(L, 1);
 	const char *buffer = lua_tostring(L, 2);
 /* http://stackoverflow.com/questions/5547131/c-question-const-void-vs-void */
 	size_t length = (size_t)lua_tointeger(L, 3);
@@ -391,7 +1850,7 @@ static int c_fluid_player_add_mem(lua_State *L) { /* fluidsynth/midi.h */
 }
 
 static int c_fluid_settings_copystr(lua_State *L) {
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
+	fluid_settings_t* settings = check_settings(L, 1);
 	const char* key = lua_tostring(L, 2);
 	const int length = 1024;
 	char *buffer = malloc(length);
@@ -401,7 +1860,7 @@ static int c_fluid_settings_copystr(lua_State *L) {
 }
 
 static int c_fluid_settings_getnum(lua_State *L) {
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
+	fluid_settings_t* settings = check_settings(L, 1);
 	const char* key = lua_tostring(L, 2);
 	lua_Number val = 0.0;
 	int rc = fluid_settings_getnum(settings, key, &val);
@@ -410,7 +1869,7 @@ static int c_fluid_settings_getnum(lua_State *L) {
 }
 
 static int c_fluid_settings_getint(lua_State *L) {
-	fluid_settings_t* settings = settingses[(int)luaL_checkinteger(L, 1)];
+	fluid_settings_t* settings = check_settings(L, 1);
 	const char* key = lua_tostring(L, 2);
 	int         val = 0;
 	int rc = fluid_settings_getint(settings, key, &val);
@@ -458,6 +1917,15 @@ static const luaL_Reg prv[] = {  /* private functions */
     {"fluid_player_add",           c_fluid_player_add},
     {"fluid_player_play",          c_fluid_player_play},
     {"fast_render_loop",           c_fast_render_loop},
+    {"render_block",               c_render_block},
+    {"render_to_buffer",           c_render_to_buffer},
+    {"render_batch",               c_render_batch},
+    {"stats",                      c_synth_stats},
+    {"sf_cache",                   c_sf_cache},
+    {"send_events",                c_send_events},
+    {"queue_events",               c_queue_events},
+    {"queue_clear",                c_queue_clear},
+    {"queue_time",                 c_queue_time},
     {"fluid_player_join",          c_fluid_player_join},
     {"fluid_player_stop",          c_fluid_player_stop},
     {"delete_fluid_player",        c_delete_fluid_player},
@@ -482,6 +1950,14 @@ static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
         lua_pushinteger(L, constants[index].value);
         lua_setfield(L, 3, constants[index].name);
     }
+    /* 2.4 the synth and player handles are garbage-collected userdata */
+    luaL_newmetatable(L, SYNTH_METATABLE);
+    lua_pushcfunction(L, c_synth_gc);
+    lua_setfield(L, -2, "__gc");
+    luaL_newmetatable(L, PLAYER_METATABLE);
+    lua_pushcfunction(L, c_player_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 2);
     /* lua_pushvalue(L, 1);   * set the aux table as environment */
     /* lua_replace(L, LUA_ENVIRONINDEX);
        unnecessary here, fortunately, because it fails in 5.2 */
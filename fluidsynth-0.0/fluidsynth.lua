@@ -7,25 +7,26 @@
 ---------------------------------------------------------------------
 
 local M = {} -- public interface
-M.Version     = '2.3' -- 20201103 2.3 adapt to gcc9 and libfluidsynth 1.12
-M.VersionDate = '20201103'
+M.Version     = '2.4' -- 20261017 2.4 render_to_buffer, userdata handles
+M.VersionDate = '20261017'
 
 local ALSA = nil -- not needed if you never use play_event
 
 -- local Synth2settings       = {}  -- 2.0 now identical
 -- local AudioDriver2synth    = {}  -- 2.0 now identical
-local Player2synth         = {}
-local Synth2fastRender     = {}
+-- 2.4 weak keys, so synths and players that are no longer referenced
+-- by the application can be reclaimed by their __gc metamethods
+local Player2synth         = setmetatable({}, {__mode='k'})
+local Synth2fastRender     = setmetatable({}, {__mode='k'})
 local ConfigFileSettings   = {}
 --local FLUID_FAILED         = -1  -- /usr/include/fluidsynth/misc.h
 -- 2.0 all C functions return nil if they fail
 local TmpName              = nil -- used to save the C-library's stderr
 local DefaultSoundfont     = nil
 
-local Synths               = {}  -- 2.0 indexes into three C arrays
+local Synths = setmetatable({}, {__mode='k'}) -- 2.4 userdata, not indexes
 -- local Settingses        = {}  -- 2.0 each synth only has one settings
 -- local AudioDrivers      = {}  -- 2.0 each synth only has one audio_driver
-local Players              = {}  -- 2.0 indexes into the C array
 -- 2.0 each synth has one settings, so Synth2settings is not necessary
 -- and each synth has one audio_driver, so AudioDriver2synth is unnecessary
 -- but one synth may have multiple midi_players running at the same time
@@ -161,34 +162,16 @@ local DefaultOption = {   -- the default synthesiser options
 
 ------------------------ private functions ----------------------
 
-function first_free_synthnum()     -- 2.0 to keep ptrs in C arrays
-	for synthnum = 0,127 do
-		if not Synths[synthnum] then
-			-- _debug('first_free_synthnum was '..tostring(synthnum))
-			return synthnum
-		end
-	end
-	return nil, 'first_free_synthnum: no free synthnums'
-end
-function first_free_playernum()    -- 2.0 to keep ptrs in C arrays
-	for playernum = 0,127 do
-		if not Players[playernum] then
-			-- _debug('first_free_playernum was '..tostring(playernum))
-			return playernum
-		end
-	end
-	return nil, 'first_free_playernum: no free playernums'
-end
-
-function new_settings(synthnum)
+function new_settings()
+	-- 2.4 returns the synth's userdata, which owns its settings
 	TmpName = prv.redirect_stderr()
-	local settings = prv.new_fluid_settings(synthnum)
+	local settings = prv.new_fluid_settings()
 	if settings==nil then return nil,'new_fluid_settings failed' end
 	return settings
 end
 
-function new_audio_driver(synthnum)
-	local audio_driver = prv.new_fluid_audio_driver(synthnum)
+function new_audio_driver(synth)
+	local audio_driver = prv.new_fluid_audio_driver(synth)
 	if audio_driver == nil then
 		return nil, synth_error('new_fluid_audio_driver')
 	end
@@ -214,8 +197,8 @@ local function is_noteoff(alsaevent)
     return false
 end
 
-function set(synthnum, key, val)  -- typically called before a synth exists,
-	-- but always after its settings have been created
+local function setting_type(key, val)   -- 2.4 also used by render_batch
+	-- returns 'num', 'int' or 'str', and the value converted to suit
 	if type(key) == 'nil' then
 		return nil, "fluidsynth: can't set the value for a nil key"
 	end
@@ -229,27 +212,24 @@ function set(synthnum, key, val)  -- typically called before a synth exists,
 		return nil, 'fluidsynth knows no '..key..' setting'
 	end
 	if key=='synth.sample-rate' or key=='synth.gain' then
-		local rc = prv.fluid_settings_setnum(synthnum, key, val)
-		if rc == 1 then return true
-		else return nil,synth_error('fluid_settings_setnum') end
+		return 'num', val
 	elseif type(val) == 'number' then
-		local rc = prv.fluid_settings_setint(synthnum, key, round(val))
-		if rc == 1 then return true
-		else return nil,synth_error('fluid_settings_setint') end
+		return 'int', round(val)
 	elseif type(val) == 'boolean' then   -- 1.1
-		local v = 0
-		if val then v = 1 end
-		local rc = prv.fluid_settings_setint(synthnum, key, v)
-		if rc == 1 then return true
-		else return nil,synth_error('fluid_settings_setint') end
+		if val then return 'int', 1 else return 'int', 0 end
 	elseif type(val) == 'string' then
-		local rc = prv.fluid_settings_setstr(synthnum, key, val)
-		if rc == 1 then return true
-		else return nil,synth_error('fluid_settings_setstr') end
-	else
-		return nil,'fluidsynth knows no '..key..' setting of '..type(val)..' type'
+		return 'str', val
 	end
-	return true
+	return nil,'fluidsynth knows no '..key..' setting of '..type(val)..' type'
+end
+
+function set(synth, key, val)  -- typically called before a synth exists,
+	-- but always after its settings have been created
+	local settype, v = setting_type(key, val)
+	if not settype then return nil, v end
+	local rc = prv['fluid_settings_set'..settype](synth, key, v)
+	if rc == 1 then return true
+	else return nil,synth_error('fluid_settings_set'..settype) end
 end
 
 -- function M.synth_error(synthnum)   -- undocumented
@@ -318,36 +298,38 @@ function M.new_synth(arg)
 	end
 	-- invoking new_synth with a table of settings invokes
 	--  new_settings, set, new_synth, new_audio_driver automatically.
-	local synthnum = first_free_synthnum()
-	local settings = new_settings(synthnum)
+	local synth, msg = new_settings()
+	if synth == nil then return nil, msg end
 	for k,v in pairs(arg) do
-		if k ~= 'fast.render' then set(synthnum, k, v) end
+		if k ~= 'fast.render' then set(synth, k, v) end
 	end
 	for k,v in pairs(ConfigFileSettings) do
-		if k ~= 'fast.render' then set(synthnum, k, v) end
+		if k ~= 'fast.render' then set(synth, k, v) end
 	end
-	local synth = prv.new_fluid_synth(synthnum)
-	if synth == nil then return nil, 'new_synth() failed' end
-	Synths[synthnum] = true
+	if prv.new_fluid_synth(synth) == nil then
+		return nil, 'new_synth() failed'
+	end
+	Synths[synth] = true
 	if arg['fast.render'] then   -- from src/fluidsynth.c
-		Synth2fastRender[synthnum] = true
-		set(synthnum, 'player.timing-source', 'sample')
-		set(synthnum, 'synth.parallel-render', 1)
+		Synth2fastRender[synth] = true
+		set(synth, 'player.timing-source', 'sample')
+		set(synth, 'synth.parallel-render', 1)
 		-- fast_render should not need this, but currently does
 	end
 	-- Synth2settings[synth] = settings
-	if not Synth2fastRender[synthnum] and arg['audio.driver'] ~= 'none' then
-		local audio_driver = new_audio_driver(synthnum)
+	if not Synth2fastRender[synth] and arg['audio.driver'] ~= 'none' then
+		local audio_driver = new_audio_driver(synth)
 	end
 	--DefaultSoundfont = prv.fluid_settings_copystr(settings,
 	-- 'synth.default-soundfont');  NOT SET on my debian stable...
-	-- synthnum is no longer an integer cast of a C-pointer, it's an int 0..127
-	return synthnum
+	-- 2.4 synth is a userdata owning the C-pointers; if the application
+	-- drops it without calling delete_synth, its __gc deletes them
+	return synth
 end
 
 function M.sf_load( synth, commands )
 	if type(commands) == 'string' then
-		local sf_id = prv.fluid_synth_sfload(synth, filename)
+		local sf_id = prv.fluid_synth_sfload(synth, commands)
 		if sf_id == nil then return nil, synth_error('fluid_synth_sfload')
 		else return { sf_id } end
 	elseif type(commands) == 'table' then
@@ -394,6 +376,13 @@ function M.sf_load( synth, commands )
 	end
 end
 
+function M.sf_cache(mode)   -- 2.4
+	if mode ~= nil and mode ~= 'mmap' and mode ~= 'read' and mode ~= 'off' then
+		return nil, "fluidsynth: sf_cache mode must be 'mmap', 'read' or 'off'"
+	end
+	return prv.sf_cache(mode)
+end
+
 function M.sf_select(synth, channel, sf_id)   -- not documented :-(
 	local rc = prv.fluid_synth_sfont_select(synth, channel, sf_id)
 	if rc == nil then
@@ -403,11 +392,11 @@ end
 
 function M.delete_synth(synth)
 	if synth == nil then   -- if synth==nil it deletes all synths
-		for synthnum = 0,127 do
-			if Synths[synthnum] then
-				local rc, msg = M.delete_synth(synthnum)
-				if not rc then return rc, msg end
-			end
+		local synths = {}
+		for synth in pairs(Synths) do synths[#synths+1] = synth end
+		for i,synth in ipairs(synths) do
+			local rc, msg = M.delete_synth(synth)
+			if not rc then return rc, msg end
 		end
 		-- 1.6: os.remove(TmpName) No. See below...
 		return true
@@ -437,8 +426,7 @@ end
 
 function M.new_player(synth, midifile)
 	if not midifile then return nil,'new_player: midifile was nil' end
-	local playernum = first_free_playernum()
-	local player = prv.new_fluid_player(synth, playernum)
+	local player = prv.new_fluid_player(synth)
 	if player == nil then return nil, synth_error('new_fluid_player') end
 	local rc
 	if M.is_midifile(midifile) then   -- 1.5
@@ -504,6 +492,76 @@ function M.player_stop(player)
 	end
 end
 
+function M.render_block(synth, nframes, format)  -- 2.4
+	-- returns nframes of interleaved stereo samples as a string,
+	-- as native-endian float ('float') or int16 ('s16', the default)
+	if type(nframes) ~= 'number' then
+		return nil, 'render_block: nframes must be a number'
+	end
+	local buffer = prv.render_block(synth, round(nframes), format)
+	if buffer == nil then return nil, synth_error('fluid_synth_write')
+	else return buffer end
+end
+
+function M.render_to_buffer(synth, player, max_frames, format)  -- 2.4
+	-- like player_join with fast.render, but returns the audio as a string
+	-- instead of writing it to audio.file.name.  max_frames=nil: no limit
+	if max_frames == nil then max_frames = -1 end
+	local buffer, nframes = prv.render_to_buffer(synth, player,
+	  round(max_frames), format)
+	if buffer == nil then return nil, synth_error('fluid_synth_write') end
+	return buffer, nframes
+end
+
+function M.render_batch(jobs, arg, soundfonts, nthreads, format)  -- 2.4
+	-- renders many midi files at once, in a pool of C threads each with
+	-- its own synth; jobs is an array of midi (filenames or in-memory data)
+	-- or of {midi=, output=}. Returns an array of results, and total time
+	if type(jobs) ~= 'table' then
+		return nil, 'render_batch: jobs must be an array'
+	end
+	if arg == nil then arg = { } end
+	local c_jobs = {}
+	for i,job in ipairs(jobs) do
+		local midi, output = job, nil
+		if type(job) == 'table' then midi, output = job.midi, job.output end
+		if midi == '-' then midi = io.stdin:read('*a') end
+		if type(midi) ~= 'string' then
+			return nil, 'render_batch: job '..i..' has no midi'
+		end
+		if output ~= nil and type(output) ~= 'string' then
+			return nil, 'render_batch: job '..i..' output must be a filename'
+		end
+		c_jobs[i] = {
+			midi = midi, output = output,
+			is_data = string.match(midi, '^MThd') ~= nil,
+		}
+	end
+	local c_settings = {}   -- applied in the same order as new_synth
+	for i,settings in ipairs({arg, ConfigFileSettings}) do
+		for k,v in pairs(settings) do
+			if k ~= 'fast.render' then
+				local settype, val = setting_type(k, v)
+				if not settype then return nil, val end
+				table.insert(c_settings, {k, string.sub(settype,1,1), val})
+			end
+		end
+	end
+	local filenames = {}   -- only the 'load' commands are used
+	if type(soundfonts) == 'string' then
+		filenames = { soundfonts }
+	elseif type(soundfonts) == 'table' then
+		for k,line in ipairs(soundfonts) do
+			local filename = string.match(line, '^%s*load%s+(%S+)%s*$')
+			if filename then table.insert(filenames, filename) end
+		end
+	end
+	local results, seconds = prv.render_batch(c_jobs, c_settings,
+	  filenames, nthreads, format)
+	if results == nil then return nil, 'render_batch failed' end
+	return results, seconds
+end
+
 function M.player_add_mem(player, buffer)
 	local rc = prv.fluid_player_add_mem(player, buffer, string.len(buffer)+1)
 	if rc == nil then return nil, synth_error('fluid_player_add_mem')
@@ -550,7 +608,7 @@ function M.pitch_bend_sens(synth, channel, val) -- val = semitones
 	else return true end
 end
 
-function M.play_event(synth, event) -- no queuing yet; immediate output only
+function M.play_event(synth, event) -- immediate output; see queue_events
 	if #event == 8 then  -- its a midialsa event
 		-- see:  http://www.pjb.com.au/comp/lua/midialsa.html#input
 		-- and:  http://www.pjb.com.au/comp/lua/midialsa.html#constants
@@ -591,8 +649,68 @@ function M.play_event(synth, event) -- no queuing yet; immediate output only
 	return true   -- so assert doesn't die unnecessarily
 end
 
+function M.send_events(synth, events)  -- 2.4
+	-- plays an array of MIDI.lua events immediately, in one call into C
+	if type(events) ~= 'table' then
+		return nil, 'send_events: 2nd arg must be an array of events'
+	end
+	return prv.send_events(synth, events)   -- nfailed, nsent
+end
+
+-- 2.4 timed output: the events go onto a fluid_sequencer_t in one call,
+-- and are then played by the synth's own clock, with no Lua involved
+function M.queue_events(synth, events, start_ms)
+	if type(events) ~= 'table' then
+		return nil, 'queue_events: 2nd arg must be an array of events'
+	end
+	local n, nfailed = prv.queue_events(synth, events, start_ms or 0)
+	if not n then return nil, 'queue_events: '..tostring(nfailed) end
+	if nfailed > 0 then
+		return nil, 'queue_events: the sequencer refused '..nfailed..' events'
+	end
+	return n
+end
+
+function M.queue_score(synth, score, start_ms)
+	local MIDI
+	pcall(function() MIDI = require 'MIDI' end)
+	if MIDI == nil then
+		return nil, 'you need to install MIDI.lua !'
+	end
+	if type(score) == 'string' then   -- it's MIDI data
+		score = MIDI.midi2ms_score(score)
+	elseif type(score) ~= 'table' then
+		return nil, 'queue_score: 2nd arg must be a score, opus or MIDI data'
+	elseif MIDI.score_type(score) == 'opus' then
+		score = MIDI.opus2score(MIDI.to_millisecs(score))
+	else   -- even with 1000 ticks, since only set_tempo says they're ms
+		score = MIDI.opus2score(MIDI.to_millisecs(MIDI.score2opus(score)))
+	end
+	local n = 0
+	for itrack = 2, #score do
+		local nt, msg = M.queue_events(synth, score[itrack], start_ms)
+		if not nt then return nil, msg end
+		n = n + nt
+	end
+	return n
+end
+
+function M.queue_clear(synth)
+	return prv.queue_clear(synth)
+end
+
+function M.queue_time(synth)
+	local ms = prv.queue_time(synth)
+	if ms == nil then return nil, 'queue_time: no sequencer' end
+	return ms
+end
+
 ------------------- functions returning state -----------------
 
+function M.stats(synth, reset)   -- 2.4
+	return prv.stats(synth, reset)
+end
+
 function M.is_soundfont(filename)
 	return prv.fluid_is_soundfont(filename)
 end
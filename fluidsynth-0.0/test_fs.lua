@@ -60,6 +60,11 @@ print("about to call sf_load")
 local sf_ids,msg = FS.sf_load(synth, soundfonts)
 if sf_ids == nil then print(msg) end
 print('sf_ids =',DataDumper(sf_ids))
+local old_mode, cached = FS.sf_cache()
+print('sf_cache mode is '..old_mode..', with '..#cached..' soundfonts cached')
+for i,sf in ipairs(cached) do
+	print('  '..sf.filename..' refcount='..sf.refcount..' presets='..sf.presets)
+end
 print("about to call sf_load on non-existent file")
 sf_ids,msg = FS.sf_load(synth, "/wherever/Zsfuospw9erk.sf2", 0)
 print('sf_ids =',DataDumper(sf_ids))
@@ -122,6 +127,70 @@ if not rc then print(msg) end
 os.execute('sleep 1')       -- should schedule, or use luaposix...
 
 if not rc then print(msg) end
+
+print("about to call new_synth with audio.driver none, for render_to_buffer")
+local synth2 = assert(FS.new_synth({['audio.driver']='none',
+  ['player.timing-source']='sample'}))
+FS.sf_load(synth2, soundfonts)
+print('about to call render_block')
+local block = assert(FS.render_block(synth2, 64, 'float'))
+print('render_block(synth2, 64, "float") returned '..#block..' bytes')
+block = assert(FS.render_block(synth2, 64))
+print('render_block(synth2, 64) returned '..#block..' bytes')
+print('about to call render_to_buffer on in-memory MIDI data')
+local player2 = assert(FS.new_player(synth2, midi))
+local pcm, nframes = FS.render_to_buffer(synth2, player2, 44100*3)
+print('render_to_buffer returned '..nframes..' frames in '..#pcm..' bytes')
+if #pcm ~= 4*nframes then print('render_to_buffer: wrong buffer length') end
+
+print('about to call send_events with a sweep of 128 control_changes')
+local sweep = {}
+for i = 0,127 do sweep[#sweep+1] = {'control_change', 0, 0, 74, i} end
+sweep[#sweep+1] = {'note_on', 0, 99, 60, 100}   -- channel 99 must fail
+local nfailed, nsent = FS.send_events(synth2, sweep)
+print('send_events: '..nsent..' sent, '..nfailed..' failed')
+
+print('about to call queue_events, then render_to_buffer')
+local n = assert(FS.queue_events(synth2, {
+	{'patch_change',    0, 0, 24},
+	{'note',            0, 500, 0, 60, 100},
+	{'note',          250, 500, 0, 64, 100},
+	{'control_change', 300, 0, 10, 0},
+	{'note_on',       500, 0, 67, 100},
+	{'note_off',     1000, 0, 67, 0},
+}))
+print('queue_events queued '..n..' events, queue_time is '..FS.queue_time(synth2))
+pcm, nframes = FS.render_to_buffer(synth2, assert(FS.new_player(synth2, midi)),
+  44100*2)
+print('queue_time after rendering '..nframes..' frames is '..FS.queue_time(synth2))
+FS.queue_clear(synth2)
+
+local stats = FS.stats(synth2)
+print(string.format('stats: %d blocks, %d frames, block_us p50 %g p99 %g max %g',
+  stats.blocks, stats.frames, stats.block_us_p50 or 0,
+  stats.block_us_p99 or 0, stats.block_us_max or 0))
+
+print('about to call render_batch on four copies of the in-memory MIDI data')
+local results, seconds = FS.render_batch({midi, midi, midi, midi},
+  {['synth.gain']=0.3}, soundfonts, 2)
+if not results then print(seconds) else
+	for i,result in ipairs(results) do
+		print(string.format('job %d: %s frames in %.3f sec on thread %d %s',
+		  i, result.frames, result.seconds, result.worker, result.error or ''))
+	end
+	print(string.format('render_batch took %.3f sec altogether', seconds))
+end
+
+print('about to create and drop 200 synths, more than the old limit of 128')
+for i = 1,200 do
+	local s = FS.new_synth({['audio.driver']='none'})
+	if not s then print('new_synth failed at synth number '..i) ; break end
+end
+collectgarbage('collect')   -- their __gc should delete them all
+collectgarbage('collect')
+print('collectgarbage returned, memory in use is '
+  ..collectgarbage('count')..' kB')
+
 print("about to call delete_synth(nil)")
 rc,msg = FS.delete_synth(nil)
 if not rc then print(msg) end
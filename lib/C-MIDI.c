@@ -0,0 +1,239 @@
+/*
+    C-MIDI.c - optional C core for MIDI.lua
+
+   This Lua5 module is Copyright (c) 2026, Peter J Billam
+                     www.pjb.com.au
+
+ This module is free software; you can redistribute it and/or
+       modify it under the same terms as Lua5 itself.
+
+ It decodes a whole Standard MIDI File into exactly the opus that the
+ pure-Lua midi2opus() would produce.  Anything unusual (running status
+ not set, bad meta-event lengths, truncated events, the warnings ...)
+ is not handled here; such a track is returned as its raw string, and
+ MIDI.lua decodes it in Lua as before, so that the output and the
+ warnings are always identical.  If even the header or a track-header
+ is unusual, midi2opus returns nil and MIDI.lua does the whole file.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <string.h>
+
+/* The event-names are held as upvalues of midi2opus,
+   so that each event only costs a lua_pushvalue for its name */
+static const char *names[] = {
+	"note_off", "note_on", "key_after_touch", "control_change",
+	"patch_change", "channel_after_touch", "pitch_wheel_change",
+	"set_sequence_number", "text_event", "copyright_text_event",
+	"track_name", "instrument_name", "lyric", "marker", "cue_point",
+	"text_event_08", "text_event_09", "text_event_0a", "text_event_0b",
+	"text_event_0c", "text_event_0d", "text_event_0e", "text_event_0f",
+	"set_tempo", "smpte_offset", "time_signature", "key_signature",
+	"sequencer_specific", "raw_meta_event", "sysex_f0", "sysex_f7",
+	"song_position", "song_select", "tune_request", "raw_data",
+	NULL
+};
+enum {
+	N_NOTE_OFF, N_NOTE_ON, N_KEY_AFTER_TOUCH, N_CONTROL_CHANGE,
+	N_PATCH_CHANGE, N_CHANNEL_AFTER_TOUCH, N_PITCH_WHEEL_CHANGE,
+	N_SET_SEQUENCE_NUMBER, N_TEXT_EVENT, /* then meta-events 2 to 15 */
+	N_SET_TEMPO = N_TEXT_EVENT + 15, N_SMPTE_OFFSET, N_TIME_SIGNATURE,
+	N_KEY_SIGNATURE, N_SEQUENCER_SPECIFIC, N_RAW_META_EVENT,
+	N_SYSEX_F0, N_SYSEX_F7, N_SONG_POSITION, N_SONG_SELECT,
+	N_TUNE_REQUEST, N_RAW_DATA, N_NAMES
+};
+#define push_name(L,n) lua_pushvalue(L, lua_upvalueindex((n)+1))
+
+/* str2ber_int; returns -1 where MIDI.lua would warn, or fail */
+static long long ber_int(const unsigned char *s, long long n, long long *p) {
+	long long i = *p;
+	long long integer = 0;
+	int nbytes = 0;
+	while (i < n) {
+		integer += s[i] & 0x7F;
+		if (s[i] < 128) { *p = i+1; return integer; }
+		if (i+1 >= n || ++nbytes > 7) return -1;
+		i++;
+		integer *= 128;
+	}
+	return -1;
+}
+
+/* pushes an event-array {name, time, ...} with nargs more items
+   already on the stack; rawseti's it into the events table below them */
+static void new_event(lua_State *L, int name, long long time, int nargs,
+  int *nevents) {
+	int k;
+	lua_createtable(L, 2+nargs, 0);
+	push_name(L, name);            lua_rawseti(L, -2, 1);
+	lua_pushinteger(L, (lua_Integer) time); lua_rawseti(L, -2, 2);
+	for (k = nargs; k >= 1; k--) {
+		lua_pushvalue(L, -1-k);    lua_rawseti(L, -2, 2+nargs-k+1);
+	}
+	lua_replace(L, -1-nargs);
+	if (nargs > 1) lua_pop(L, nargs-1);
+	*nevents = *nevents + 1;
+	lua_rawseti(L, -2, *nevents);
+}
+
+/* decodes one track like MIDI.lua's _decode, pushing the events-array;
+   returns 0, with nothing pushed, if the track needs the Lua decoder */
+static int decode_track(lua_State *L, const unsigned char *s, long long n) {
+	long long i = 0;
+	long long time, length;
+	int event_code = -1;   /* used for running status */
+	int first_byte, command, nevents = 0;
+	int top = lua_gettop(L);
+	lua_createtable(L, (int)(n/3 < 65536 ? n/3 : 65536), 0);
+	while (i+1 < n) {
+		if ((time = ber_int(s, n, &i)) < 0) goto fallback;
+		if (i >= n) goto fallback;
+		first_byte = s[i++];
+		if (first_byte < 240) {  /* it's a MIDI event */
+			if (first_byte > 127) {
+				event_code = first_byte;
+			} else {  /* running status */
+				i--;
+				if (event_code == -1) goto fallback;
+			}
+			command = event_code & 0xF0;
+			lua_pushinteger(L, event_code & 0x0F);
+			if (command == 192 || command == 208) {
+				if (i >= n) goto fallback;
+				lua_pushinteger(L, s[i++]);
+				new_event(L, command == 192 ? N_PATCH_CHANGE
+				  : N_CHANNEL_AFTER_TOUCH, time, 2, &nevents);
+			} else {
+				if (i+1 >= n) goto fallback;
+				if (command == 224) {
+					lua_pushinteger(L, 128*s[i+1] + s[i] - 8192);
+					new_event(L, N_PITCH_WHEEL_CHANGE, time, 2, &nevents);
+				} else {
+					lua_pushinteger(L, s[i]);
+					lua_pushinteger(L, s[i+1]);
+					new_event(L, (command-128)/16, time, 3, &nevents);
+				}
+				i += 2;
+			}
+		} else if (first_byte == 255) {  /* it's a Meta-Event */
+			if (i >= n) goto fallback;
+			command = s[i++];
+			if ((length = ber_int(s, n, &i)) < 0) goto fallback;
+			if (command == 47) {  /* end_track, with the EOT magic */
+				if (time > 0) {
+					lua_pushliteral(L, "");
+					new_event(L, N_TEXT_EVENT, time, 1, &nevents);
+				}
+				break;
+			} else if (command == 0) {
+				if (length != 2 || i+1 >= n) goto fallback;
+				lua_pushinteger(L, 256*s[i] + s[i+1]);
+				new_event(L, N_SET_SEQUENCE_NUMBER, time, 1, &nevents);
+			} else if (command == 81) {
+				if (length != 3 || i+2 >= n) goto fallback;
+				lua_pushinteger(L, 65536*s[i] + 256*s[i+1] + s[i+2]);
+				new_event(L, N_SET_TEMPO, time, 1, &nevents);
+			} else if (command == 84) {
+				int k;
+				if (length != 5 || i+4 >= n) goto fallback;
+				for (k = 0; k < 5; k++) lua_pushinteger(L, s[i+k]);
+				new_event(L, N_SMPTE_OFFSET, time, 5, &nevents);
+			} else if (command == 88) {
+				int k;
+				if (length != 4 || i+3 >= n) goto fallback;
+				for (k = 0; k < 4; k++) lua_pushinteger(L, s[i+k]);
+				new_event(L, N_TIME_SIGNATURE, time, 4, &nevents);
+			} else if (command == 89) {
+				if (length != 2 || i+1 >= n) goto fallback;
+				lua_pushinteger(L, s[i] > 127 ? s[i]-256 : s[i]);
+				lua_pushinteger(L, s[i+1]);
+				new_event(L, N_KEY_SIGNATURE, time, 2, &nevents);
+			} else {  /* the string.sub in MIDI.lua clips at the end */
+				long long len = length < n-i ? length : n-i;
+				if (command >= 1 && command <= 15) {
+					lua_pushlstring(L, (const char *)s+i, (size_t)len);
+					new_event(L, N_TEXT_EVENT+command-1, time, 1, &nevents);
+				} else if (command == 127) {
+					lua_pushlstring(L, (const char *)s+i, (size_t)len);
+					new_event(L, N_SEQUENCER_SPECIFIC, time, 1, &nevents);
+				} else {
+					lua_pushinteger(L, command);
+					lua_pushlstring(L, (const char *)s+i, (size_t)len);
+					new_event(L, N_RAW_META_EVENT, time, 2, &nevents);
+				}
+			}
+			i += length;
+		} else if (first_byte == 240 || first_byte == 247) {  /* sysex */
+			long long len;
+			if ((length = ber_int(s, n, &i)) < 0) goto fallback;
+			len = length < n-i ? length : n-i;
+			lua_pushlstring(L, (const char *)s+i, (size_t)len);
+			new_event(L, first_byte == 240 ? N_SYSEX_F0 : N_SYSEX_F7,
+			  time, 1, &nevents);
+			i += length;
+		} else if (first_byte == 242) {  /* song_position */
+			if (i+1 >= n) goto fallback;
+			lua_pushinteger(L, s[i] + 128*s[i+1]);
+			new_event(L, N_SONG_POSITION, time, 1, &nevents);
+			i += 2;
+		} else if (first_byte == 246) {
+			lua_createtable(L, 2, 0);
+			push_name(L, N_TUNE_REQUEST);           lua_rawseti(L, -2, 1);
+			lua_pushinteger(L, (lua_Integer) time); lua_rawseti(L, -2, 2);
+			lua_rawseti(L, -2, ++nevents);
+		} else {  /* song_select, and other F-series events as raw_data */
+			if (i >= n) goto fallback;
+			lua_pushinteger(L, s[i++]);
+			new_event(L, first_byte == 243 ? N_SONG_SELECT : N_RAW_DATA,
+			  time, 1, &nevents);
+		}
+	}
+	return 1;
+  fallback:
+	lua_settop(L, top);
+	return 0;
+}
+
+static int c_midi2opus(lua_State *L) {
+	size_t len;
+	const unsigned char *s = (const unsigned char *)luaL_checklstring(L,1,&len);
+	long long n = (long long) len;
+	long long i, track_length;
+	int ntracks = 0, tracks_expected;
+	if (n < 14 || memcmp(s, "MThd", 4)) return 0;   /* Lua warns */
+	if (s[4] || s[5] || s[6] || s[7] != 6) return 0;
+	tracks_expected = 256*s[10] + s[11];
+	lua_createtable(L, 1 + (tracks_expected < 512 ? tracks_expected : 512), 0);
+	lua_pushinteger(L, 256*s[12] + s[13]);  /* ticks */
+	lua_rawseti(L, -2, ++ntracks);
+	i = 14;
+	while (i+1 < n-8) {   /* MIDI.lua: while i < #s-8 */
+		if (memcmp(s+i, "MTrk", 4)) return 0;  /* Lua warns */
+		track_length = ((long long)s[i+4] << 24) + (s[i+5] << 16)
+		  + (s[i+6] << 8) + s[i+7];
+		if (track_length > n) return 0;        /* Lua warns */
+		i += 8;
+		if (track_length > n-i) track_length = n-i > 0 ? n-i : 0;
+		if (! decode_track(L, s+i, track_length))   /* leave it to Lua */
+			lua_pushlstring(L, (const char *)s+i, (size_t)track_length);
+		lua_rawseti(L, -2, ++ntracks);
+		i += track_length;
+	}
+	return 1;
+}
+
+static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
+	/* Lua stack: aux table, prv table, dat table */
+	int index;
+	for (index = 0; names[index] != NULL; ++index)
+		lua_pushstring(L, names[index]);
+	lua_pushcclosure(L, c_midi2opus, N_NAMES);
+	lua_setfield(L, 2, "midi2opus");
+	return 0;
+}
+
+int luaopen_MIDI(lua_State *L) {
+	lua_pushcfunction(L, initialise);
+	return 1;
+}
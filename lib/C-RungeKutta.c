@@ -0,0 +1,723 @@
+/*
+    C-RungeKutta.c - optional C core for RungeKutta.lua
+
+   This Lua5 module is Copyright (c) 2026, Peter J Billam
+                     www.pjb.com.au
+
+ This module is free software; you can redistribute it and/or
+       modify it under the same terms as Lua5 itself.
+
+ A stepper owns contiguous arrays of doubles for the state, the stages
+ and the intermediate values, allocated once, and integrates any number
+ of timesteps per call.  The formulae are those of rk2, rk4, rk4_classical
+ and rk4_ralston in RungeKutta.lua, term by term, in loops over contiguous
+ arrays which the compiler can vectorise; auto does rk4_auto's
+ step-doubling, with the same rules for adjusting dt.
+
+ The derivative function is still in Lua.  It is called as dydt(t,y,f)
+ with two tables which the stepper re-uses for every call, so that no
+ tables are created; it should fill in f, but it may instead return
+ a new table, as the dydt functions of rk4 etc do.
+
+ An ensemble is nsystems systems of dim equations each, with the same
+ dydt, in one nsystems*dim array, integrated in lock-step; dydt is called
+ once for all of them, as dydt(t, y, f, nsystems, dim, first).  It may be
+ split into slices of systems, each integrated by its own thread with
+ its own lua_State, into which dydt has been loaded.
+
+ Compile with -pthread.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#define lua_setuservalue lua_setfenv
+#define lua_getuservalue lua_getfenv
+#endif
+
+#define STEPPER  "RungeKutta.stepper"
+#define ENSEMBLE "RungeKutta.ensemble"
+
+static const char *methods[] = {
+	"rk2", "rk4", "rk4_classical", "rk4_ralston", NULL
+};
+enum { RK2, RK4, RK4_CLASSICAL, RK4_RALSTON };
+
+typedef struct stepper {
+	long n;
+	int method;
+	double *y;      /* the current values */
+	double *ynp1;   /* the values after the step; swapped with y */
+	double *eta, *k0, *k1, *k2, *k3, *k4;
+	double *f0;     /* rk4_auto's saved_k0 */
+	double *y1, *y2, *y3;    /* rk4_auto's full-step, midpoint, and result */
+	double *errors;
+	double t_midpoint;
+	long nsystems, dim, first;   /* if it is (a slice of) an ensemble */
+	double data[1];
+} stepper;
+
+/* while a method runs, the uservalue's dydt, y and f tables are here */
+#define DYDT  2
+#define YTAB  3
+#define FTAB  4
+
+static stepper *check_stepper(lua_State *L, int index) {
+	return (stepper *) luaL_checkudata(L, index, STEPPER);
+}
+
+/* puts the uservalue's dydt, y and f at 2,3,4, and moves the args above */
+static void push_tables(lua_State *L) {
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+	lua_rawgeti(L, -2, 2);
+	lua_rawgeti(L, -3, 3);
+	lua_remove(L, -4);
+	lua_insert(L, 2);  lua_insert(L, 2);  lua_insert(L, 2);
+}
+
+/* leaves the stepper at 1, dydt, y and f at 2,3,4, and the args above */
+static stepper *get_stepper(lua_State *L) {
+	stepper *s = check_stepper(L, 1);
+	push_tables(L);
+	return s;
+}
+
+/* f = dydt(t, y), or dydt(t, y, f, nsystems, dim, first) in an ensemble */
+static void derivative(lua_State *L, stepper *s, double t,
+  const double *y, double *f) {
+	long i, n = s->n;
+	int ftab;
+	for (i = 0; i < n; i++) {
+		lua_pushnumber(L, y[i]);
+		lua_rawseti(L, YTAB, i+1);
+	}
+	lua_pushvalue(L, DYDT);
+	lua_pushnumber(L, t);
+	lua_pushvalue(L, YTAB);
+	lua_pushvalue(L, FTAB);
+	if (s->nsystems > 0) {
+		lua_pushinteger(L, (lua_Integer) s->nsystems);
+		lua_pushinteger(L, (lua_Integer) s->dim);
+		lua_pushinteger(L, (lua_Integer) s->first);
+		lua_call(L, 6, 1);
+	} else {
+		lua_call(L, 3, 1);
+	}
+	ftab = lua_istable(L, -1) ? lua_gettop(L) : FTAB;
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, ftab, i+1);
+		if (lua_type(L, -1) != LUA_TNUMBER)
+			luaL_error(L, "RungeKutta: dydt did not return dydt[%d]", (int)i+1);
+		f[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+static void rk2(lua_State *L, stepper *s, double t, double dt,
+  const double *yn, double *ynp1) {
+	long i, n = s->n;
+	double gamma = .75;  /* Ralston's minimisation of error bounds */
+	double alpha = 0.5/gamma, beta = 1.0-gamma;
+	double alphadt = alpha*dt, betadt = beta*dt, gammadt = gamma*dt;
+	double *dydtn = s->k0, *ynpalpha = s->eta, *dydtnpalpha = s->k1;
+	derivative(L, s, t, yn, dydtn);
+	for (i = 0; i < n; i++) ynpalpha[i] = yn[i] + alphadt*dydtn[i];
+	derivative(L, s, t+alphadt, ynpalpha, dydtnpalpha);
+	for (i = 0; i < n; i++)
+		ynp1[i] = yn[i]+betadt*dydtn[i]+gammadt*dydtnpalpha[i];
+}
+
+/* Merson's method; if saved_k0, that is used as dydt(t, yn) */
+static void rk4(lua_State *L, stepper *s, double t, double dt,
+  const double *yn, double *ynp1, const double *saved_k0) {
+	long i, n = s->n;
+	double *k0 = s->k0, *k1 = s->k1, *k2 = s->k2, *k3 = s->k3, *k4 = s->k4;
+	double *eta = s->eta;
+	if (saved_k0) memcpy(k0, saved_k0, n*sizeof(double));
+	else derivative(L, s, t, yn, k0);
+	for (i = 0; i < n; i++) k0[i] = k0[i] * dt;
+	for (i = 0; i < n; i++) eta[i] = yn[i] + k0[i]/3.0;
+	derivative(L, s, t + dt/3.0, eta, k1);
+	for (i = 0; i < n; i++) k1[i] = k1[i] * dt;
+	for (i = 0; i < n; i++) eta[i] = yn[i] + (k0[i]+k1[i])/6.0;
+	derivative(L, s, t + dt/3.0, eta, k2);
+	for (i = 0; i < n; i++) k2[i] = k2[i] * dt;
+	for (i = 0; i < n; i++) eta[i] = yn[i] + (k0[i]+3.0*k2[i])*0.125;
+	derivative(L, s, t+0.5*dt, eta, k3);
+	for (i = 0; i < n; i++) k3[i] = k3[i] * dt;
+	for (i = 0; i < n; i++) eta[i] = yn[i] + (k0[i]-3.0*k2[i]+4.0*k3[i])*0.5;
+	derivative(L, s, t+dt, eta, k4);
+	for (i = 0; i < n; i++) k4[i] = k4[i] * dt;
+	for (i = 0; i < n; i++)
+		ynp1[i] = yn[i] + (k0[i]+4.0*k3[i]+k4[i])/6.0;
+}
+
+static void rk4_classical(lua_State *L, stepper *s, double t, double dt,
+  const double *yn, double *ynp1) {
+	long i, n = s->n;
+	double *k0 = s->k0, *k1 = s->k1, *k2 = s->k2, *k3 = s->k3;
+	double *eta = s->eta;
+	derivative(L, s, t, yn, k0);
+	for (i = 0; i < n; i++) k0[i] = dt * k0[i];
+	for (i = 0; i < n; i++) eta[i] = yn[i] + 0.5*k0[i];
+	derivative(L, s, t+0.5*dt, eta, k1);
+	for (i = 0; i < n; i++) k1[i] = dt * k1[i];
+	for (i = 0; i < n; i++) eta[i] = yn[i] + 0.5*k1[i];
+	derivative(L, s, t+0.5*dt, eta, k2);
+	for (i = 0; i < n; i++) k2[i] = dt * k2[i];
+	for (i = 0; i < n; i++) eta[i] = yn[i] + k2[i];
+	derivative(L, s, t+dt, eta, k3);
+	for (i = 0; i < n; i++) k3[i] = dt * k3[i];
+	for (i = 0; i < n; i++)
+		ynp1[i] = yn[i] + (k0[i] + 2.0*k1[i] + 2.0*k2[i] + k3[i]) / 6.0;
+}
+
+static void rk4_ralston(lua_State *L, stepper *s, double t, double dt,
+  const double *yn, double *ynp1) {
+	long i, n = s->n;
+	double *k0 = s->k0, *k1 = s->k1, *k2 = s->k2, *k3 = s->k3;
+	double *eta = s->eta;
+	double alpha1 = 0.4, alpha2 = 0.4557372542;
+	derivative(L, s, t, yn, k0);
+	for (i = 0; i < n; i++) k0[i] = dt * k0[i];
+	for (i = 0; i < n; i++) eta[i] = yn[i] + 0.4*k0[i];
+	derivative(L, s, t + alpha1*dt, eta, k1);
+	for (i = 0; i < n; i++) k1[i] = dt * k1[i];
+	for (i = 0; i < n; i++)
+		eta[i] = yn[i] + 0.2969776*k0[i] + 0.15875966*k1[i];
+	derivative(L, s, t + alpha2*dt, eta, k2);
+	for (i = 0; i < n; i++) k2[i] = dt * k2[i];
+	for (i = 0; i < n; i++)
+		eta[i] = yn[i] + 0.21810038*k0[i] - 3.0509647*k1[i] + 3.83286432*k2[i];
+	derivative(L, s, t+dt, eta, k3);
+	for (i = 0; i < n; i++) k3[i] = dt * k3[i];
+	for (i = 0; i < n; i++)
+		ynp1[i] = yn[i] + 0.17476028*k0[i]
+		 - 0.55148053*k1[i] + 1.20553547*k2[i] + 0.17118478*k3[i];
+}
+
+static void swap_y(stepper *s) {
+	double *tmp = s->y;  s->y = s->ynp1;  s->ynp1 = tmp;
+}
+
+/* nsteps fixed timesteps of dt, from s->y at t; returns the final t */
+static double fixed_steps(lua_State *L, stepper *s, double t, double dt,
+  long nsteps) {
+	long istep;
+	for (istep = 0; istep < nsteps; istep++) {
+		switch (s->method) {
+			case RK2:           rk2(L, s, t, dt, s->y, s->ynp1);           break;
+			case RK4:           rk4(L, s, t, dt, s->y, s->ynp1, NULL);     break;
+			case RK4_CLASSICAL: rk4_classical(L, s, t, dt, s->y, s->ynp1); break;
+			case RK4_RALSTON:   rk4_ralston(L, s, t, dt, s->y, s->ynp1);   break;
+		}
+		swap_y(s);
+		t = t + dt;
+	}
+	return t;
+}
+
+#define STEPPER_SIZE(n) (sizeof(stepper) + (14*(n)-1)*sizeof(double))
+
+/* lays out a stepper of n values in mem, of STEPPER_SIZE(n) bytes */
+static stepper *init_stepper(void *mem, long n, int method) {
+	stepper *s = (stepper *) mem;
+	s->n = n;  s->method = method;  s->t_midpoint = 0.0;
+	s->nsystems = 0;  s->dim = n;  s->first = 1;
+	s->y  = s->data;    s->ynp1 = s->y + n;   s->eta = s->ynp1 + n;
+	s->k0 = s->eta + n; s->k1 = s->k0 + n;    s->k2 = s->k1 + n;
+	s->k3 = s->k2 + n;  s->k4 = s->k3 + n;    s->f0 = s->k4 + n;
+	s->y1 = s->f0 + n;  s->y2 = s->y1 + n;    s->y3 = s->y2 + n;
+	s->errors = s->y3 + n;
+	memset(s->data, 0, 14*n*sizeof(double));
+	return s;
+}
+
+/* ------------------------- the Lua methods --------------------------- */
+
+static int c_new_stepper(lua_State *L) {   /* dydt, y, method */
+	long i, n;
+	stepper *s;
+	int method;
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	method = luaL_checkoption(L, 3, "rk4", methods);
+	n = (long) lua_rawlen(L, 2);
+	luaL_argcheck(L, n >= 1, 2, "must not be empty");
+	s = init_stepper(lua_newuserdata(L, STEPPER_SIZE(n)), n, method);
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 2, i+1);
+		s->y[i] = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+	}
+	luaL_getmetatable(L, STEPPER);
+	lua_setmetatable(L, -2);
+	lua_createtable(L, 3, 0);        /* its uservalue: {dydt, y, f} */
+	lua_pushvalue(L, 1);             lua_rawseti(L, -2, 1);
+	lua_createtable(L, (int) n, 0);  lua_rawseti(L, -2, 2);
+	lua_createtable(L, (int) n, 0);  lua_rawseti(L, -2, 3);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+/* into the table at index, or into a new table if index is 0 */
+static void push_array(lua_State *L, int index, const double *v, long n) {
+	long i;
+	if (index && lua_istable(L, index)) lua_pushvalue(L, index);
+	else lua_createtable(L, (int) n, 0);
+	for (i = 0; i < n; i++) {
+		lua_pushnumber(L, v[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+}
+
+static int c_stepper_get(lua_State *L) {   /* stepper, [y] */
+	stepper *s = check_stepper(L, 1);
+	push_array(L, 2, s->y, s->n);
+	return 1;
+}
+
+static int c_stepper_set(lua_State *L) {   /* stepper, y */
+	stepper *s = check_stepper(L, 1);
+	long i;
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_argcheck(L, (long) lua_rawlen(L, 2) == s->n, 2, "wrong length");
+	for (i = 0; i < s->n; i++) {
+		lua_rawgeti(L, 2, i+1);
+		s->y[i] = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int c_stepper_step(lua_State *L) {   /* stepper, t, dt, [nsteps] */
+	stepper *s = get_stepper(L);
+	double t  = luaL_checknumber(L, 5);
+	double dt = luaL_checknumber(L, 6);
+	long nsteps = (long) luaL_optinteger(L, 7, 1);
+	lua_pushnumber(L, fixed_steps(L, s, t, dt, nsteps));
+	return 1;
+}
+
+/* rk4_auto's relative error of y1 against y3 */
+static double relative_error(stepper *s, const double *yn, double epsilon) {
+	long i, n = s->n;
+	double diff;
+	if (epsilon > 0.0) {
+		double errmax = 0, ymax = 0;
+		for (i = 0; i < n; i++) {
+			diff = fabs(s->y1[i] - s->y3[i]);
+			if (errmax < diff) errmax = diff;
+			if (ymax < fabs(yn[i])) ymax = fabs(yn[i]);
+		}
+		return errmax / (epsilon*ymax);
+	} else {
+		double relative_error = 0.0;
+		for (i = 0; i < n; i++) {
+			diff = fabs(s->y1[i] - s->y3[i]) / fabs(s->errors[i]);
+			if (relative_error < diff) relative_error = diff;
+		}
+		return relative_error;
+	}
+}
+
+/* one step of rk4_auto, from s->y at t, into s->y3; returns the dt used */
+static double auto_step(lua_State *L, stepper *s, double t, double dt,
+  double epsilon) {
+	const double *yn = s->y;
+	double halfdt;
+	int resizings = 0;
+	double highest_low_error = 0.1e-99, highest_low_dt = 0.0;
+	double lowest_high_error = 9.9e99,  lowest_high_dt = 9.9e99;
+	if (dt == 0) dt = 0.1;
+	derivative(L, s, t, yn, s->f0);
+	while (1) {
+		double rel;
+		halfdt = 0.5 * dt;
+		rk4(L, s, t, dt, yn, s->y1, s->f0);
+		rk4(L, s, t, halfdt, yn, s->y2, s->f0);
+		rk4(L, s, t+halfdt, halfdt, s->y2, s->y3, NULL);
+		rel = relative_error(s, yn, epsilon);
+		if (rel < 0.60) {
+			if (dt > highest_low_dt) {
+				highest_low_error = rel;  highest_low_dt = dt;
+			}
+		} else if (rel > 1.67) {
+			if (dt < lowest_high_dt) {
+				lowest_high_error = rel;  lowest_high_dt = dt;
+			}
+		} else {
+			break;
+		}
+		if (lowest_high_dt<9.8e99 && highest_low_dt>1.0e-99) { /* interpolate */
+			double denom = log(lowest_high_error/highest_low_error);
+			if (highest_low_dt==0.0 || highest_low_error==0.0 || denom==0.0) {
+				dt = 0.5 * (highest_low_dt+lowest_high_dt);
+			} else {
+				dt = highest_low_dt * pow(lowest_high_dt/highest_low_dt,
+				  log(1.0/highest_low_error) / denom);
+			}
+		} else {
+			double adjust = pow(rel, -0.2);  /* hope error is 5th-order ... */
+			if (fabs(adjust) > 2.0) dt = dt * 2.0;
+			else dt = dt * adjust;
+		}
+		resizings = resizings + 1;
+		if (resizings>4 && highest_low_dt>1.0e-99) {
+			/* hope a small step forward gets us out of this mess ... */
+			dt = highest_low_dt;  halfdt = 0.5 * dt;
+			rk4(L, s, t, halfdt, yn, s->y2, s->f0);
+			rk4(L, s, t+halfdt, halfdt, s->y2, s->y3, NULL);
+			break;
+		}
+	}
+	s->t_midpoint = t + halfdt;
+	return dt;
+}
+
+/* like rk4_auto, nsteps times; returns t, dt */
+static int c_stepper_auto(lua_State *L) { /* stepper,t,dt,epsilon|errors,n */
+	stepper *s = get_stepper(L);
+	double t  = luaL_checknumber(L, 5);
+	double dt = luaL_checknumber(L, 6);
+	long istep, nsteps = (long) luaL_optinteger(L, 8, 1);
+	double epsilon = 0.0;
+	if (lua_istable(L, 7)) {
+		long i;
+		luaL_argcheck(L, (long) lua_rawlen(L, 7) == s->n, 7, "wrong length");
+		for (i = 0; i < s->n; i++) {
+			lua_rawgeti(L, 7, i+1);
+			s->errors[i] = luaL_checknumber(L, -1);
+			lua_pop(L, 1);
+		}
+	} else {
+		epsilon = fabs(luaL_checknumber(L, 7));
+		if (epsilon == 0) epsilon = .0000001;
+	}
+	for (istep = 0; istep < nsteps; istep++) {
+		dt = auto_step(L, s, t, dt, epsilon);
+		memcpy(s->y, s->y3, s->n*sizeof(double));
+		t = t + dt;
+	}
+	lua_pushnumber(L, t);
+	lua_pushnumber(L, dt);
+	return 2;
+}
+
+static int c_stepper_midpoint(lua_State *L) {   /* stepper, [y] */
+	stepper *s = check_stepper(L, 1);
+	lua_pushnumber(L, s->t_midpoint);
+	push_array(L, 2, s->y2, s->n);
+	return 2;
+}
+
+static const luaL_Reg stepper_methods[] = {
+	{ "get",      c_stepper_get      },
+	{ "set",      c_stepper_set      },
+	{ "step",     c_stepper_step     },
+	{ "auto",     c_stepper_auto     },
+	{ "midpoint", c_stepper_midpoint },
+	{ NULL, NULL }
+};
+
+/* ------------------------------ ensembles ---------------------------- */
+
+/* a slice of the systems of an ensemble, integrated by its own thread */
+typedef struct worker {
+	lua_State *L;           /* its own Lua state, into which dydt is loaded */
+	int dydt, ytab, ftab;   /* references in its registry */
+	stepper *s;
+	double *y;              /* its systems, within the ensemble's array */
+	double t, dt;
+	long nsteps;
+	pthread_t thread;
+	int started;
+	char error[256];        /* empty if dydt raised no error */
+} worker;
+
+typedef struct ensemble {
+	long nsystems, dim;
+	int method;
+	int nworkers;           /* 0 if dydt is called in the caller's state */
+	worker *workers;
+	stepper *s;             /* for all the systems, if nworkers is 0 */
+	double y[1];            /* nsystems*dim, system by system */
+} ensemble;
+
+static ensemble *check_ensemble(lua_State *L, int index) {
+	return (ensemble *) luaL_checkudata(L, index, ENSEMBLE);
+}
+
+static int run_slice(lua_State *L) {   /* called by lua_pcall in a worker */
+	worker *w = (worker *) lua_touserdata(L, 1);
+	stepper *s = w->s;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, w->dydt);   /* at DYDT */
+	lua_rawgeti(L, LUA_REGISTRYINDEX, w->ytab);   /* at YTAB */
+	lua_rawgeti(L, LUA_REGISTRYINDEX, w->ftab);   /* at FTAB */
+	memcpy(s->y, w->y, s->n*sizeof(double));
+	fixed_steps(L, s, w->t, w->dt, w->nsteps);
+	return 0;
+}
+
+static void *ensemble_worker(void *arg) {
+	worker *w = (worker *) arg;
+	lua_State *L = w->L;
+	lua_pushcfunction(L, run_slice);
+	lua_pushlightuserdata(L, w);
+	w->error[0] = '\0';
+	if (lua_pcall(L, 1, 0, 0)) {
+		const char *msg = lua_tostring(L, -1);
+		strncpy(w->error, msg ? msg : "error in dydt", sizeof(w->error)-1);
+		w->error[sizeof(w->error)-1] = '\0';
+	}
+	lua_settop(L, 0);
+	return NULL;
+}
+
+static int c_ensemble_gc(lua_State *L) {
+	ensemble *e = check_ensemble(L, 1);
+	int i;
+	if (e->workers) {
+		for (i = 0; i < e->nworkers; i++) {
+			if (e->workers[i].L) lua_close(e->workers[i].L);
+			free(e->workers[i].s);
+		}
+		free(e->workers);  e->workers = NULL;
+	}
+	free(e->s);  e->s = NULL;
+	return 0;
+}
+
+/* loads dydt into a new Lua state for the worker; returns an error or NULL */
+static const char *new_worker_state(worker *w, const char *code, size_t len,
+  int is_source) {
+	lua_State *L = luaL_newstate();
+	if (! L) return "out of memory";
+	w->L = L;
+	luaL_openlibs(L);
+	if (luaL_loadbuffer(L, code, len, "=dydt")) return "can't load dydt";
+	if (is_source) {
+		if (lua_pcall(L, 0, 1, 0)) return "the dydt source raised an error";
+		if (! lua_isfunction(L, -1)) return "the dydt source must return a function";
+	}
+	w->dydt = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_createtable(L, (int) w->s->n, 0);
+	w->ytab = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_createtable(L, (int) w->s->n, 0);
+	w->ftab = luaL_ref(L, LUA_REGISTRYINDEX);
+	return NULL;
+}
+
+/* dydt, ys, method, nthreads, code, is_source */
+static int c_new_ensemble(lua_State *L) {
+	long i, k, nsystems, dim, chunk, first;
+	int method, nthreads, nworkers;
+	ensemble *e;
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	method   = luaL_checkoption(L, 3, "rk4", methods);
+	nthreads = (int) luaL_optinteger(L, 4, 1);
+	nsystems = (long) lua_rawlen(L, 2);
+	luaL_argcheck(L, nsystems >= 1, 2, "must not be empty");
+	lua_rawgeti(L, 2, 1);
+	luaL_argcheck(L, lua_istable(L, -1), 2, "must be an array of arrays");
+	dim = (long) lua_rawlen(L, -1);
+	lua_pop(L, 1);
+	luaL_argcheck(L, dim >= 1, 2, "the systems must not be empty");
+	if (nthreads < 1) nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > nsystems) nthreads = (int) nsystems;
+	nworkers = (nthreads > 1 && lua_isstring(L, 5)) ? nthreads : 0;
+
+	e = (ensemble *) lua_newuserdata(L,
+	  sizeof(ensemble) + (nsystems*dim-1)*sizeof(double));
+	e->nsystems = nsystems;  e->dim = dim;  e->method = method;
+	e->nworkers = 0;  e->workers = NULL;  e->s = NULL;
+	luaL_getmetatable(L, ENSEMBLE);
+	lua_setmetatable(L, -2);   /* so that __gc frees whatever follows */
+	for (k = 0; k < nsystems; k++) {
+		lua_rawgeti(L, 2, k+1);
+		if (! lua_istable(L, -1) || (long) lua_rawlen(L, -1) != dim)
+			return luaL_argerror(L, 2, "the systems must all be the same size");
+		for (i = 0; i < dim; i++) {
+			lua_rawgeti(L, -1, i+1);
+			e->y[k*dim+i] = luaL_checknumber(L, -1);
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	if (nworkers == 0) {
+		e->s = (stepper *) malloc(STEPPER_SIZE(nsystems*dim));
+		if (! e->s) return luaL_error(L, "RungeKutta: out of memory");
+		init_stepper(e->s, nsystems*dim, method);
+		e->s->nsystems = nsystems;  e->s->dim = dim;  e->s->first = 1;
+		lua_createtable(L, 3, 0);        /* its uservalue: {dydt, y, f} */
+		lua_pushvalue(L, 1);             lua_rawseti(L, -2, 1);
+		lua_createtable(L, (int) (nsystems*dim), 0);  lua_rawseti(L, -2, 2);
+		lua_createtable(L, (int) (nsystems*dim), 0);  lua_rawseti(L, -2, 3);
+		lua_setuservalue(L, -2);
+		return 1;
+	}
+
+	e->workers = (worker *) calloc(nworkers, sizeof(worker));
+	if (! e->workers) return luaL_error(L, "RungeKutta: out of memory");
+	e->nworkers = nworkers;
+	chunk = (nsystems + nworkers - 1) / nworkers;
+	for (i = 0, first = 0; i < nworkers; i++, first += chunk) {
+		worker *w = &(e->workers[i]);
+		size_t len;
+		const char *code = lua_tolstring(L, 5, &len);
+		const char *error;
+		long n = nsystems-first < chunk ? nsystems-first : chunk;
+		if (n < 1) { e->nworkers = (int) i; break; }
+		w->s = (stepper *) malloc(STEPPER_SIZE(n*dim));
+		if (! w->s) return luaL_error(L, "RungeKutta: out of memory");
+		init_stepper(w->s, n*dim, method);
+		w->s->nsystems = n;  w->s->dim = dim;  w->s->first = first+1;
+		w->y = e->y + first*dim;
+		error = new_worker_state(w, code, len, lua_toboolean(L, 6));
+		if (error) return luaL_error(L, "RungeKutta.new_ensemble: %s", error);
+	}
+	return 1;
+}
+
+static int c_ensemble_get(lua_State *L) {   /* ensemble, [k, [y]] */
+	ensemble *e = check_ensemble(L, 1);
+	long k;
+	if (lua_isnoneornil(L, 2)) {
+		lua_createtable(L, (int) e->nsystems, 0);
+		for (k = 0; k < e->nsystems; k++) {
+			push_array(L, 0, e->y + k*e->dim, e->dim);
+			lua_rawseti(L, -2, k+1);
+		}
+		return 1;
+	}
+	k = (long) luaL_checkinteger(L, 2);
+	luaL_argcheck(L, k >= 1 && k <= e->nsystems, 2, "no such system");
+	push_array(L, 3, e->y + (k-1)*e->dim, e->dim);
+	return 1;
+}
+
+static int c_ensemble_set(lua_State *L) {   /* ensemble, k, y */
+	ensemble *e = check_ensemble(L, 1);
+	long i, k = (long) luaL_checkinteger(L, 2);
+	luaL_argcheck(L, k >= 1 && k <= e->nsystems, 2, "no such system");
+	luaL_checktype(L, 3, LUA_TTABLE);
+	luaL_argcheck(L, (long) lua_rawlen(L, 3) == e->dim, 3, "wrong length");
+	for (i = 0; i < e->dim; i++) {
+		lua_rawgeti(L, 3, i+1);
+		e->y[(k-1)*e->dim+i] = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int c_ensemble_step(lua_State *L) {   /* ensemble, t, dt, [nsteps] */
+	ensemble *e = check_ensemble(L, 1);
+	double t  = luaL_checknumber(L, 2);
+	double dt = luaL_checknumber(L, 3);
+	long nsteps = (long) luaL_optinteger(L, 4, 1);
+	int i;
+	if (e->nworkers == 0) {
+		stepper *s = e->s;
+		push_tables(L);
+		memcpy(s->y, e->y, s->n*sizeof(double));
+		t = fixed_steps(L, s, t, dt, nsteps);
+		memcpy(e->y, s->y, s->n*sizeof(double));
+		lua_pushnumber(L, t);
+		return 1;
+	}
+	for (i = 0; i < e->nworkers; i++) {
+		worker *w = &(e->workers[i]);
+		w->t = t;  w->dt = dt;  w->nsteps = nsteps;
+		/* the first slice is done in this thread, while the others run */
+		if (i > 0) w->started
+		  = ! pthread_create(&(w->thread), NULL, ensemble_worker, w);
+	}
+	ensemble_worker(&(e->workers[0]));
+	for (i = 1; i < e->nworkers; i++) {
+		worker *w = &(e->workers[i]);
+		if (w->started) pthread_join(w->thread, NULL);
+		else ensemble_worker(w);   /* it could not be started */
+		w->started = 0;
+	}
+	for (i = 0; i < e->nworkers; i++)   /* all or nothing */
+		if (e->workers[i].error[0])
+			return luaL_error(L, "RungeKutta ensemble: %s", e->workers[i].error);
+	for (i = 0; i < e->nworkers; i++) {
+		worker *w = &(e->workers[i]);
+		memcpy(w->y, w->s->y, w->s->n*sizeof(double));
+	}
+	lua_pushnumber(L, t + nsteps*dt);
+	return 1;
+}
+
+static int c_ensemble_size(lua_State *L) {   /* returns nsystems, dim */
+	ensemble *e = check_ensemble(L, 1);
+	lua_pushinteger(L, (lua_Integer) e->nsystems);
+	lua_pushinteger(L, (lua_Integer) e->dim);
+	return 2;
+}
+
+static const luaL_Reg ensemble_methods[] = {
+	{ "get",  c_ensemble_get  },
+	{ "set",  c_ensemble_set  },
+	{ "step", c_ensemble_step },
+	{ "size", c_ensemble_size },
+	{ NULL, NULL }
+};
+
+static const luaL_Reg prv[] = {
+	{ "new_stepper",  c_new_stepper  },
+	{ "new_ensemble", c_new_ensemble },
+	{ NULL, NULL }
+};
+
+static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
+	/* Lua stack: aux table, prv table, dat table */
+	luaL_newmetatable(L, STEPPER);
+	lua_newtable(L);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, stepper_methods, 0);
+#else
+	luaL_register(L, NULL, stepper_methods);
+#endif
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, ENSEMBLE);
+	lua_newtable(L);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, ensemble_methods, 0);
+#else
+	luaL_register(L, NULL, ensemble_methods);
+#endif
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, c_ensemble_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	lua_pushvalue(L, 2);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, prv, 0);
+#else
+	luaL_register(L, NULL, prv);
+#endif
+	lua_pop(L, 1);
+	return 0;
+}
+
+int luaopen_RungeKutta(lua_State *L) {
+	lua_pushcfunction(L, initialise);
+	return 1;
+}
@@ -0,0 +1,362 @@
+/*
+    C-WalshTransform.c - optional C core for WalshTransform.lua
+
+   This Lua5 module is Copyright (c) 2026, Peter J Billam
+                     www.pjb.com.au
+
+ This module is free software; you can redistribute it and/or
+       modify it under the same terms as Lua5 itself.
+
+ It does fht, fhtinv, fwt and fwtinv in place on contiguous arrays of
+ doubles, with exactly the same arithmetic, in the same order, as the
+ pure-Lua versions, so that the results are identical.  The butterflies
+ of each stage are independent, so the compiler can vectorise them.
+ A buffer holds a batch of equal-length vectors, which are transformed
+ in place in one call, without any Lua tables; logical_convolution also
+ does its transforms and product in a buffer.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <string.h>
+
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#endif
+
+#define BUFFER "WalshTransform.buffer"
+
+static const char *transforms[] = { "fht", "fhtinv", "fwt", "fwtinv", NULL };
+enum { FHT, FHTINV, FWT, FWTINV };
+
+/* log2(n), or -1 if n is not a power of 2, or is less than 2 */
+static int log2_of(long n) {
+	int m = 0;
+	if (n < 2) return -1;
+	while (n > 1) {
+		if (n & 1) return -1;
+		n >>= 1;  m++;
+	}
+	return m;
+}
+
+static void fht(double *mr, long n) {
+	long k, i;
+	for (k = 1; k < n; k += k) {
+		for (i = 0; i < n; i += k+k) {
+			double *restrict a = mr + i;
+			double *restrict b = mr + i + k;
+			long j;
+			for (j = 0; j < k; j++) {   /* vectorisable */
+				a[j] = (a[j] + b[j])/2;
+				b[j] =  a[j] - b[j];
+			}
+		}
+	}
+}
+
+static void fhtinv(double *mr, long n) {
+	long k, i;
+	for (k = 1; k < n; k += k) {
+		for (i = 0; i < n; i += k+k) {
+			double *restrict a = mr + i;
+			double *restrict b = mr + i + k;
+			long j;
+			for (j = 0; j < k; j++) {   /* vectorisable */
+				a[j] = a[j] + b[j];
+				b[j] = a[j] - 2*b[j];
+			}
+		}
+	}
+}
+
+/* the fwt and fwtinv stages go from mr to nr and back again,
+   starting in place if log2(n) is odd, so as to finish in mr */
+static void fwt(double *mr, double *nr, long n, int m) {
+	int alternate = m % 2;
+	long k, kh, nh, nl, l, i;
+	if (alternate) {
+		for (k = 0; k < n; k += 2) {
+			mr[k]   = (mr[k] + mr[k+1])/2;
+			mr[k+1] =  mr[k] - mr[k+1];
+		}
+	} else {
+		for (k = 0; k < n; k += 2) {
+			nr[k]   = (mr[k] + mr[k+1])/2;
+			nr[k+1] =  nr[k] - mr[k+1];
+		}
+	}
+	for (k = 1, nh = n/2; 2*k < n; ) {
+		double *restrict src, *restrict dst;
+		kh = k;  k = k+k;  nh = nh/2;  alternate = !alternate;
+		src = alternate ? nr : mr;
+		dst = alternate ? mr : nr;
+		for (nl = 0, l = 0, i = 0; nl < nh; nl++, i += k) {
+			long nk;
+			for (nk = 0; nk < kh; nk++, l += 4, i += 2) {
+				dst[l]   = (src[i]   + src[i+k])/2;
+				dst[l+1] =  dst[l]   - src[i+k];
+				dst[l+2] = (src[i+1] - src[i+k+1])/2;
+				dst[l+3] =  dst[l+2] + src[i+k+1];
+			}
+		}
+	}
+}
+
+static void fwtinv(double *mr, double *nr, long n, int m) {
+	int alternate = m % 2;
+	long k, kh, nh, nl, l, i;
+	if (alternate) {
+		for (k = 0; k < n; k += 2) {
+			mr[k]   = mr[k] + mr[k+1];
+			mr[k+1] = mr[k] - mr[k+1] - mr[k+1];
+		}
+	} else {
+		for (k = 0; k < n; k += 2) {
+			nr[k]   = mr[k] + mr[k+1];
+			nr[k+1] = mr[k] - mr[k+1];
+		}
+	}
+	for (k = 1, nh = n/2; 2*k < n; ) {
+		double *restrict src, *restrict dst;
+		kh = k;  k = k+k;  nh = nh/2;  alternate = !alternate;
+		src = alternate ? nr : mr;
+		dst = alternate ? mr : nr;
+		for (nl = 0, l = 0, i = 0; nl < nh; nl++, i += k) {
+			long nk;
+			for (nk = 0; nk < kh; nk++, l += 4, i += 2) {
+				dst[l]   = src[i]   + src[i+k];
+				dst[l+1] = src[i]   - src[i+k];
+				dst[l+2] = src[i+1] - src[i+k+1];
+				dst[l+3] = src[i+1] + src[i+k+1];
+			}
+		}
+	}
+}
+
+/* transforms the n doubles in mr in place; nr is n doubles of scratch */
+static void transform(int which, double *mr, double *nr, long n, int m) {
+	switch (which) {
+		case FHT:    fht(mr, n);           break;
+		case FHTINV: fhtinv(mr, n);        break;
+		case FWT:    fwt(mr, nr, n, m);    break;
+		case FWTINV: fwtinv(mr, nr, n, m); break;
+	}
+}
+
+/* WalshTransform.lua's fht etc call this first; it returns nothing,
+   leaving the array to the pure-Lua code, if the length is not a power
+   of 2, or if anything is not a plain number, so that the warnings and
+   errors are the same.  As in Lua5.3, the inverse transforms of integers
+   are integers */
+static int c_transform(lua_State *L) {   /* array, which */
+	int which = luaL_checkoption(L, 2, NULL, transforms);
+	long i, n;
+	int m, is_integer = (which == FHTINV || which == FWTINV);
+	double *mr;
+	if (lua_type(L, 1) != LUA_TTABLE || lua_getmetatable(L, 1)) return 0;
+	n = (long) lua_rawlen(L, 1);
+	if ((m = log2_of(n)) < 0) return 0;
+	mr = (double *) lua_newuserdata(L, 2*n*sizeof(double));
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, i+1);
+		if (lua_type(L, -1) != LUA_TNUMBER) return 0;
+#if LUA_VERSION_NUM >= 503
+		if (! lua_isinteger(L, -1)) is_integer = 0;
+#else
+		is_integer = 0;
+#endif
+		mr[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	transform(which, mr, mr+n, n, m);
+	lua_createtable(L, (int) n, 0);
+	for (i = 0; i < n; i++) {
+#if LUA_VERSION_NUM >= 503
+		if (is_integer) lua_pushinteger(L, (lua_Integer) mr[i]);
+		else
+#endif
+		lua_pushnumber(L, mr[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+/* ------------------- buffers of equal-length vectors ------------------ */
+
+typedef struct buffer {
+	long n;       /* the length of each vector, a power of 2 */
+	long count;   /* the number of vectors */
+	int m;        /* log2(n) */
+	double *nr;   /* n doubles of scratch, after the vectors */
+	double data[1];
+} buffer;
+
+static buffer *check_buffer(lua_State *L, int index) {
+	return (buffer *) luaL_checkudata(L, index, BUFFER);
+}
+
+static double *check_vector(lua_State *L, buffer *b, int index) {
+	long i = (long) luaL_checkinteger(L, index);
+	luaL_argcheck(L, i >= 1 && i <= b->count, index, "no such vector");
+	return b->data + (i-1)*b->n;
+}
+
+static int c_new_buffer(lua_State *L) {   /* n, count */
+	long n     = (long) luaL_checkinteger(L, 1);
+	long count = (long) luaL_optinteger(L, 2, 1);
+	int m = log2_of(n);
+	buffer *b;
+	luaL_argcheck(L, m >= 0, 1, "must be a power of 2");
+	luaL_argcheck(L, count >= 1, 2, "must be positive");
+	b = (buffer *) lua_newuserdata(L, sizeof(buffer)
+	  + ((count+1)*n - 1)*sizeof(double));
+	b->n = n;  b->count = count;  b->m = m;
+	b->nr = b->data + count*n;
+	memset(b->data, 0, count*n*sizeof(double));
+	luaL_getmetatable(L, BUFFER);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int c_buffer_set(lua_State *L) {   /* buffer, i, array */
+	buffer *b = check_buffer(L, 1);
+	double *v = check_vector(L, b, 2);
+	long i;
+	luaL_checktype(L, 3, LUA_TTABLE);
+	luaL_argcheck(L, (long) lua_rawlen(L, 3) == b->n, 3, "wrong length");
+	for (i = 0; i < b->n; i++) {
+		lua_rawgeti(L, 3, i+1);
+		v[i] = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int c_buffer_get(lua_State *L) {   /* buffer, i, [array] */
+	buffer *b = check_buffer(L, 1);
+	double *v = check_vector(L, b, 2);
+	long i;
+	if (lua_istable(L, 3)) lua_settop(L, 3);
+	else lua_createtable(L, (int) b->n, 0);
+	for (i = 0; i < b->n; i++) {
+		lua_pushnumber(L, v[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+static int batch(lua_State *L, int which) {   /* buffer, [i] */
+	buffer *b = check_buffer(L, 1);
+	if (lua_isnoneornil(L, 2)) {
+		long iv;
+		for (iv = 0; iv < b->count; iv++)
+			transform(which, b->data + iv*b->n, b->nr, b->n, b->m);
+	} else {
+		transform(which, check_vector(L, b, 2), b->nr, b->n, b->m);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+static int c_buffer_fht(lua_State *L)    { return batch(L, FHT); }
+static int c_buffer_fhtinv(lua_State *L) { return batch(L, FHTINV); }
+static int c_buffer_fwt(lua_State *L)    { return batch(L, FWT); }
+static int c_buffer_fwtinv(lua_State *L) { return batch(L, FWTINV); }
+
+/* ----------------- logical convolution and autocorrelation ------------- */
+
+/* copies the array at index into v; returns 0 if anything is not a number */
+static int load(lua_State *L, int index, double *v, long n) {
+	long i;
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, index, i+1);
+		if (lua_type(L, -1) != LUA_TNUMBER) return 0;
+		v[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
+/* fwt of a and of b, their product, and its fwtinv, all in one buffer,
+   which is the optional workspace if given, so no Lua tables are created
+   except the result.  The arithmetic is as in the Lua, so the results are
+   identical; if b is a, its fwt is only done once.  As with c_transform
+   it returns nothing, leaving it to the Lua, if a or b is unusual */
+static int c_convolution(lua_State *L) {   /* a, b, [buffer] */
+	long i, n;
+	int m, autocorrelation = lua_rawequal(L, 1, 2);
+	double *x, *y, *nr;
+	if (lua_type(L, 1) != LUA_TTABLE || lua_type(L, 2) != LUA_TTABLE) return 0;
+	if (lua_getmetatable(L, 1) || lua_getmetatable(L, 2)) return 0;
+	n = (long) lua_rawlen(L, 1);
+	if ((long) lua_rawlen(L, 2) != n || (m = log2_of(n)) < 0) return 0;
+	if (lua_isnoneornil(L, 3)) {
+		x = (double *) lua_newuserdata(L, 3*n*sizeof(double));
+		y = x + n;  nr = y + n;
+	} else {
+		buffer *b = check_buffer(L, 3);
+		luaL_argcheck(L, b->n == n && b->count >= 2, 3,
+		  "workspace must be new_buffer(#a,2)");
+		x = b->data;  y = x + n;  nr = b->nr;
+	}
+	if (! load(L, 1, x, n)) return 0;
+	fwt(x, nr, n, m);
+	if (autocorrelation) {
+		for (i = 0; i < n; i++) x[i] = x[i]*x[i];
+	} else {
+		if (! load(L, 2, y, n)) return 0;
+		fwt(y, nr, n, m);
+		for (i = 0; i < n; i++) x[i] = x[i]*y[i];
+	}
+	fwtinv(x, nr, n, m);
+	lua_createtable(L, (int) n, 0);
+	for (i = 0; i < n; i++) {
+		lua_pushnumber(L, x[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+static const luaL_Reg buffer_methods[] = {
+	{ "set",     c_buffer_set     },
+	{ "get",     c_buffer_get     },
+	{ "fht",     c_buffer_fht     },
+	{ "fhtinv",  c_buffer_fhtinv  },
+	{ "fwt",     c_buffer_fwt     },
+	{ "fwtinv",  c_buffer_fwtinv  },
+	{ NULL, NULL }
+};
+
+static const luaL_Reg prv[] = {
+	{ "transform",   c_transform   },
+	{ "new_buffer",  c_new_buffer  },
+	{ "convolution", c_convolution },
+	{ NULL, NULL }
+};
+
+static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
+	/* Lua stack: aux table, prv table, dat table */
+	luaL_newmetatable(L, BUFFER);
+	lua_newtable(L);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, buffer_methods, 0);
+#else
+	luaL_register(L, NULL, buffer_methods);
+#endif
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+	lua_pushvalue(L, 2);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, prv, 0);
+#else
+	luaL_register(L, NULL, prv);
+#endif
+	lua_pop(L, 1);
+	return 0;
+}
+
+int luaopen_WalshTransform(lua_State *L) {
+	lua_pushcfunction(L, initialise);
+	return 1;
+}
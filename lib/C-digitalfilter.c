@@ -0,0 +1,303 @@
+/*
+    C-digitalfilter.c - optional C core for digitalfilter.lua
+
+   This Lua5 module is Copyright (c) 2026, Peter J Billam
+                     www.pjb.com.au
+
+ This module is free software; you can redistribute it and/or
+       modify it under the same terms as Lua5 itself.
+
+ It runs a cascade of the second-order sections that digitalfilter.lua
+ designs, taking the {A0,A1,A2,B0,B1,B2} sets straight from
+ freq_a012b012_to_zm1_A012B012, and keeping the coefficients and the
+ state of all the sections in one contiguous struct-of-arrays.
+ A whole buffer is filtered one section at a time, so that each
+ section's coefficients and state stay in registers for the whole
+ buffer.  The buffer can be a string of native-endian floats
+ (format "float") or int16s ("s16"), as in C-fluidsynth, or an array.
+
+ With more than one channel, the frames are interleaved, and all the
+ channels go through each section in lock-step; the state is laid out
+ channel-fastest, so that neighbouring channels, which are independent,
+ can go through a section together as one SSE or AVX vector.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <string.h>
+#include <math.h>
+
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#endif
+
+#define CASCADE "digitalfilter.cascade"
+
+typedef struct cascade {
+	int nsections;
+	int nchannels;
+	double gain;   /* the chebyschev even-order initial gain, else 1.0 */
+	double *A0, *A1, *A2, *B1, *B2;   /* already divided by B0 */
+	double *u1, *u2, *v1, *v2;   /* u_km1 etc, [isection*nchannels+ichannel] */
+	double *frame;               /* nchannels of scratch for filter_sample */
+	double data[1];
+} cascade;
+
+/* Constantinides eqn. [3.3] p.35, one section at a time over a block */
+static void run_sections(cascade *c, double *x, long n) {
+	int i;
+	long k;
+	for (i = 0; i < c->nsections; i++) {
+		double A0 = c->A0[i], A1 = c->A1[i], A2 = c->A2[i];
+		double B1 = c->B1[i], B2 = c->B2[i];
+		double u1 = c->u1[i], u2 = c->u2[i], v1 = c->v1[i], v2 = c->v2[i];
+		for (k = 0; k < n; k++) {
+			double v = A0*x[k] + A1*u1 + A2*u2 - B1*v1 - B2*v2;
+			u2 = u1;  u1 = x[k];
+			v2 = v1;  v1 = v;
+			x[k] = v;
+		}
+		c->u1[i] = u1;  c->u2[i] = u2;  c->v1[i] = v1;  c->v2[i] = v2;
+	}
+}
+
+/* the same, over a block of nframes interleaved frames of all channels.
+   With gcc or clang, GROUP channels at a time go through each section as
+   one vector, with their state in vector registers: four channels with
+   AVX (-mavx or -march=native on x86-64), else two, as with SSE2.
+   Any remaining channels, or all of them with other compilers,
+   go through one at a time */
+#if defined(__GNUC__)
+#if defined(__AVX__)
+#define GROUP 4
+#else
+#define GROUP 2
+#endif
+typedef double group_t __attribute__ ((vector_size (GROUP*sizeof(double))));
+#endif
+static void run_channels(cascade *c, double *x, long nframes) {
+	int i, ch, nch = c->nchannels;
+	long k;
+	for (i = 0; i < c->nsections; i++) {
+		const double A0 = c->A0[i], A1 = c->A1[i], A2 = c->A2[i];
+		const double B1 = c->B1[i], B2 = c->B2[i];
+		double *su1 = c->u1 + i*nch, *su2 = c->u2 + i*nch;
+		double *sv1 = c->v1 + i*nch, *sv2 = c->v2 + i*nch;
+		ch = 0;
+#ifdef GROUP
+		for (; ch+GROUP <= nch; ch += GROUP) {
+			group_t u, v, u1, u2, v1, v2;
+			memcpy(&u1, su1+ch, sizeof(group_t));
+			memcpy(&u2, su2+ch, sizeof(group_t));
+			memcpy(&v1, sv1+ch, sizeof(group_t));
+			memcpy(&v2, sv2+ch, sizeof(group_t));
+			for (k = 0; k < nframes; k++) {
+				memcpy(&u, x + k*nch + ch, sizeof(group_t));
+				v = A0*u + A1*u1 + A2*u2 - B1*v1 - B2*v2;
+				u2 = u1;  u1 = u;
+				v2 = v1;  v1 = v;
+				memcpy(x + k*nch + ch, &v, sizeof(group_t));
+			}
+			memcpy(su1+ch, &u1, sizeof(group_t));
+			memcpy(su2+ch, &u2, sizeof(group_t));
+			memcpy(sv1+ch, &v1, sizeof(group_t));
+			memcpy(sv2+ch, &v2, sizeof(group_t));
+		}
+#endif
+		for (; ch < nch; ch++) {
+			double u1 = su1[ch], u2 = su2[ch], v1 = sv1[ch], v2 = sv2[ch];
+			for (k = 0; k < nframes; k++) {
+				double u = x[k*nch + ch];
+				double v = A0*u + A1*u1 + A2*u2 - B1*v1 - B2*v2;
+				u2 = u1;  u1 = u;
+				v2 = v1;  v1 = v;
+				x[k*nch + ch] = v;
+			}
+			su1[ch] = u1;  su2[ch] = u2;  sv1[ch] = v1;  sv2[ch] = v2;
+		}
+	}
+}
+
+/* n samples, in blocks small enough to stay in the L1 cache
+   while they go through all the sections */
+#define BLOCK_SAMPLES 1024
+static void run_cascade(cascade *c, double *x, long n) {
+	long k, start, block;
+	long nch = c->nchannels;
+	block = nch < BLOCK_SAMPLES ? (BLOCK_SAMPLES / nch) * nch : nch;
+	for (start = 0; start < n; start += block) {
+		long len = n-start < block ? n-start : block;
+		if (nch == 1) run_sections(c, x+start, len);
+		else          run_channels(c, x+start, len / nch);
+	}
+	if (c->gain != 1.0) for (k = 0; k < n; k++) x[k] *= c->gain;
+}
+
+static cascade *check_cascade(lua_State *L, int index) {
+	return (cascade *) luaL_checkudata(L, index, CASCADE);
+}
+
+static double section_coeff(lua_State *L, int isection, int icoeff) {
+	double coeff;
+	lua_rawgeti(L, -1, icoeff);
+	if (! lua_isnumber(L, -1)) luaL_error(L,
+	  "new_cascade: section %d coefficient %d is not a number",
+	  isection, icoeff);
+	coeff = lua_tonumber(L, -1);
+	lua_pop(L, 1);
+	return coeff;
+}
+
+static int c_new_cascade(lua_State *L) {  /* {{A012B012},...},gain,nch */
+	int i, n, nch, nstate;
+	cascade *c;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	n = (int) lua_rawlen(L, 1);
+	nch = (int) luaL_optinteger(L, 3, 1);
+	luaL_argcheck(L, nch >= 1, 3, "the number of channels must be positive");
+	nstate = n*nch;
+	c = (cascade *) lua_newuserdata(L,
+	  sizeof(cascade) + (5*n + 4*nstate + nch)*sizeof(double));
+	c->nsections = n;
+	c->nchannels = nch;
+	c->gain = luaL_optnumber(L, 2, 1.0);
+	c->A0 = c->data;     c->A1 = c->A0 + n;  c->A2 = c->A1 + n;
+	c->B1 = c->A2 + n;   c->B2 = c->B1 + n;
+	c->u1 = c->B2 + n;   c->u2 = c->u1 + nstate;
+	c->v1 = c->u2 + nstate;   c->v2 = c->v1 + nstate;
+	c->frame = c->v2 + nstate;
+	for (i = 0; i < nstate; i++) c->u1[i] = c->u2[i] = c->v1[i] = c->v2[i] = 0.0;
+	for (i = 0; i < n; i++) {
+		double B0;
+		lua_rawgeti(L, 1, i+1);
+		if (! lua_istable(L, -1))
+			return luaL_error(L, "new_cascade: section %d is not a table", i+1);
+		B0 = section_coeff(L, i+1, 4);
+		c->A0[i] = section_coeff(L, i+1, 1) / B0;
+		c->A1[i] = section_coeff(L, i+1, 2) / B0;
+		c->A2[i] = section_coeff(L, i+1, 3) / B0;
+		c->B1[i] = section_coeff(L, i+1, 5) / B0;
+		c->B2[i] = section_coeff(L, i+1, 6) / B0;
+		lua_pop(L, 1);
+	}
+	luaL_getmetatable(L, CASCADE);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int c_filter_sample(lua_State *L) {  /* cascade, signal, ... */
+	cascade *c = check_cascade(L, 1);
+	int ch;
+	if (c->nchannels == 1) {
+		double x = luaL_checknumber(L, 2);
+		run_sections(c, &x, 1);
+		lua_pushnumber(L, c->gain * x);
+		return 1;
+	}
+	for (ch = 0; ch < c->nchannels; ch++)
+		c->frame[ch] = luaL_checknumber(L, ch+2);
+	run_cascade(c, c->frame, c->nchannels);
+	luaL_checkstack(L, c->nchannels, "filter_sample");
+	for (ch = 0; ch < c->nchannels; ch++) lua_pushnumber(L, c->frame[ch]);
+	return c->nchannels;
+}
+
+static int not_whole_frames(lua_State *L, cascade *c, long n) {
+	if (n % c->nchannels == 0) return 0;
+	lua_pushnil(L);
+	lua_pushfstring(L,
+	  "filter_buffer: %d samples are not a whole number of %d-channel frames",
+	  (int) n, c->nchannels);
+	return 2;
+}
+
+static int c_filter_buffer(lua_State *L) {  /* cascade, samples, format */
+	cascade *c = check_cascade(L, 1);
+	double *x;
+	long k, n;
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		n = (long) lua_rawlen(L, 2);
+		if (not_whole_frames(L, c, n)) return 2;
+		x = (double *) lua_newuserdata(L, (n > 0 ? n : 1)*sizeof(double));
+		for (k = 0; k < n; k++) {
+			lua_rawgeti(L, 2, k+1);
+			x[k] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		run_cascade(c, x, n);
+		lua_createtable(L, (int) n, 0);
+		for (k = 0; k < n; k++) {
+			lua_pushnumber(L, x[k]);
+			lua_rawseti(L, -2, k+1);
+		}
+		return 1;
+	} else if (lua_type(L, 2) == LUA_TSTRING) {
+		size_t len;
+		const char *s = lua_tolstring(L, 2, &len);
+		const char *format = luaL_optstring(L, 3, "s16");
+		if (! strcmp(format, "float")) {
+			float *f;
+			n = (long) (len / sizeof(float));
+			if (not_whole_frames(L, c, n)) return 2;
+			x = (double *) lua_newuserdata(L,
+			  (n > 0 ? n : 1)*(sizeof(double)+sizeof(float)));
+			f = (float *) (x + (n > 0 ? n : 1));
+			memcpy(f, s, n*sizeof(float));
+			for (k = 0; k < n; k++) x[k] = f[k];
+			run_cascade(c, x, n);
+			for (k = 0; k < n; k++) f[k] = (float) x[k];
+			lua_pushlstring(L, (const char *) f, n*sizeof(float));
+			return 1;
+		} else if (! strcmp(format, "s16")) {
+			short *h;
+			n = (long) (len / sizeof(short));
+			if (not_whole_frames(L, c, n)) return 2;
+			x = (double *) lua_newuserdata(L,
+			  (n > 0 ? n : 1)*(sizeof(double)+sizeof(short)));
+			h = (short *) (x + (n > 0 ? n : 1));
+			memcpy(h, s, n*sizeof(short));
+			for (k = 0; k < n; k++) x[k] = h[k];
+			run_cascade(c, x, n);
+			for (k = 0; k < n; k++) {  /* round, and clip */
+				double v = floor(x[k] + 0.5);
+				h[k] = v > 32767.0 ? 32767 : v < -32768.0 ? -32768
+				  : v == v ? (short) v : 0;
+			}
+			lua_pushlstring(L, (const char *) h, n*sizeof(short));
+			return 1;
+		}
+		lua_pushnil(L);
+		lua_pushfstring(L,
+		  "filter_buffer: format must be 'float' or 's16', not '%s'", format);
+		return 2;
+	}
+	lua_pushnil(L);
+	lua_pushstring(L, "filter_buffer: samples must be a string or an array");
+	return 2;
+}
+
+static const luaL_Reg prv[] = {
+	{ "new_cascade",    c_new_cascade    },
+	{ "filter_sample",  c_filter_sample  },
+	{ "filter_buffer",  c_filter_buffer  },
+	{ NULL, NULL }
+};
+
+static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
+	/* Lua stack: aux table, prv table, dat table */
+	luaL_newmetatable(L, CASCADE);
+	lua_pop(L, 1);
+	lua_pushvalue(L, 2);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, prv, 0);
+#else
+	luaL_register(L, NULL, prv);
+#endif
+	lua_pop(L, 1);
+	return 0;
+}
+
+int luaopen_digitalfilter(lua_State *L) {
+	lua_pushcfunction(L, initialise);
+	return 1;
+}
@@ -0,0 +1,274 @@
+/*
+    C-edit_distance.c - optional C helper for edit_distance.lua
+
+   This Lua5 module is Copyright (c) 2026, Peter J Billam
+                     www.pjb.com.au
+
+ This module is free software; you can redistribute it and/or
+       modify it under the same terms as Lua5 itself.
+
+ It maps a dictionary compiled by edit_distance.compile_words read-only
+ into memory, so that loading it costs almost nothing, and processes
+ using the same dictionary share its pages.  The layout, in the byte
+ order of the machine which compiled it, is:
+
+   header    "LUAEDIX1", 0x01020304, nwords, maxlen, nalpha, nhash, textsize
+   uint32    bucket_first[maxlen+2]  the first word of each length
+   uint32    word_off[nwords+1]      where each word starts in the text
+   uint32    alpha[nalpha]           the codepoints used in the words
+             padding to a multiple of 8 bytes
+   int64     hash[nhash]             sorted, see deletion_hashes
+   uint32    hash_id[nhash]          the word of each hash
+   char      text[textsize]          the words, by length
+
+ The words are numbered from 0 in the file, and from 1 in Lua.
+ The hashes are calculated in Lua, which passes them in to look up.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DICTIONARY "edit_distance.dictionary"
+#define MAGIC      "LUAEDIX1"
+#define HEADER     32
+
+typedef struct dictionary {
+	void *base;
+	size_t size;
+	uint32_t nwords, maxlen, nalpha, nhash, textsize;
+	const uint32_t *bucket_first, *word_off, *alpha, *hash_id;
+	const int64_t *hash;
+	const char *text;
+} dictionary;
+
+static dictionary *check_dictionary(lua_State *L, int index) {
+	dictionary *d = (dictionary *) luaL_checkudata(L, index, DICTIONARY);
+	if (! d->base) luaL_argerror(L, index, "the dictionary has been closed");
+	return d;
+}
+
+/* lays out the sections; returns 0 if they don't fit in the file, or if
+   the indexes in them would lead outside it.  They are checked once here,
+   so that the lookups needn't check them again */
+static int layout(dictionary *d) {
+	const char *p = (const char *) d->base;
+	uint32_t h[6], i;
+	size_t off;
+	if (d->size < HEADER || memcmp(p, MAGIC, 8)) return 0;
+	memcpy(h, p+8, sizeof(h));
+	if (h[0] != 0x01020304) return 0;   /* compiled on another machine */
+	d->nwords = h[1];  d->maxlen = h[2];  d->nalpha = h[3];
+	d->nhash  = h[4];  d->textsize = h[5];
+	off = HEADER;
+	d->bucket_first = (const uint32_t *) (p + off);
+	off += 4 * ((size_t) d->maxlen + 2);
+	d->word_off = (const uint32_t *) (p + off);
+	off += 4 * ((size_t) d->nwords + 1);
+	d->alpha = (const uint32_t *) (p + off);
+	off += 4 * (size_t) d->nalpha;
+	off = (off + 7) & ~((size_t) 7);
+	d->hash = (const int64_t *) (p + off);
+	off += 8 * (size_t) d->nhash;
+	d->hash_id = (const uint32_t *) (p + off);
+	off += 4 * (size_t) d->nhash;
+	d->text = p + off;
+	off += d->textsize;
+	if (off > d->size) return 0;
+	if (d->word_off[d->nwords] > d->textsize) return 0;
+	for (i = 0; i < d->nwords; i++)
+		if (d->word_off[i] > d->word_off[i+1]) return 0;
+	for (i = 0; i < d->maxlen + 2; i++) {
+		if (d->bucket_first[i] > d->nwords) return 0;
+		if (i > 0 && d->bucket_first[i-1] > d->bucket_first[i]) return 0;
+	}
+	for (i = 0; i < d->nhash; i++)
+		if (d->hash_id[i] >= d->nwords) return 0;
+	return 1;
+}
+
+/* the first index with hash >= h */
+static uint32_t lower_bound(const dictionary *d, int64_t h) {
+	uint32_t lo = 0, hi = d->nhash;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (d->hash[mid] < h) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static void push_word(lua_State *L, const dictionary *d, uint32_t id) {
+	lua_pushlstring(L, d->text + d->word_off[id],
+	  d->word_off[id+1] - d->word_off[id]);
+}
+
+/* ------------------------- the Lua methods --------------------------- */
+
+static int c_map(lua_State *L) {   /* filename; returns dictionary or nil,msg */
+	const char *filename = luaL_checkstring(L, 1);
+	dictionary *d;
+	struct stat st;
+	void *base;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "can't open %s", filename);
+		return 2;
+	}
+	if (fstat(fd, &st) || st.st_size < HEADER) {
+		close(fd);
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s is not a compiled dictionary", filename);
+		return 2;
+	}
+	base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "can't map %s", filename);
+		return 2;
+	}
+	d = (dictionary *) lua_newuserdata(L, sizeof(dictionary));
+	memset(d, 0, sizeof(dictionary));
+	d->base = base;  d->size = (size_t) st.st_size;
+	luaL_getmetatable(L, DICTIONARY);
+	lua_setmetatable(L, -2);
+	if (! layout(d)) {
+		munmap(d->base, d->size);  d->base = NULL;
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s is not a compiled dictionary", filename);
+		return 2;
+	}
+	return 1;
+}
+
+static int c_close(lua_State *L) {   /* also __gc */
+	dictionary *d = (dictionary *) luaL_checkudata(L, 1, DICTIONARY);
+	if (d->base) munmap(d->base, d->size);
+	d->base = NULL;
+	return 0;
+}
+
+/* appends the words with hash h, that are not yet in seen, to ids */
+static int c_lookup(lua_State *L) {   /* dictionary, h, ids, seen */
+	dictionary *d = check_dictionary(L, 1);
+	int64_t h = (int64_t) luaL_checkinteger(L, 2);
+	uint32_t i;
+	lua_Integer n;
+	luaL_checktype(L, 3, LUA_TTABLE);
+	luaL_checktype(L, 4, LUA_TTABLE);
+	n = (lua_Integer) lua_rawlen(L, 3);
+	for (i = lower_bound(d, h); i < d->nhash && d->hash[i] == h; i++) {
+		lua_Integer id = (lua_Integer) d->hash_id[i] + 1;
+		lua_rawgeti(L, 4, id);
+		if (lua_isnil(L, -1)) {
+			lua_pushboolean(L, 1);
+			lua_rawseti(L, 4, id);
+			lua_pushinteger(L, id);
+			lua_rawseti(L, 3, ++n);
+		}
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+/* is word, whose whole-word hash is h, in the dictionary ? */
+static int c_find(lua_State *L) {   /* dictionary, word, h */
+	dictionary *d = check_dictionary(L, 1);
+	size_t len;
+	const char *word = luaL_checklstring(L, 2, &len);
+	int64_t h = (int64_t) luaL_checkinteger(L, 3);
+	uint32_t i;
+	for (i = lower_bound(d, h); i < d->nhash && d->hash[i] == h; i++) {
+		uint32_t id = d->hash_id[i];
+		if (d->word_off[id+1] - d->word_off[id] == len
+		  && ! memcmp(d->text + d->word_off[id], word, len)) {
+			lua_pushboolean(L, 1);
+			return 1;
+		}
+	}
+	lua_pushboolean(L, 0);
+	return 1;
+}
+
+static int c_word(lua_State *L) {   /* dictionary, id */
+	dictionary *d = check_dictionary(L, 1);
+	lua_Integer id = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, id >= 1 && id <= (lua_Integer) d->nwords, 2, "no such word");
+	push_word(L, d, (uint32_t) (id - 1));
+	return 1;
+}
+
+static int c_nwords(lua_State *L) {
+	dictionary *d = check_dictionary(L, 1);
+	lua_pushinteger(L, (lua_Integer) d->nwords);
+	return 1;
+}
+
+static int c_alphabet(lua_State *L) {
+	dictionary *d = check_dictionary(L, 1);
+	uint32_t i;
+	lua_createtable(L, (int) d->nalpha, 0);
+	for (i = 0; i < d->nalpha; i++) {
+		lua_pushinteger(L, (lua_Integer) d->alpha[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+static int c_words_of_length(lua_State *L) {   /* dictionary, len */
+	dictionary *d = check_dictionary(L, 1);
+	lua_Integer len = luaL_checkinteger(L, 2);
+	uint32_t i, first = 0, last = 0;
+	if (len >= 0 && len <= (lua_Integer) d->maxlen) {
+		first = d->bucket_first[len];  last = d->bucket_first[len+1];
+	}
+	lua_createtable(L, (int) (last - first), 0);
+	for (i = first; i < last; i++) {
+		push_word(L, d, i);
+		lua_rawseti(L, -2, i-first+1);
+	}
+	return 1;
+}
+
+static const luaL_Reg dictionary_methods[] = {
+	{ "lookup",          c_lookup          },
+	{ "find",            c_find            },
+	{ "word",            c_word            },
+	{ "nwords",          c_nwords          },
+	{ "alphabet",        c_alphabet        },
+	{ "words_of_length", c_words_of_length },
+	{ "close",           c_close           },
+	{ NULL, NULL }
+};
+
+static const luaL_Reg prv[] = {
+	{ "map", c_map },
+	{ NULL, NULL }
+};
+
+static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
+	/* Lua stack: aux table, prv table, dat table */
+	luaL_newmetatable(L, DICTIONARY);
+	lua_newtable(L);
+	luaL_setfuncs(L, dictionary_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, c_close);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	lua_pushvalue(L, 2);
+	luaL_setfuncs(L, prv, 0);
+	lua_pop(L, 1);
+	return 0;
+}
+
+int luaopen_edit_distance(lua_State *L) {
+	lua_pushcfunction(L, initialise);
+	return 1;
+}
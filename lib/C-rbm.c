@@ -0,0 +1,427 @@
+/*
+    C-rbm.c - optional C core for rbm.lua
+
+   This Lua5 module is Copyright (c) 2026, Peter J Billam
+                     www.pjb.com.au
+
+ This module is free software; you can redistribute it and/or
+       modify it under the same terms as Lua5 itself.
+
+ It holds each matrix as one contiguous row-major block of doubles,
+ and offers the few kernels that rbm.lua's training needs: a matrix
+ product C = alpha*op(A)*op(B) + beta*C, where op() may transpose,
+ which with beta=1 also updates the weights in place; logistic() fused
+ with the sampling of the binary states; and the squared error.
+ The random numbers for the sampling come from splitmix64, seeded by
+ rbm.lua from math.random on each call.
+ The product is cache-blocked: blocks of op(A) and op(B) are copied
+ into contiguous panels, so that transposed or not, the innermost loop
+ runs along contiguous rows of C and of the op(B) panel, four rows of C
+ at a time, and the compiler can vectorise it.  A big product is split
+ by rows of C among worker threads, which share nothing but A and B.
+ A matrix can also be a view of some consecutive rows of another,
+ so that a mini-batch of the training data needs no copy.
+ Compile with -pthread.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#endif
+
+#define MATRIX "rbm.matrix"
+
+typedef struct matrix {
+	long nrows;
+	long ncols;
+	double *data;      /* row-major, data[i*ncols + j] */
+	double block[1];   /* where data points, unless it's a view */
+} matrix;
+
+static matrix *check_matrix(lua_State *L, int index) {
+	return (matrix *) luaL_checkudata(L, index, MATRIX);
+}
+
+static matrix *push_matrix(lua_State *L, long nrows, long ncols) {
+	matrix *m = (matrix *) lua_newuserdata(L,
+	  sizeof(matrix) + (nrows*ncols - 1)*sizeof(double));
+	m->nrows = nrows;  m->ncols = ncols;  m->data = m->block;
+	memset(m->data, 0, nrows*ncols*sizeof(double));
+	luaL_getmetatable(L, MATRIX);
+	lua_setmetatable(L, -2);
+	return m;
+}
+
+/* ---------------------------- the product ---------------------------- */
+
+#define MB 64    /* rows of op(A) per block */
+#define KB 128   /* the inner dimension per block */
+#define NB 256   /* columns of op(B) per block */
+
+/* C[m][n] = alpha * op(A)[m][k] * op(B)[k][n] + beta * C[m][n], where
+   op(A)[i][p] is A[p*lda+i] if ta else A[i*lda+p], and likewise op(B).
+   Ap and Bp are MB*KB and KB*NB doubles of scratch */
+static void gemm(long m, long n, long k, double alpha,
+  const double *A, long lda, int ta, const double *B, long ldb, int tb,
+  double beta, double *C, long ldc, double *Ap, double *Bp) {
+	long i, j, p, ii, jj, pp;
+	for (i = 0; i < m; i++) {
+		double *c = C + i*ldc;
+		if (beta == 0.0) for (j = 0; j < n; j++) c[j] = 0.0;
+		else if (beta != 1.0) for (j = 0; j < n; j++) c[j] *= beta;
+	}
+	if (alpha == 0.0) return;
+	for (jj = 0; jj < n; jj += NB) {
+		long nb = n-jj < NB ? n-jj : NB;
+		for (pp = 0; pp < k; pp += KB) {
+			long kb = k-pp < KB ? k-pp : KB;
+			for (p = 0; p < kb; p++) for (j = 0; j < nb; j++)
+				Bp[p*nb + j] = tb ? B[(jj+j)*ldb + pp+p] : B[(pp+p)*ldb + jj+j];
+			for (ii = 0; ii < m; ii += MB) {
+				long mb = m-ii < MB ? m-ii : MB;
+				for (i = 0; i < mb; i++) for (p = 0; p < kb; p++)
+					Ap[i*kb + p] = alpha
+					  * (ta ? A[(pp+p)*lda + ii+i] : A[(ii+i)*lda + pp+p]);
+				for (i = 0; i+4 <= mb; i += 4) {
+					double *restrict c0 = C + (ii+i)*ldc + jj;
+					double *restrict c1 = c0 + ldc;
+					double *restrict c2 = c1 + ldc;
+					double *restrict c3 = c2 + ldc;
+					const double *a = Ap + i*kb;
+					for (p = 0; p < kb; p++) {
+						const double *restrict b = Bp + p*nb;
+						double a0 = a[p], a1 = a[kb+p], a2 = a[2*kb+p], a3 = a[3*kb+p];
+						for (j = 0; j < nb; j++) {   /* vectorisable */
+							c0[j] += a0*b[j];  c1[j] += a1*b[j];
+							c2[j] += a2*b[j];  c3[j] += a3*b[j];
+						}
+					}
+				}
+				for (; i < mb; i++) {
+					double *restrict c0 = C + (ii+i)*ldc + jj;
+					for (p = 0; p < kb; p++) {
+						const double *restrict b = Bp + p*nb;
+						double a0 = Ap[i*kb + p];
+						for (j = 0; j < nb; j++) c0[j] += a0*b[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+/* the rows of C, in chunks, each done by its own thread */
+typedef struct gemm_job {
+	long m, n, k;
+	double alpha, beta;
+	const double *A, *B;
+	double *C;
+	long lda, ldb, ldc;
+	int ta, tb;
+	double *Ap, *Bp;
+	pthread_t thread;
+	int started;
+} gemm_job;
+
+static void *gemm_worker(void *arg) {
+	gemm_job *j = (gemm_job *) arg;
+	gemm(j->m, j->n, j->k, j->alpha, j->A, j->lda, j->ta, j->B, j->ldb,
+	  j->tb, j->beta, j->C, j->ldc, j->Ap, j->Bp);
+	return NULL;
+}
+
+/* below about this many multiply-adds, a thread is not worth starting */
+#define FLOPS_PER_THREAD (1L<<20)
+
+/* as gemm, but on up to nthreads threads; returns 0 if out of memory */
+static int threaded_gemm(int nthreads, long m, long n, long k, double alpha,
+  const double *A, long lda, int ta, const double *B, long ldb, int tb,
+  double beta, double *C, long ldc) {
+	gemm_job *jobs;
+	double *scratch;
+	long chunk, i0;
+	int i, njobs;
+	if (nthreads < 1) nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if ((double)m*n*k < (double)nthreads*FLOPS_PER_THREAD)
+		nthreads = (int) ((double)m*n*k / FLOPS_PER_THREAD);
+	if (nthreads > m/4) nthreads = (int) (m/4);
+	if (nthreads < 1) nthreads = 1;
+	chunk = (m + nthreads - 1) / nthreads;
+	chunk = (chunk + 3) & ~3L;   /* four rows at a time */
+	njobs = (int) ((m + chunk - 1) / chunk);
+	jobs = (gemm_job *) calloc(njobs, sizeof(gemm_job));
+	scratch = (double *) malloc(njobs*(MB*KB + KB*NB)*sizeof(double));
+	if (! jobs || ! scratch) { free(jobs); free(scratch); return 0; }
+	for (i = 0, i0 = 0; i < njobs; i++, i0 += chunk) {
+		gemm_job *j = &(jobs[i]);
+		j->m = m-i0 < chunk ? m-i0 : chunk;  j->n = n;  j->k = k;
+		j->alpha = alpha;  j->beta = beta;
+		j->A = ta ? A + i0 : A + i0*lda;  j->lda = lda;  j->ta = ta;
+		j->B = B;  j->ldb = ldb;  j->tb = tb;
+		j->C = C + i0*ldc;  j->ldc = ldc;
+		j->Ap = scratch + i*(MB*KB + KB*NB);  j->Bp = j->Ap + MB*KB;
+		/* the first chunk is done in this thread, while the others run */
+		if (i > 0) j->started
+		  = ! pthread_create(&(j->thread), NULL, gemm_worker, j);
+	}
+	gemm_worker(&(jobs[0]));
+	for (i = 1; i < njobs; i++) {
+		if (jobs[i].started) pthread_join(jobs[i].thread, NULL);
+		else gemm_worker(&(jobs[i]));   /* it could not be started */
+	}
+	free(scratch);  free(jobs);
+	return 1;
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1.0e-9*(double)ts.tv_nsec;
+}
+
+/* --------------------- random numbers, for sampling ------------------ */
+
+static double uniform(unsigned long long *state) {
+	unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+	return (double)(z >> 11) * (1.0/9007199254740992.0);   /* [0,1) */
+}
+
+/* ------------------------- the Lua functions ------------------------- */
+
+static int c_new_matrix(lua_State *L) {   /* nrows, ncols */
+	long nrows = (long) luaL_checkinteger(L, 1);
+	long ncols = (long) luaL_checkinteger(L, 2);
+	luaL_argcheck(L, nrows >= 0, 1, "must not be negative");
+	luaL_argcheck(L, ncols >= 1, 2, "must be positive");
+	push_matrix(L, nrows, ncols);
+	return 1;
+}
+
+/* a view of count rows of m, from row first; it keeps m alive */
+static int c_rows(lua_State *L) {   /* m, first, count */
+	matrix *m = check_matrix(L, 1);
+	long first = (long) luaL_checkinteger(L, 2);
+	long count = (long) luaL_checkinteger(L, 3);
+	matrix *v;
+	luaL_argcheck(L, first >= 1 && first <= m->nrows, 2, "no such row");
+	luaL_argcheck(L, count >= 1 && first+count-1 <= m->nrows, 3,
+	  "not that many rows");
+	v = (matrix *) lua_newuserdata(L, sizeof(matrix));
+	v->nrows = count;  v->ncols = m->ncols;
+	v->data = m->data + (first-1)*m->ncols;
+	luaL_getmetatable(L, MATRIX);
+	lua_setmetatable(L, -2);
+	lua_createtable(L, 1, 0);   /* 5.1 and 5.2 only take a table */
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 1);
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+	return 1;
+}
+
+/* copies a table of rows into a new matrix, with a bias column of 1.0
+   in front of each row if bias is true; with nrows, only the first nrows */
+static int c_matrix_from(lua_State *L) {   /* rows, bias, [nrows] */
+	int bias = lua_toboolean(L, 2);
+	long i, j, nrows, ncols;
+	matrix *m;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	nrows = (long) luaL_optinteger(L, 3, (lua_Integer) lua_rawlen(L, 1));
+	luaL_argcheck(L, nrows >= 1 && nrows <= (long) lua_rawlen(L, 1), 1,
+	  "not enough rows");
+	lua_rawgeti(L, 1, 1);
+	if (! lua_istable(L, -1)) return luaL_error(L, "row 1 is not a table");
+	ncols = (long) lua_rawlen(L, -1);
+	lua_pop(L, 1);
+	m = push_matrix(L, nrows, ncols+bias);
+	for (i = 0; i < nrows; i++) {
+		double *row = m->data + i*m->ncols;
+		lua_rawgeti(L, 1, i+1);
+		if (! lua_istable(L, -1) || (long) lua_rawlen(L, -1) != ncols)
+			return luaL_error(L, "row %d should be a table of %d numbers",
+			  (int) i+1, (int) ncols);
+		if (bias) *row++ = 1.0;
+		for (j = 0; j < ncols; j++) {
+			lua_rawgeti(L, -1, j+1);
+			row[j] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
+/* returns the matrix as a table of rows, from column first_col onwards,
+   re-using the rows table and its row tables if given; if integers is
+   true, the values (the 0 or 1 states) are pushed as integers */
+static int c_to_table(lua_State *L) {   /* m, first_col, [rows], integers */
+	matrix *m = check_matrix(L, 1);
+	long first = (long) luaL_optinteger(L, 2, 1) - 1;
+	int integers = lua_toboolean(L, 4);
+	long i, j;
+	luaL_argcheck(L, first >= 0 && first < m->ncols, 2, "no such column");
+	if (lua_istable(L, 3)) lua_settop(L, 3);
+	else { lua_settop(L, 2); lua_createtable(L, (int) m->nrows, 0); }
+	for (i = 0; i < m->nrows; i++) {
+		const double *row = m->data + i*m->ncols;
+		lua_rawgeti(L, 3, i+1);
+		if (! lua_istable(L, -1)) {
+			lua_pop(L, 1);
+			lua_createtable(L, (int) (m->ncols - first), 0);
+		}
+		for (j = first; j < m->ncols; j++) {
+			if (integers) lua_pushinteger(L, (lua_Integer) row[j]);
+			else lua_pushnumber(L, row[j]);
+			lua_rawseti(L, -2, j-first+1);
+		}
+		lua_rawseti(L, 3, i+1);
+	}
+	return 1;
+}
+
+/* C = alpha * op(A) * op(B) + beta * C, on nthreads threads, or on as
+   many as there are processors if nthreads is 0 */
+static int c_gemm(lua_State *L) {   /* C, A, B, ta, tb, alpha, beta, nthr */
+	matrix *c = check_matrix(L, 1);
+	matrix *a = check_matrix(L, 2);
+	matrix *b = check_matrix(L, 3);
+	int ta = lua_toboolean(L, 4), tb = lua_toboolean(L, 5);
+	double alpha = luaL_optnumber(L, 6, 1.0);
+	double beta  = luaL_optnumber(L, 7, 0.0);
+	int nthreads = (int) luaL_optinteger(L, 8, 1);
+	long m = ta ? a->ncols : a->nrows,  k = ta ? a->nrows : a->ncols;
+	long kb = tb ? b->ncols : b->nrows, n = tb ? b->nrows : b->ncols;
+	luaL_argcheck(L, c->data != a->data && c->data != b->data, 1,
+	  "must not also be A or B");
+	if (k != kb || c->nrows != m || c->ncols != n) return luaL_error(L,
+	  "gemm: %dx%d times %dx%d does not fit into %dx%d",
+	  (int) m, (int) k, (int) kb, (int) n, (int) c->nrows, (int) c->ncols);
+	if (! threaded_gemm(nthreads, m, n, k, alpha, a->data, a->ncols, ta,
+	  b->data, b->ncols, tb, beta, c->data, c->ncols))
+		return luaL_error(L, "gemm: out of memory");
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* m = logistic(m) in place; and if states is given, it is set to 1
+   where m is greater than a uniform random number, else to 0 */
+static int c_logistic(lua_State *L) {   /* m, [states, seed] */
+	matrix *m = check_matrix(L, 1);
+	long i, n = m->nrows * m->ncols;
+	double *x = m->data;
+	if (lua_isnoneornil(L, 2)) {
+		for (i = 0; i < n; i++) x[i] = 1.0/(1.0 + exp(0.0 - x[i]));
+	} else {
+		matrix *s = check_matrix(L, 2);
+		unsigned long long state =
+		  (unsigned long long) luaL_checknumber(L, 3);
+		luaL_argcheck(L, s->nrows == m->nrows && s->ncols == m->ncols, 2,
+		  "states must be the same size");
+		for (i = 0; i < n; i++) {
+			x[i] = 1.0/(1.0 + exp(0.0 - x[i]));
+			s->data[i] = x[i] > uniform(&state) ? 1.0 : 0.0;
+		}
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int c_uniform(lua_State *L) {   /* m, seed */
+	matrix *m = check_matrix(L, 1);
+	unsigned long long state = (unsigned long long) luaL_checknumber(L, 2);
+	long i, n = m->nrows * m->ncols;
+	for (i = 0; i < n; i++) m->data[i] = uniform(&state);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int c_set_column(lua_State *L) {   /* m, column, value */
+	matrix *m = check_matrix(L, 1);
+	long i, j = (long) luaL_checkinteger(L, 2) - 1;
+	double value = luaL_checknumber(L, 3);
+	luaL_argcheck(L, j >= 0 && j < m->ncols, 2, "no such column");
+	for (i = 0; i < m->nrows; i++) m->data[i*m->ncols + j] = value;
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* a = a + b, for the weights and their velocity */
+static int c_add(lua_State *L) {   /* a, b */
+	matrix *a = check_matrix(L, 1);
+	matrix *b = check_matrix(L, 2);
+	long i, n = a->nrows * a->ncols;
+	luaL_argcheck(L, b->nrows == a->nrows && b->ncols == a->ncols, 2,
+	  "must be the same size");
+	for (i = 0; i < n; i++) a->data[i] += b->data[i];
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int c_now(lua_State *L) {   /* the wall-clock, unlike os.clock */
+	lua_pushnumber(L, now_seconds());
+	return 1;
+}
+
+/* the sum of the squares of the differences */
+static int c_sqdiff(lua_State *L) {   /* a, b */
+	matrix *a = check_matrix(L, 1);
+	matrix *b = check_matrix(L, 2);
+	long i, n = a->nrows * a->ncols;
+	double sum = 0.0;
+	luaL_argcheck(L, b->nrows == a->nrows && b->ncols == a->ncols, 2,
+	  "must be the same size");
+	for (i = 0; i < n; i++) {
+		double d = a->data[i] - b->data[i];
+		sum += d*d;
+	}
+	lua_pushnumber(L, sum);
+	return 1;
+}
+
+static const luaL_Reg prv[] = {
+	{ "new_matrix",  c_new_matrix  },
+	{ "rows",        c_rows        },
+	{ "matrix_from", c_matrix_from },
+	{ "to_table",    c_to_table    },
+	{ "gemm",        c_gemm        },
+	{ "logistic",    c_logistic    },
+	{ "uniform",     c_uniform     },
+	{ "set_column",  c_set_column  },
+	{ "add",         c_add         },
+	{ "sqdiff",      c_sqdiff      },
+	{ "now",         c_now         },
+	{ NULL, NULL }
+};
+
+static int initialise(lua_State *L) {  /* Lua Programming Gems p. 335 */
+	/* Lua stack: aux table, prv table, dat table */
+	luaL_newmetatable(L, MATRIX);
+	lua_pop(L, 1);
+	lua_pushvalue(L, 2);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, prv, 0);
+#else
+	luaL_register(L, NULL, prv);
+#endif
+	lua_pop(L, 1);
+	return 0;
+}
+
+int luaopen_rbm(lua_State *L) {
+	lua_pushcfunction(L, initialise);
+	return 1;
+}
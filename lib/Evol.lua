@@ -46,7 +46,270 @@ M.eb = 0.000000001;        -- relative stepsize
 M.ec = 0.0000000000000001; -- absolute error
 M.ed = 0.00000000001;      -- relative error
 
-function M.evol (xb ,sm, func,constrain, tm)
+------------------ infrastructure for population mode ------------------
+-- the lambda candidates of each generation may be evaluated concurrently
+-- by worker processes, forked so that they inherit func; they need posix
+local P  -- luaposix, if installed
+pcall(function() P = require 'posix' end)
+
+local function str2num(s)   -- tonumber, but also inf, -inf and nan
+	local v = tonumber(s)
+	if v then return v end
+	if string.find(s, '^%-inf') then return -math.huge end
+	if string.find(s, '^inf') then return math.huge end
+	return 0/0
+end
+local function write_all(fd, s)
+	while #s > 0 do
+		local n = P.write(fd, s)
+		if not n or n < 1 then return false end
+		s = string.sub(s, n+1)
+	end
+	return true
+end
+local function new_line_reader(fd)
+	local buf = ''
+	return function ()
+		local i = string.find(buf, '\n', 1, true)
+		while not i do
+			local s = P.read(fd, 4096)
+			if not s or s == '' then return nil end
+			buf = buf .. s
+			i = string.find(buf, '\n', 1, true)
+		end
+		local line = string.sub(buf, 1, i-1)
+		buf = string.sub(buf, i+1)
+		return line
+	end
+end
+
+local function wall_clock()   -- in seconds, to the microsecond or better
+	if P.clock_gettime then
+		local ok, t, nsec =
+		  pcall(P.clock_gettime, P.CLOCK_MONOTONIC or 'monotonic')
+		if ok and type(t) == 'table' then return t.tv_sec + 1.0e-9*t.tv_nsec end
+		if ok and t then return t + 1.0e-9*(nsec or 0) end
+	end
+	if P.gettimeofday then
+		local t = P.gettimeofday()
+		if t then return (t.tv_sec or t.sec) + 1.0e-6*(t.tv_usec or t.usec) end
+	end
+	return os.time()
+end
+
+local function stop_workers(workers)
+	for w = 1,#workers do P.close(workers[w].to) end  -- they see EOF
+	for w = 1,#workers do
+		P.close(workers[w].from) ; P.wait(workers[w].pid)
+	end
+	for w = #workers,1,-1 do workers[w] = nil end
+end
+
+local function start_workers(nworkers, func)
+	local workers = {}
+	if nworkers < 2 or not (P and P.fork and P.pipe) then return workers end
+	for w = 1,nworkers do
+		local to_r, to_w = P.pipe()
+		local from_r, from_w = P.pipe()
+		if not to_r or not from_r then break end
+		local pid = P.fork()
+		if pid == 0 then   -- the worker: x in, func(x) out, until EOF
+			-- nothing may unwind out of here, into a copy of the caller
+			local status = pcall(function ()
+				for v = 1,#workers do
+					P.close(workers[v].to) ; P.close(workers[v].from)
+				end
+				P.close(to_w) ; P.close(from_r)
+				local readline = new_line_reader(to_r)
+				local x = {}
+				while true do
+					local line = readline()
+					if not line then break end
+					local i = 0
+					for s in string.gmatch(line, '%S+') do
+						i = i+1; x[i] = str2num(s)
+					end
+					local ok, f = pcall(function ()
+						return string.format('%.17g\n', func(x))
+					end)
+					if ok then
+						ok = write_all(from_w, f)
+					else
+						ok = write_all(from_w,
+						  'E '..string.gsub(tostring(f), '\n', ' ')..'\n')
+					end
+					if not ok then break end
+				end
+			end)
+			P._exit(status and 0 or 1)
+		end
+		P.close(to_r) ; P.close(from_w)
+		if not pid or pid < 0 then P.close(to_w) ; P.close(from_r) ; break end
+		workers[#workers+1] = {
+			pid=pid, to=to_w, from=from_r, readline=new_line_reader(from_r)
+		}
+	end
+	return workers
+end
+
+-- fit[j] = func(pop[j]) for j = first,last, spread over the workers
+local strs = {}
+local function evaluate(func, pop, fit, first, last, workers)
+	local nworkers = #workers
+	if nworkers == 0 then
+		for j = first,last do fit[j] = func(pop[j]) end
+		return
+	end
+	local j0 = first
+	while j0 <= last do
+		local nsent = 0
+		for w = 1,nworkers do
+			local j = j0 + w - 1
+			if j > last then break end
+			local x = pop[j]
+			for i = 1,#x do strs[i] = string.format('%.17g', x[i]) end
+			for i = #x+1,#strs do strs[i] = nil end
+			if not write_all(workers[w].to, table.concat(strs,' ')..'\n') then
+				error('Evol.evol: a worker process has died', 0)
+			end
+			nsent = w
+		end
+		for w = 1,nsent do
+			local line = workers[w].readline()
+			if not line or string.find(line, '^E ') then
+				error(line and string.sub(line, 3) or
+				  'Evol.evol: a worker process has died', 0)
+			end
+			fit[j0 + w - 1] = str2num(line)
+		end
+		j0 = j0 + nsent
+	end
+end
+
+-- the (mu,lambda) and (mu+lambda) strategies, with Rechenberg's rule
+local function population_evol(xb, sm, func, constrain, tm, options)
+	local n = #xb   -- number of variables
+	local mu      = math.floor(options.mu or 1)
+	local lambda  = math.floor(options.lambda or 5*mu)
+	local plus    = options.plus ~= false
+	if mu < 1 then die "Evol.evol mu must be at least 1\n" end
+	if lambda < 1 or (not plus and lambda < mu) then
+		die "Evol.evol lambda must be at least 1, and at least mu if not plus\n"
+	end
+	local nworkers = math.floor(options.workers or 1)
+	-- with workers, tm is wall-clock time, since they use the cpu time
+	local clock = os.clock
+	if nworkers >= 2 and P and P.fork and P.pipe then clock = wall_clock end
+	local clock_o = clock()
+
+	-- all the arrays are allocated here, once; the generations re-use them
+	local pop = {} ; local fit = {}  -- pop[1..mu] are the parents
+	local new_pop = {} ; local new_fit = {} ; local used = {}
+	local parent_fit = {} ; local ranked = {}
+	for j = 1,mu+lambda do pop[j] = {} ; used[j] = false end
+	local best = {}
+	if constrain then xb = constrain(xb) end
+	for i = 1,n do best[i] = xb[i] end
+	local fb = func(best) ; local fc = fb   -- before there are workers
+	for j = 1,mu do
+		for i = 1,n do pop[j][i] = best[i] end
+		fit[j] = fb
+	end
+	local workers = start_workers(nworkers, func)
+	local old_sigpipe   -- so a dead worker makes write fail with EPIPE
+	if #workers > 0 and P.signal and P.SIGPIPE and P.SIG_IGN then
+		old_sigpipe = P.signal(P.SIGPIPE, P.SIG_IGN)
+	end
+	local by_fitness = function (a, b) return fit[a] < fit[b] end
+	local trials = 0 ; local successes = 0 ; local lc = 0
+	local rel_limit
+
+	local function finish(converged)
+		return best, sm, fb, converged
+	end
+
+	local function generations()
+		while true do
+			for j = 1,lambda do   -- the parents take turns to have offspring
+				local p = (j-1) % mu + 1
+				local x = pop[mu+j] ; local xp = pop[p]
+				for i = 1,n do x[i] = xp[i] + gaussn(sm[i]) end
+				if constrain then
+					local xc = constrain(x)
+					if xc ~= x then for i = 1,n do x[i] = xc[i] end end
+				end
+				parent_fit[j] = fit[p]
+			end
+			evaluate(func, pop, fit, mu+1, mu+lambda, workers)
+			for j = 1,lambda do
+				if fit[mu+j] <= parent_fit[j] then successes = successes + 1 end
+			end
+			trials = trials + lambda
+
+			-- select the mu best, of the parents and offspring if plus,
+			-- or of the offspring only; the arrays are moved, not copied
+			local nranked = 0
+			for j = 1,mu+lambda do
+				if plus or j > mu then
+					nranked = nranked+1; ranked[nranked] = j
+				end
+			end
+			for j = nranked+1,#ranked do ranked[j] = nil end
+			table.sort(ranked, by_fitness)
+			for k = 1,mu do
+				new_pop[k] = pop[ranked[k]] ; new_fit[k] = fit[ranked[k]]
+				used[ranked[k]] = true
+			end
+			local m = mu
+			for j = 1,mu+lambda do
+				if not used[j] then m = m+1 ; new_pop[m] = pop[j] end
+				used[j] = false
+			end
+			pop, new_pop = new_pop, pop ; fit, new_fit = new_fit, fit
+			if fit[1] <= fb then
+				fb = fit[1] ; for i = 1,n do best[i] = pop[1][i] end
+			end
+
+			if trials >= n then   -- adjust the step sizes, for success rate 0.2
+				local k = 1
+				if successes < 0.2*trials then k = 0.85
+				elseif successes > 0.2*trials then k = 1.0/0.85
+				end
+				for i=1,n do
+					sm[i] = k * sm[i]
+					rel_limit = math.abs(M.eb * best[i]);
+					if (sm[i] < rel_limit) then sm[i] = rel_limit end
+					if (sm[i] < M.ea) then sm[i] = M.ea; end
+				end
+				trials = 0 ; successes = 0
+				lc = lc + 1
+				if lc >= 25 then
+					-- fit[1] is the best parent, which is fb if plus; if not
+					-- plus, it wanders, and converges as the step sizes shrink
+					local df = math.abs(fc - fit[1])
+					if M.ec and (df <= math.abs(M.ec)) then
+						return finish(true)
+					end
+					if M.ed and (df/math.abs(M.ed) <= math.abs(fc)) then
+						return finish(true)
+					end
+					lc = 0; fc = fit[1]
+				end
+			end
+			if (clock() - clock_o) > tm then return finish(false) end
+		end
+	end
+
+	-- if func or constrain raises an error, the workers must still stop
+	local ok, b, s, f, converged = pcall(generations)
+	stop_workers(workers)
+	if old_sigpipe then P.signal(P.SIGPIPE, old_sigpipe) end
+	if not ok then error(b, 0) end
+	return b, s, f, converged
+end
+--------------------------------------------------------------
+
+function M.evol (xb ,sm, func,constrain, tm, options)
 	if (type(xb) ~= 'table') then
 		die "Evol.evol 1st arg must be a table\n";
 	elseif (type(sm) ~= 'table') then
@@ -55,9 +318,12 @@ function M.evol (xb ,sm, func,constrain, tm)
 		die "Evol.evol 3rd arg must be a function\n";
 	elseif constrain and (type(constrain) ~= 'function') then
 		die "Evol.evol 4th arg must be a function\n";
+	elseif options and (type(options) ~= 'table') then
+		die "Evol.evol 6th arg must be a table\n";
 	end
 	if not tm then tm = 10.0 end
 	tm = math.abs(tm)
+	if options then return population_evol(xb,sm,func,constrain,tm,options) end
 
 	local debug = false
 	local n = #xb;   -- number of variables
@@ -317,6 +583,9 @@ Evol - Evolution search optimisation
 
  local EV = require 'Evol'
  xb, sm, fb, lf = evol(xb, sm, function, constrain, tm)
+ -- or, with a population, evaluated by 4 worker processes
+ xb, sm, fb, lf = evol(xb, sm, function, constrain, tm,
+   {mu=3, lambda=12, workers=4})
  -- or
  xb, sm = select_evol(xb, sm, choose_best, constrain)
 
@@ -371,6 +640,31 @@ I<lf> is set false if the search ran out of cpu time before converging.
 For more control over the convergence criteria, see the
 CONVERGENCE CRITERIA section below.
 
+=item I<evol>( xb, sm, minimise, constrain, tm, options);
+
+If the optional sixth argument I<options> is given, I<evol> uses
+a population of I<mu> parents, which between them have
+I<lambda> offspring in each generation; the I<mu> best of the
+parents and the offspring (or, if I<plus> is false, of the offspring only)
+become the parents of the next generation.
+The step sizes are still adjusted by Rechenberg's rule,
+for a success rate of about 0.2, a success being
+an offspring which is no worse than its parent.
+The arguments and the return values are as above.
+
+ xb, sm, fb, lf = EV.evol(xb, sm, minimise, constrain, tm,
+   { mu=3, lambda=12, plus=false, workers=4 })
+
+The default I<mu> is 1, the default I<lambda> is 5*I<mu>,
+and the default I<plus> is true.
+If I<workers> is more than 1, and the I<posix> module is installed,
+that many worker processes are forked, which evaluate
+the I<lambda> offspring of each generation concurrently.
+This is worthwhile if I<minimise> is slow.
+Since the workers are forked, I<minimise> can use any variables
+it sees, but anything it changes is only changed in that worker.
+With workers, I<tm> is the elapsed time in seconds, not the cpu time.
+
 =item I<select_evol>( xb, sm, choose_best, constrain, nchoices);
 
 Where the arguments are:
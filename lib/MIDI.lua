@@ -3,6 +3,12 @@
 local M = {} -- public interface
 M.Version = 'VERSION'
 M.VersionDate = 'DATESTAMP'
+-- 20261017 6.9 mix_opus_tracks merges the tracks with a heap, not a sort
+-- 20261017 6.9 add new_stats, stats_add, stats_merge and stats_result
+-- 20261017 6.9 add score2index(), which segment() can use
+-- 20261017 6.9 _encode no longer deepcopies, score2midi bypasses score2opus
+-- 20261017 6.9 add scan(), a streaming decoder with include and exclude
+-- 20261017 6.9 midi2opus uses the optional C-MIDI core if it's installed
 -- 20170917 6.8 fix 153: bad argument #1 to 'char' and round dtime
 -- 20160702 6.7 to_millisecs() now handles set_tempo across multiple Tracks
 -- 20150921 6.5 segment restores controllers as well as patch and tempo
@@ -38,6 +44,9 @@ M.VersionDate = 'DATESTAMP'
 -- 20100913 3.7 first released version
 
 ---------------------------- private -----------------------------
+local prv = {} -- private C functions, if the optional C-MIDI is installed
+pcall(function() require('C-MIDI')({}, prv, M) end)  -- 6.9
+
 local sysex2midimode = {
 	["\126\127\09\01\247"] = 1,
 	["\126\127\09\02\247"] = 0,
@@ -231,17 +240,19 @@ The options:
 	local event_code = -1 -- used for running status
 	local event_count = 0
 	local events = {}
+	local ticks = 0  -- the absolute time, for event_callback 6.9
 
 	local i = 1     -- in Lua, i is the pointer to within the trackdata
 	while i < #trackdata do   -- loop while there's anything to analyze
 		local eot = false -- when True event registrar aborts this loop 4.6,4.7
    		event_count = event_count + 1
 
-		local E = {} -- event; feed it to the event registrar at the end. 4.7
+		local E -- event; feed it to the event registrar at the end. 4.7, 6.9
 
 		-- Slice off the delta time code, and analyze it
 		local time
 		time, i = str2ber_int(trackdata, i)
+		ticks = ticks + time   -- 6.9
 
 		-- Now let's see what we can make of the command
 		local first_byte = string.byte(trackdata,i); i = i+1
@@ -532,12 +543,16 @@ The options:
 			end
 		end
 
-		if E and not exclude[E[1]] then
+		if E and E[1] and not exclude[E[1]] then  -- 6.9 E[1]
 			--if ( $exclusive_event_callback ):
 			--    &{ $exclusive_event_callback }( @E );
 			--else
 			--    &{ $event_callback }( @E ) if $event_callback;
-			events[#events+1] = E
+			if event_callback then  -- 6.9
+				if event_callback(E, ticks) == false then break end
+			else
+				events[#events+1] = E
+			end
 		end
 		if eot then break end
 	end
@@ -546,144 +561,136 @@ The options:
 	return events
 end
 
-local function _encode(events_lol)
+local byte2char = {}  -- 6.9 the one-byte strings, to save string.char calls
+for b = 0,255 do byte2char[b] = string.char(b) end
+local midi_event2status = {  -- 6.9 the events eligible for running status
+	note_off=128, note_on=144, key_after_touch=160, control_change=176,
+	patch_change=192, channel_after_touch=208, pitch_wheel_change=224,
+}
+local text_event2type = {  -- 6.9
+	text_event=1, copyright_text_event=2, track_name=3, instrument_name=4,
+	lyric=5, marker=6, cue_point=7, text_event_08=8, text_event_09=9,
+	text_event_0a=10, text_event_0b=11, text_event_0c=12, text_event_0d=13,
+	text_event_0e=14, text_event_0f=15, sequencer_specific=127,
+}
+
+local function ber_chunks(data, n, integer)  -- 6.9
+	-- appends ber_compressed_int(integer) to data[n], returns the new n
+	if integer < 128 then
+		data[n+1] = byte2char[integer % 128]
+		return n+1
+	elseif integer < 16384 then
+		data[n+1] = byte2char[128 + math.floor(integer/128)]
+		data[n+2] = byte2char[integer % 128]
+		return n+2
+	end
+	data[n+1] = ber_compressed_int(integer)
+	return n+1
+end
+
+local function _encode(events, abs_times)
+	-- 6.9 events is neither copied nor modified. With abs_times, as from
+	-- score_track_events, the times are absolute and get converted here.
 	local no_running_status = false
 	local no_eot_magic      = false   -- 4.6
 	local never_add_eot     = false   -- 4.6
 	local unknown_callback  = false   -- 4.6
 	local data = {} -- what I'll store the chunks of byte-data in
-
-	-- This is so my end_track magic won't corrupt the original
-	local events = deepcopy(events_lol)
-
-	if not never_add_eot then -- One way or another, tack on an 'end_track'
-		if #events > 0 then   -- 5.7
-			local last = events[#events] -- 4.5, 4.7
+	local n = 0     -- 6.9 #data
+
+	-- One way or another, tack on an 'end_track'; this used to be done
+	-- on a deepcopy of the events, now it's done while encoding them 6.9
+	local nevents = #events
+	local add_eot = false
+	local last_becomes_eot = false
+	if not never_add_eot then
+		if nevents > 0 then   -- 5.7
+			local last = events[nevents] -- 4.5, 4.7
 			if not (last[1] == 'end_track') then  -- no end_track already
-				if (last[1] == 'text_event' and last[3] == '') then -- 4.5,4.6
-					-- 0-length text event at track-end. 
-					if no_eot_magic then
-						-- Exceptional case: don't mess with track-final
-						-- 0-length text_events; just peg on an end_track
-						events.append({'end_track', 0})
-					else
-						-- NORMAL CASE: replace with an end_track, leaving DTime
-						last[1] = 'end_track'
-					end
+				if last[1] == 'text_event' and last[3] == ''
+				  and not no_eot_magic then  -- 4.5,4.6
+					-- 0-length text event at track-end.
+					-- NORMAL CASE: replace with an end_track, leaving DTime
+					last_becomes_eot = true
 				else
 					-- last event was neither 0-length text_event nor end_track
-					events[#events+1] = {'end_track', 0}
+					add_eot = true
 				end
 			end
 		else  -- an eventless track!
-			events = { {'end_track', 0},}
+			add_eot = true
 		end
 	end
 
 	-- maybe_running_status = not no_running_status  -- unused? 4.7
 	local last_status = -1 -- 4.7
+	local abs_time = 0
+	local completed = true -- false if we break out of the loop
 
-	for k,E in ipairs(events) do
+	for k = 1,nevents do
+		local E = events[k]
 		-- get rid of the two pop's and increase the other E[] indices by two
-		if not E then break end
+		if not E then completed = false ; break end
 
 		local event = E[1] -- 4.7
-		if #event < 1 then break end
+		if #event < 1 then completed = false ; break end
+		if k == nevents and last_becomes_eot then event = 'end_track' end
 
-		local dtime = round(E[2]) -- 4.7 6.8
+		local dtime -- 4.7
+		if abs_times then  -- 6.9
+			dtime = round(E[2] - abs_time)
+			abs_time = E[2]
+		else
+			dtime = round(E[2]) -- 6.8
+		end
 		-- print('event='..event..' dtime='..dtime)
 
-		local event_data = '' -- 4.7
-
-		if    -- MIDI events -- eligible for running status
-			 event	== 'note_on'
-			 or event == 'note_off'
-			 or event == 'control_change'
-			 or event == 'key_after_touch'
-			 or event == 'patch_change'
-			 or event == 'channel_after_touch'
-			 or event == 'pitch_wheel_change'   then
+		local event_data = nil -- 4.7
+		local status = midi_event2status[event] -- 6.9
 
+		if status then -- MIDI events -- eligible for running status
 			-- This block is where we spend most of the time.  Gotta be tight.
-			local status = nil     -- 4.7
-			local parameters = nil -- 4.7
-			if (event == 'note_off') then
-				status = 128 + (E[3] % 16)
-				parameters = int2sevenbits(E[4]%128)..int2sevenbits(E[5]%128)
-			elseif event == 'note_on' then
-				status = 144 + (E[3] % 16)
-				parameters = int2sevenbits(E[4]) .. int2sevenbits(E[5])
-			elseif event == 'key_after_touch' then
-				status = 160 + (E[3] % 16)
-				parameters = int2sevenbits(E[4]) .. int2sevenbits(E[5])
-			elseif event == 'control_change' then
-				status = 176 + (E[3] % 16)
-				parameters = int2sevenbits(E[4]) .. int2sevenbits(E[5])
-			elseif event == 'patch_change' then
-				status = 192 + (E[3] % 16)
-				parameters = int2sevenbits(E[4])
-			elseif event == 'channel_after_touch' then
-				status = 208 + (E[3] % 16)
-				parameters = int2sevenbits(E[4])
-			elseif event == 'pitch_wheel_change' then
-				status = 224 + (E[3] % 16)
-				parameters =  write_14_bit(E[4] + 8192)
+			local base = status
+			status = base + (E[3] % 16)
+			local p1, p2
+			if base == 128 then  -- note_off
+				p1 = byte2char[math.floor((E[4]%128 + 0.5) % 128)]
+				p2 = byte2char[math.floor((E[5]%128 + 0.5) % 128)]
+			elseif base == 192 or base == 208 then
+				p1 = byte2char[math.floor((E[4] + 0.5) % 128)]
+			elseif base == 224 then
+				p1 = write_14_bit(E[4] + 8192)
 			else
-				warn("BADASS FREAKOUT ERROR 31415!")
+				p1 = byte2char[math.floor((E[4] + 0.5) % 128)]
+				p2 = byte2char[math.floor((E[5] + 0.5) % 128)]
 			end
 
 			-- And now the encoding
 
-			data[#data+1] = ber_compressed_int(dtime)
+			n = ber_chunks(data, n, dtime)
 			if (status ~= last_status) or no_running_status then
-				data[#data+1] = int2byte(status)
+				n = n+1 ; data[n] = byte2char[math.floor((status+0.5) % 256)]
 			end
-			data[#data+1] = parameters
+			n = n+1 ; data[n] = p1
+			if p2 then n = n+1 ; data[n] = p2 end
 			last_status = status
 			-- break
 		else
 			-- Not a MIDI event.
 			last_status = -1
 
-			if event == 'raw_meta_event' then
+			local text_type = text_event2type[event]  -- 6.9
+			if text_type then  -- a case for a dict, I think (pjb) ...
+				local text = E[3] or 'some_text'  -- as in some_text_event
+				n = ber_chunks(data, n, dtime)
+				data[n+1] = '\255' ; data[n+2] = byte2char[text_type]
+				n = ber_chunks(data, n+2, #text)
+				n = n+1 ; data[n] = text
+			elseif event == 'raw_meta_event' then
 				event_data = some_text_event(E[3], E[4])
 			elseif (event == 'set_sequence_number') then  -- 3.9
 				event_data = some_text_event(0, int2twobytes(E[3]))
 
-			-- Text Meta-events...
-			-- a case for a dict, I think (pjb) ...
-			elseif (event == 'text_event') then
-				event_data = some_text_event(1, E[3])
-			elseif (event == 'copyright_text_event') then
-				event_data = some_text_event(2, E[3])
-			elseif (event == 'track_name') then
-				event_data = some_text_event(3, E[3])
-			elseif (event == 'instrument_name') then
-				event_data = some_text_event(4, E[3])
-			elseif (event == 'lyric') then
-				event_data = some_text_event(5, E[3])
-			elseif (event == 'marker') then
-				event_data = some_text_event(6, E[3])
-			elseif (event == 'cue_point') then
-				event_data = some_text_event(7, E[3])
-			elseif (event == 'text_event_08') then
-				event_data = some_text_event(8, E[3])
-			elseif (event == 'text_event_09') then
-				event_data = some_text_event(9, E[3])
-			elseif (event == 'text_event_0a') then
-				event_data = some_text_event(10, E[3])
-			elseif (event == 'text_event_0b') then
-				event_data = some_text_event(11, E[3])
-			elseif (event == 'text_event_0c') then
-				event_data = some_text_event(12, E[3])
-			elseif (event == 'text_event_0d') then
-				event_data = some_text_event(13, E[3])
-			elseif (event == 'text_event_0e') then
-				event_data = some_text_event(14, E[3])
-			elseif (event == 'text_event_0f') then
-				event_data = some_text_event(15, E[3])
-			-- End of text meta-events
-
 			elseif (event == 'end_track') then
 				event_data = '\255\47\0'
 			elseif (event == 'set_tempo') then
@@ -699,8 +706,6 @@ local function _encode(events_lol)
 			elseif (event == 'key_signature') then
 				local e3 = E[3]; if e3<0 then e3 = 256+e3 end  -- signed byte
 				event_data = '\255\89\02' .. string.char(e3,E[4])
-			elseif (event == 'sequencer_specific') then
-				event_data = some_text_event(127, E[3])
 			-- End of Meta-events
 
 			-- Other Things...
@@ -718,7 +723,7 @@ local function _encode(events_lol)
 				 event_data = "\246"
 			elseif (event == 'raw_data') then
 				warn("_encode: raw_data event not supported")
-				break
+				completed = false ; break
 			-- End of Other Stuff
 
 			-- The Big Fallthru
@@ -726,24 +731,294 @@ local function _encode(events_lol)
 				if not unknown_callback then
 					warn("Unknown event: "..tostring(event))
 				end
-				break
+				completed = false ; break
 			end
 
-			--print "Event $event encoded part 2\n"
-			--if str(type(event_data)).find('str') >= 0 then
-			--	event_data = bytearray(event_data.encode('Latin1', 'ignore'))
-			--end
 			if event_data and (#event_data > 0) then -- how could it be empty?
-				-- data.append(struct.pack('>wa*', dtime, event_data))
-				-- print(' event_data='+str(event_data))
-				data[#data+1] = ber_compressed_int(dtime)
-				data[#data+1] = event_data
+				n = ber_chunks(data, n, dtime)
+				n = n+1 ; data[n] = event_data
 			end
 		end
 	end
+	if add_eot and completed then
+		n = n+1 ; data[n] = '\000\255\47\000'
+	end
 	return table.concat(data)
 end
 
+local function score_track_events(score_track)  -- 6.9
+	-- returns the events of a score track, sorted by their (absolute) time,
+	-- with each note split into a note_on and a note_off.  The other events
+	-- are the originals, not copies, so they must not be modified.
+	local time2events = {}
+	local k,scoreevent; for k,scoreevent in ipairs(score_track) do
+		local continue = false
+		if scoreevent[1] == 'note' then
+			local note_on_event = {'note_on',scoreevent[2],
+			 scoreevent[4],scoreevent[5],scoreevent[6]}
+			local note_off_event = {'note_off',scoreevent[2]+scoreevent[3],
+			 scoreevent[4],scoreevent[5],scoreevent[6]}
+			if time2events[note_on_event[2]] then
+			   table.insert(time2events[note_on_event[2]], note_on_event)
+			else
+			   time2events[note_on_event[2]] = {note_on_event,}
+			end
+			if time2events[note_off_event[2]] then
+			   table.insert(time2events[note_off_event[2]], note_off_event)
+			else
+			   time2events[note_off_event[2]] = {note_off_event,}
+			end
+			continue = true
+		end
+		if not continue then
+			if time2events[scoreevent[2]] then
+				table.insert(time2events[scoreevent[2]], scoreevent)
+			else
+				time2events[scoreevent[2]] = {scoreevent, }
+			end
+		end
+	end
+	local sorted_times = {}  -- list of keys
+	for k,v in pairs(time2events) do
+		sorted_times[#sorted_times+1] = k
+	end
+	table.sort(sorted_times)
+	local sorted_events = {} -- once-flattened list of values sorted by key
+	for k,time in ipairs(sorted_times) do
+		for k2,v in ipairs(time2events[time]) do
+			sorted_events[#sorted_events+1] = v
+		end
+	end
+	return sorted_events
+end
+
+local function _midi(ticks, ntracks, encoded_track)  -- 6.9
+	-- encoded_track(i) must return the encoded data of the i'th track
+	local format
+	if ntracks == 1 then format = 0 else format = 1 end
+	local chunks = { "MThd\00\00\00\06" ..
+	 int2twobytes(format) .. int2twobytes(ntracks) .. int2twobytes(ticks) }
+	-- struct.pack('>HHH',format,ntracks,ticks)
+	for i = 1, ntracks do
+		local events = encoded_track(i)
+		chunks[#chunks+1] = 'MTrk' .. int2fourbytes(#events)
+		chunks[#chunks+1] = events
+	end
+	clean_up_warnings()
+	return table.concat(chunks)
+end
+
+local Checkpoint_interval = 64  -- 6.9 events between checkpoints
+
+local function index_track(track)  -- 6.9 used by score2index and segment
+	-- order[] is the events in (time, position-in-track) order, and times[]
+	-- their times.  After every Checkpoint_interval events of order[],
+	-- checkpoints[] holds the state which segment restores: the recentest
+	-- set_tempo, and patch_change and control_change by channel.
+	local order = {}
+	for k = 1,#track do order[k] = k end
+	local in_order = true
+	for k = 2,#track do
+		if track[k][2] < track[k-1][2] then in_order = false ; break end
+	end
+	if not in_order then
+		table.sort(order, function (a,b)
+			local ta, tb = track[a][2], track[b][2]
+			if ta == tb then return a < b end
+			return ta < tb
+		end)
+	end
+	local times = {}
+	local checkpoints = { [0] = {patch={}, cc={}} }
+	local tempo, patch, cc = nil, {}, {}
+	for k,j in ipairs(order) do
+		local event = track[j]
+		times[k] = event[2]
+		if event[2] >= 0 then
+			if event[1] == 'control_change' then
+				cc[event[3]] = event
+			elseif event[1] == 'patch_change' then
+				patch[event[3]] = event
+			elseif event[1] == 'set_tempo' then
+				tempo = event
+			end
+		end
+		if k % Checkpoint_interval == 0 then
+			checkpoints[k/Checkpoint_interval] =
+			  { tempo=tempo, patch=copy(patch), cc=copy(cc) }
+		end
+	end
+	return { order=order, times=times, in_order=in_order,
+	  checkpoints=checkpoints }
+end
+
+local function first_after(times, t, strictly)  -- 6.9 binary search
+	-- returns the first k with times[k] >= t, or > t if strictly
+	local lo, hi = 1, #times+1
+	while lo < hi do
+		local mid = math.floor((lo+hi)/2)
+		if times[mid] < t or (strictly and times[mid] == t) then
+			lo = mid+1
+		else
+			hi = mid
+		end
+	end
+	return lo
+end
+
+local function indexed_segment(track_index, track, start, endt)  -- 6.9
+	-- returns the same new_track and state as segment's linear search
+	local order = track_index.order
+	local times = track_index.times
+	local new_track = {}
+	local k1 = first_after(times, start, false)
+	local k2 = first_after(times, endt,  true) - 1
+	if k1 <= k2 then
+		if track_index.in_order then
+			for k = k1,k2 do new_track[#new_track+1] = track[order[k]] end
+		else  -- put them back in their order within the track
+			local js = {}
+			for k = k1,k2 do js[#js+1] = order[k] end
+			table.sort(js)
+			for n,j in ipairs(js) do new_track[n] = track[j] end
+		end
+	end
+	-- the state at the start is that at the checkpoint, plus what follows
+	local last = first_after(times, start, true) - 1
+	local icp  = math.floor(last / Checkpoint_interval)
+	local checkpoint = track_index.checkpoints[icp]
+	local tempo = checkpoint.tempo
+	local patch = copy(checkpoint.patch)
+	local cc    = copy(checkpoint.cc)
+	for k = icp*Checkpoint_interval+1, last do
+		local event = track[order[k]]
+		if event[2] >= 0 then
+			if event[1] == 'control_change' then
+				cc[event[3]] = event
+			elseif event[1] == 'patch_change' then
+				patch[event[3]] = event
+			elseif event[1] == 'set_tempo' then
+				tempo = event
+			end
+		end
+	end
+	local set_tempo_num = 500000
+	if tempo then set_tempo_num = tempo[3] end
+	local channel2patch_num = {}
+	for c,event in pairs(patch) do channel2patch_num[c] = event[4] end
+	local channel2cc_num, channel2cc_val = {}, {}
+	for c,event in pairs(cc) do
+		channel2cc_num[c] = event[4]
+		channel2cc_val[c] = event[5]
+	end
+	return new_track, set_tempo_num, channel2patch_num,
+	  channel2cc_num, channel2cc_val
+end
+
+-- 6.9 a binary heap of arrays, ordered by [1] and then [2]
+local function heap_less(a, b)
+	if a[1] == b[1] then return a[2] < b[2] end
+	return a[1] < b[1]
+end
+local function heap_sift_down(heap, i)
+	local n = #heap
+	local item = heap[i]
+	while true do
+		local child = 2*i
+		if child > n then break end
+		if child < n and heap_less(heap[child+1], heap[child]) then
+			child = child + 1
+		end
+		if not heap_less(heap[child], item) then break end
+		heap[i] = heap[child]
+		i = child
+	end
+	heap[i] = item
+end
+local function heap_push(heap, item)
+	local i = #heap + 1
+	while i > 1 do
+		local parent = math.floor(i/2)
+		if not heap_less(item, heap[parent]) then break end
+		heap[i] = heap[parent]
+		i = parent
+	end
+	heap[i] = item
+end
+local function heap_pop(heap)
+	local top = heap[1]
+	local n = #heap
+	heap[1] = heap[n]
+	heap[n] = nil
+	if n > 1 then heap_sift_down(heap, 1) end
+	return top
+end
+local function heap_replace_top(heap, item)
+	heap[1] = item
+	heap_sift_down(heap, 1)
+end
+
+local function track2started_notes(opus_track)  -- 6.9
+	-- like opus2score, but the score_track is in order of start-time,
+	-- with each note where its note_on was.  Used by mix_opus_tracks.
+	local ticks_so_far = 0
+	local score_track = {}
+	local in_order = true
+	local chapitch2note_on_events = {}
+	for k,opus_event in ipairs(opus_track) do
+		if opus_event[2] < 0 then in_order = false end
+		ticks_so_far = ticks_so_far + opus_event[2]
+		if opus_event[1] == 'note_off' or
+		 (opus_event[1] == 'note_on' and opus_event[5] == 0) then
+			local cha = opus_event[3]
+			local pitch = opus_event[4]
+			local key = cha*128 + pitch
+			local pending_notes = chapitch2note_on_events[key]
+			if pending_notes and #pending_notes > 0 then
+				local new_e = table.remove(pending_notes, 1)
+				new_e[3] = ticks_so_far - new_e[2]
+			elseif pitch > 127 then
+				warn('opus2score: note_off with no note_on, bad pitch='
+				 ..tostring(pitch))
+			else
+				warn('opus2score: note_off with no note_on cha='
+				 ..tostring(cha)..' pitch='..tostring(pitch))
+			end
+		elseif opus_event[1] == 'note_on' then
+			local cha = opus_event[3]
+			local pitch = opus_event[4]
+			local new_e = {'note',ticks_so_far,false,cha,pitch,opus_event[5]}
+			local key = cha*128 + pitch
+			if chapitch2note_on_events[key] then
+				table.insert(chapitch2note_on_events[key], new_e)
+			else
+				chapitch2note_on_events[key] = {new_e,}
+			end
+			score_track[#score_track+1] = new_e
+		else
+			local new_e = copy(opus_event)
+			new_e[2] = ticks_so_far
+			score_track[#score_track+1] = new_e
+		end
+	end
+	for chapitch,note_on_events in pairs(chapitch2note_on_events) do
+		for k,new_e in ipairs(note_on_events) do
+			new_e[3] = ticks_so_far - new_e[2]
+			warn("opus2score: note_on with no note_off cha="..new_e[4]
+			 ..' pitch='..new_e[5]..'; adding note_off at end')
+		end
+	end
+	if not in_order then  -- negative delta-times; a stable sort
+		local positions = {}
+		for k,e in ipairs(score_track) do positions[e] = k end
+		table.sort(score_track, function (a,b)
+			if a[2] == b[2] then return positions[a] < positions[b] end
+			return a[2] < b[2]
+		end)
+	end
+	return score_track
+end
+
 local function consistentise_ticks(scores) -- 3.6
 	-- used by mix_scores, merge_scores, concatenate_scores
 	if #scores == 1 then return deepcopy(scores) end
@@ -764,7 +1039,7 @@ local function consistentise_ticks(scores) -- 3.6
 end
 
 -------------------------- public ------------------------------
-M.All_events = readOnly{
+local all_events = {  -- 6.9
 	note_off=true, note_on=true, key_after_touch=true, control_change=true,
 	patch_change=true, channel_after_touch=true, pitch_wheel_change=true,
 	text_event=true, copyright_text_event=true, track_name=true,
@@ -778,6 +1053,7 @@ M.All_events = readOnly{
 	sysex_f0=true, sysex_f7=true,
 	song_position=true, song_select=true, tune_request=true,
 }
+M.All_events = readOnly(all_events)
 -- And three dictionaries:
 M.Number2patch = readOnly{   -- General MIDI patch numbers:
 [0]='Acoustic Grand',
@@ -972,9 +1248,15 @@ function M.concatenate_scores(scores)
 	-- e.g. if invoked by midisox's repeat()
 	local input_scores = consistentise_ticks(scores) -- 3.6
 	local output_score = deepcopy(input_scores[1])   -- 4.2
+	-- 6.9 the stats accumulate, instead of being recalculated every time
+	local output_stats = M.new_stats()
+	for itrack = 2,#output_score do
+		for k,event in ipairs(output_score[itrack]) do
+			M.stats_add(output_stats, event)
+		end
+	end
 	for i = 2,#input_scores do
 		local input_score = input_scores[i]
-		local output_stats = M.score2stats(output_score)
 		local delta_ticks = output_stats['nticks']
 		for itrack = 2,#input_score do
 			if itrack > #output_score then -- new output track if doesn't exist
@@ -984,6 +1266,7 @@ function M.concatenate_scores(scores)
 				local new_event = copy(event)
 				new_event[2] = new_event[2] + delta_ticks
 				table.insert(output_score[itrack], new_event)
+				M.stats_add(output_stats, new_event)
 				-- output_score[itrack][-1][1] += delta_ticks  -- hmm...
 			end
 		end
@@ -1059,17 +1342,61 @@ function M.merge_scores(scores)
 end
 
 function M.mix_opus_tracks(input_tracks) -- 5.5
-	-- must convert each track to absolute times !
-	local output_score = {1000, {}}
+	-- 6.9 Each track becomes its score-events (as from opus2score) but in
+	-- order of start-time; these are merged by a heap, stable for equal
+	-- times, and the note_offs wait in another heap, ordered as score2opus
+	-- would order them.  Previously all events were table.sort'ed.
+	local tracks = {}
 	for ks,input_track in ipairs(input_tracks) do -- 5.8
-		local input_score = M.opus2score({1000, input_track})
-		for k,event in ipairs(input_score[2]) do
-			table.insert(output_score[2], event)
+		tracks[ks] = track2started_notes(input_track)
+	end
+	local merge = {}   -- heap of {time, itrack, position}
+	for itrack,track in ipairs(tracks) do
+		if #track > 0 then heap_push(merge, {track[1][2], itrack, 1}) end
+	end
+	local note_offs = {}  -- heap of {time, seq, note_off_event}
+	local seq = 0
+	local output_track = {}
+	local abs_time = 0
+	local function output(time, event)
+		event[2] = time - abs_time
+		abs_time = time
+		output_track[#output_track+1] = event
+	end
+	while #merge > 0 do
+		local top = merge[1]
+		local time, itrack, position = top[1], top[2], top[3]
+		local score_event = tracks[itrack][position]
+		while #note_offs > 0 and note_offs[1][1] <= time do
+			local note_off = heap_pop(note_offs)
+			output(note_off[1], note_off[3])
+		end
+		if score_event[1] == 'note' then
+			output(time, {'note_on', time,
+			 score_event[4],score_event[5],score_event[6]})
+			seq = seq + 1
+			heap_push(note_offs, {score_event[2]+score_event[3], seq,
+			 {'note_off', 0, score_event[4],score_event[5],score_event[6]}})
+		else
+			local event = {}
+			for k,v in ipairs(score_event) do event[k] = v end
+			output(time, event)
+		end
+		seq = seq + 1
+		if position < #tracks[itrack] then
+			top[1] = tracks[itrack][position+1][2]
+			top[3] = position + 1
+			heap_replace_top(merge, top)
+		else
+			heap_pop(merge)
 		end
 	end
-	table.sort(output_score[2], function (e1,e2) return e1[2]<e2[2] end) 
-	local output_opus = M.score2opus(output_score)
-	return output_opus[2]
+	while #note_offs > 0 do
+		local note_off = heap_pop(note_offs)
+		output(note_off[1], note_off[3])
+	end
+	clean_up_warnings()
+	return output_track
 end
 
 function M.mix_scores(input_scores)
@@ -1092,6 +1419,19 @@ function M.midi2opus(s)
 	if not s then s = '' end
 	--my_midi=bytearray(midi)
 	if #s < 4 then return {1000,{},} end
+	if prv.midi2opus and type(s) == 'string' then  -- 6.9
+		-- C-MIDI leaves anything it can't decode exactly to _decode
+		local my_opus = prv.midi2opus(s)
+		if my_opus then
+			for itrack = 2, #my_opus do
+				if type(my_opus[itrack]) == 'string' then
+					my_opus[itrack] = _decode(my_opus[itrack])
+				end
+			end
+			clean_up_warnings()
+			return my_opus
+		end
+	end
 	local i = 1
 	local id = string.sub(s, i, i+3); i = i+4
 	if id ~= 'MThd' then
@@ -1136,6 +1476,58 @@ function M.midi2opus(s)
 	return my_opus
 end
 
+function M.scan(s, options)  -- 6.9
+	if not s then s = '' end
+	if not options then options = {} end
+	local on_event = options.on_event or function() end
+	local exclude = dict(options.exclude)
+	if options.include then
+		local include = dict(options.include)
+		for k,v in pairs(all_events) do
+			if not include[k] then exclude[k] = true end
+		end
+	end
+	if #s < 14 then return nil end
+	local i = 1
+	local id = string.sub(s, i, i+3); i = i+4
+	if id ~= 'MThd' then
+		warn("scan: midi starts with "..id.." instead of 'MThd'")
+		clean_up_warnings()
+		return nil
+	end
+	local length = fourbytes2int(string.sub(s,i,i+3)); i = i+10
+	local ticks  = twobytes2int(string.sub(s,i-2,i-1))
+	if length ~= 6 then
+		warn("scan: midi header length was "..tostring(length).." instead of 6")
+		clean_up_warnings()
+		return nil
+	end
+	local track_num = 0
+	local stopped = false
+	while i < #s-8 and not stopped do
+		track_num = track_num + 1
+		local track_type   = string.sub(s, i, i+3); i = i+4
+		if track_type ~= 'MTrk' then
+			warn('scan: Warning: track #'..track_num..' type is '..track_type.." instead of 'MTrk'")
+		end
+		local track_length = fourbytes2int(string.sub(s,i,i+3)); i = i+4
+		if track_length > #s then
+			warn('scan: track #'..track_num..' length '..track_length..' is too large')
+			break
+		end
+		-- only one track is ever held in memory, and no opus is built
+		_decode(string.sub(s, i, i+track_length-1), exclude, nil,
+		  function (event, ticks)
+			if on_event(event, track_num, ticks) == false then
+				stopped = true ; return false
+			end
+		  end, nil, true)
+		i = i+track_length
+	end
+	clean_up_warnings()
+	return ticks, track_num
+end
+
 function M.midi2score(midi)
 	return M.opus2score(M.midi2opus(midi))
 end
@@ -1179,21 +1571,8 @@ end
 function M.opus2midi(opus)
 	if #opus < 2 then opus = {1000, {},} end
 	-- tracks = copy.deepcopy(opus)
-	local ntracks = #opus - 1
-	local ticks = opus[1]
-	local format
-	if ntracks == 1 then format = 0 else format = 1 end
-	local my_midi = "MThd\00\00\00\06" ..
-	 int2twobytes(format) .. int2twobytes(ntracks) .. int2twobytes(ticks)
-	-- struct.pack('>HHH',format,ntracks,ticks)
-	--for track in tracks:
-	for i = 2, #opus do
-		local events = _encode(opus[i])
-		-- should really do an array and then concat...
-		my_midi = my_midi .. 'MTrk' .. int2fourbytes(#events) .. events
-	end
-	clean_up_warnings()
-	return my_midi
+	return _midi(opus[1], #opus - 1,
+	  function (itrack) return _encode(opus[itrack+1]) end)  -- 6.9
 end
 
 function M.opus2score(opus)
@@ -1263,48 +1642,12 @@ function M.score2opus(score)
 	local ticks = score[1]
 	local opus = {ticks,}
 	local itrack = 2; while itrack <= #score do
-		local score_track = score[itrack]
-		local time2events = {}
-		local k,scoreevent; for k,scoreevent in ipairs(score_track) do
-			local continue = false
-			if scoreevent[1] == 'note' then
-				local note_on_event = {'note_on',scoreevent[2],
-				 scoreevent[4],scoreevent[5],scoreevent[6]}
-				local note_off_event = {'note_off',scoreevent[2]+scoreevent[3],
-				 scoreevent[4],scoreevent[5],scoreevent[6]}
-				if time2events[note_on_event[2]] then
-				   table.insert(time2events[note_on_event[2]], note_on_event)
-				else
-				   time2events[note_on_event[2]] = {note_on_event,}
-				end
-				if time2events[note_off_event[2]] then
-				   table.insert(time2events[note_off_event[2]], note_off_event)
-				else
-				   time2events[note_off_event[2]] = {note_off_event,}
-				end
-				continue = true
-			end
-			if not continue then
-				if time2events[scoreevent[2]] then
-					table.insert(time2events[scoreevent[2]], scoreevent)
-				else
-					time2events[scoreevent[2]] = {scoreevent, }
-				end
-			end
-		end
-		local sorted_times = {}  -- list of keys
-		for k,v in pairs(time2events) do
-			sorted_times[#sorted_times+1] = k
-		end
-		table.sort(sorted_times)
-		local sorted_events = {} -- once-flattened list of values sorted by key
-		for k,time in ipairs(sorted_times) do
-			for k2,v in ipairs(time2events[time]) do
-				--sorted_events[#sorted_events+1] = v NOPE, must copy!
-				sorted_events[#sorted_events+1] = {}
-				for k3,v3 in ipairs(v) do
-					table.insert(sorted_events[#sorted_events],v3)
-				end
+		local sorted_events = {}
+		for k,v in ipairs(score_track_events(score[itrack])) do
+			--sorted_events[#sorted_events+1] = v NOPE, must copy!
+			sorted_events[#sorted_events+1] = {}
+			for k3,v3 in ipairs(v) do
+				table.insert(sorted_events[#sorted_events],v3)
 			end
 		end
 		local abs_time = 0
@@ -1337,7 +1680,202 @@ function M.score_type(t)
 end
 
 function M.score2midi(score)
-	return M.opus2midi(M.score2opus(score))
+	-- 6.9 no longer via score2opus, so without copying all the events
+	if score == nil or #score < 2 then score = {1000, {},} end
+	return _midi(score[1], #score - 1, function (itrack)
+		return _encode(score_track_events(score[itrack+1]), true)
+	end)
+end
+
+function M.new_stats(ticks_per_quarter)  -- 6.9
+	-- an accumulator, to which events can be added one at a time
+	return {
+		bank_select_msb = -1,
+		bank_select_lsb = -1,
+		bank_select = {},
+		channels_by_track = {},
+		channels_total    = {},
+		general_midi_mode = {},
+		num_notes_by_channel = {}, -- 5.7
+		patch_changes_by_track = {},
+		patch_changes_total    = {},
+		percussion = {}, -- histogram of channel 9 "pitches"
+		pitches    = {}, -- histogram of pitch-occurrences channels 0-8,10-15
+		pitch_range_sum = 0,   -- u pitch-ranges of each track
+		pitch_range_by_track = {},
+		is_a_score = true,
+		nticks = 0, -- 4.7
+		ticks_per_quarter = ticks_per_quarter,
+		in_track = false,  -- is there a current track ?
+		track = nil,   -- the key of the current track
+		highest_pitch = 0,  -- 4.7  and these four are of the current track
+		lowest_pitch = 128, -- 4.7
+		channels_this_track = {},      -- 4.7
+		patch_changes_this_track = {}, -- 4.7
+	}
+end
+
+local function current_track_stats(acc)  -- 6.9
+	local lowest_pitch = acc.lowest_pitch
+	if lowest_pitch == 128 then
+		lowest_pitch = 0
+	end
+	return sorted_keys(acc.channels_this_track), acc.patch_changes_this_track,
+	  {lowest_pitch, acc.highest_pitch}, acc.highest_pitch - lowest_pitch
+end
+
+local function end_track_stats(acc, to)  -- 6.9
+	-- adds the current track of acc to the finished tracks of to
+	if not acc.in_track then return end
+	local channels, patch_changes, pitch_range, sum = current_track_stats(acc)
+	table.insert(to.channels_by_track, channels)
+	table.insert(to.patch_changes_by_track, patch_changes) -- 4.2
+	table.insert(to.pitch_range_by_track, pitch_range)
+	to.pitch_range_sum = to.pitch_range_sum + sum
+end
+
+function M.stats_add(acc, event, track)  -- 6.9
+	if not acc.in_track or (track ~= nil and track ~= acc.track) then
+		end_track_stats(acc, acc)
+		acc.in_track = true
+		acc.track = track
+		acc.highest_pitch = 0
+		acc.lowest_pitch = 128
+		acc.channels_this_track = {}
+		acc.patch_changes_this_track = {}
+	end
+	if event == nil then return end
+	local num_notes_by_channel = acc.num_notes_by_channel
+	local percussion = acc.percussion
+	local pitches = acc.pitches
+	if event[1] == 'note' then
+		num_notes_by_channel[event[4]] = (num_notes_by_channel[event[4]] or 0) + 1
+		if event[4] == 9 then
+			percussion[event[5]] = (percussion[event[5]] or 0) + 1
+		else
+			pitches[event[5]]    = (pitches[event[5]] or 0) + 1
+			if event[5] > acc.highest_pitch then
+				acc.highest_pitch = event[5]
+			end
+			if event[5] < acc.lowest_pitch then
+				acc.lowest_pitch = event[5]
+			end
+		end
+		acc.channels_this_track[event[4]] = true
+		acc.channels_total[event[4]] = true
+		local finish_time = event[2] + event[3] -- 4.7
+		if finish_time > acc.nticks then
+			acc.nticks = finish_time
+		end
+	elseif event[1] == 'note_on' then
+		acc.is_a_score = false   -- 4.6
+		num_notes_by_channel[event[3]] = (num_notes_by_channel[event[3]] or 0) + 1
+		if event[3] == 9 then
+			percussion[event[4]] = (percussion[event[4]] or 0) + 1
+		else
+			pitches[event[4]]    = (pitches[event[4]] or 0) + 1
+			if event[4] > acc.highest_pitch then
+				acc.highest_pitch = event[4]
+			end
+			if event[4] < acc.lowest_pitch then
+				acc.lowest_pitch = event[4]
+			end
+		end
+		acc.channels_this_track[event[3]] = true
+		acc.channels_total[event[3]] = true
+	elseif event[1] == 'note_off' then
+		local finish_time = event[2] -- 4.7
+		if finish_time > acc.nticks then
+			acc.nticks = finish_time
+		end
+	elseif event[1] == 'patch_change' then
+		acc.patch_changes_this_track[event[3]] = event[4]
+		acc.patch_changes_total[event[4]] = true
+	elseif event[1] == 'control_change' then
+		if event[4] == 0 then  -- bank select MSB
+			acc.bank_select_msb = event[5]
+		elseif event[4] == 32 then  -- bank select LSB
+			acc.bank_select_lsb = event[5]
+		end
+		if acc.bank_select_msb >= 0 and acc.bank_select_lsb >= 0 then
+			table.insert(acc.bank_select,
+			  {acc.bank_select_msb,acc.bank_select_lsb})
+			acc.bank_select_msb = -1
+			acc.bank_select_lsb = -1
+		end
+	elseif event[1] == 'sysex_f0' then
+		if sysex2midimode[event[3]] then
+		table.insert(acc.general_midi_mode,sysex2midimode[event[3]]) -- 5.0
+		end
+	end
+	if acc.is_a_score then
+		if event[2] > acc.nticks then
+			acc.nticks = event[2]
+		end
+	else
+		acc.nticks = acc.nticks + event[2]
+	end
+end
+
+local function append(a, b)  -- 6.9
+	for i,v in ipairs(b) do a[#a+1] = v end
+	return a
+end
+
+function M.stats_merge(acc, other)  -- 6.9
+	-- adds the other accumulator's stats into acc, as though they were
+	-- further tracks; this takes no time proportional to the events
+	end_track_stats(acc, acc)
+	acc.in_track = false
+	for i,k in ipairs({'channels_total','patch_changes_total'}) do
+		for key,v in pairs(other[k]) do acc[k][key] = true end
+	end
+	for i,k in ipairs({'num_notes_by_channel','percussion','pitches'}) do
+		for key,n in pairs(other[k]) do acc[k][key] = (acc[k][key] or 0)+n end
+	end
+	for i,k in ipairs({'bank_select', 'general_midi_mode', 'channels_by_track',
+	  'patch_changes_by_track', 'pitch_range_by_track'}) do
+		append(acc[k], other[k])
+	end
+	acc.pitch_range_sum = acc.pitch_range_sum + other.pitch_range_sum
+	end_track_stats(other, acc)
+	if other.nticks > acc.nticks then acc.nticks = other.nticks end
+	if acc.ticks_per_quarter == nil then
+		acc.ticks_per_quarter = other.ticks_per_quarter
+	end
+	return acc
+end
+
+function M.stats_result(acc)  -- 6.9
+	-- returns the same table as score2stats, and acc can still be added to
+	local channels_by_track = append({}, acc.channels_by_track)
+	local patch_changes_by_track = append({}, acc.patch_changes_by_track)
+	local pitch_range_by_track = append({}, acc.pitch_range_by_track)
+	local pitch_range_sum = acc.pitch_range_sum
+	if acc.in_track then
+		local channels, patch_changes, pitch_range, sum =
+		  current_track_stats(acc)
+		channels_by_track[#channels_by_track+1] = channels
+		patch_changes_by_track[#patch_changes_by_track+1] = copy(patch_changes)
+		pitch_range_by_track[#pitch_range_by_track+1] = pitch_range
+		pitch_range_sum = pitch_range_sum + sum
+	end
+	return {
+		bank_select=append({}, acc.bank_select),
+		channels_by_track=channels_by_track,
+		channels_total=sorted_keys(acc.channels_total),
+		general_midi_mode=append({}, acc.general_midi_mode),
+		ntracks=#channels_by_track,
+		nticks=acc.nticks,
+		num_notes_by_channel=copy(acc.num_notes_by_channel),
+		patch_changes_by_track=patch_changes_by_track,
+		patch_changes_total=sorted_keys(acc.patch_changes_total),
+		percussion=copy(acc.percussion),
+		pitches=copy(acc.pitches),
+		pitch_range_by_track=pitch_range_by_track,
+		pitch_range_sum=pitch_range_sum,
+		ticks_per_quarter=acc.ticks_per_quarter
+	}
 end
 
 function M.score2stats(opus_or_score)
@@ -1356,22 +1894,6 @@ function M.score2stats(opus_or_score)
  pitch_range_by_track (table, by track, of two-member-arrays),
  pitch_range_sum (sum over tracks of the pitch_ranges)
 ]]
-	local bank_select_msb = -1
-	local bank_select_lsb = -1
-	local bank_select = {}
-	local channels_by_track = {}
-	local channels_total    = {}
-	local general_midi_mode = {}
-	local num_notes_by_channel = {} -- 5.7
-	local patches_used_by_track  = {}
-	local patches_used_total     = {}
-	local patch_changes_by_track = {}
-	local patch_changes_total    = {}
-	local percussion = {} -- histogram of channel 9 "pitches"
-	local pitches    = {} -- histogram of pitch-occurrences channels 0-8,10-15
-	local pitch_range_sum = 0   -- u pitch-ranges of each track
-	local pitch_range_by_track = {}
-	local is_a_score = true
 	if opus_or_score == nil then
 		return {bank_select={}, channels_by_track={}, channels_total={},
 		 general_midi_mode={}, ntracks=0, nticks=0,
@@ -1381,107 +1903,24 @@ function M.score2stats(opus_or_score)
 		 ticks_per_quarter=0, pitch_range_sum=0
 		}
 	end
-	local ticks_per_quarter = opus_or_score[1]
-	local nticks = 0 -- 4.7
+	local acc = M.new_stats(opus_or_score[1])  -- 6.9
 	for i = 2,#opus_or_score do  -- ignore first element, which is ticks
-		local highest_pitch = 0  -- 4.7
-		local lowest_pitch = 128 -- 4.7
-		local channels_this_track = {}      -- 4.7
-		local patch_changes_this_track = {} -- 4.7
+		M.stats_add(acc, nil, i)
 		for k,event in ipairs(opus_or_score[i]) do
-			if event[1] == 'note' then
-				num_notes_by_channel[event[4]] = (num_notes_by_channel[event[4]] or 0) + 1
-				if event[4] == 9 then
-					percussion[event[5]] = (percussion[event[5]] or 0) + 1
-				else
-					pitches[event[5]]    = (pitches[event[5]] or 0) + 1
-					if event[5] > highest_pitch then
-						highest_pitch = event[5]
-					end
-					if event[5] < lowest_pitch then
-						lowest_pitch = event[5]
-					end
-				end
-				channels_this_track[event[4]] = true
-				channels_total[event[4]] = true
-				local finish_time = event[2] + event[3] -- 4.7
-				if finish_time > nticks then
-					nticks = finish_time
-				end
-			elseif event[1] == 'note_on' then
-				is_a_score = false   -- 4.6
-				num_notes_by_channel[event[3]] = (num_notes_by_channel[event[3]] or 0) + 1
-				if event[3] == 9 then
-					percussion[event[4]] = (percussion[event[4]] or 0) + 1
-				else
-					pitches[event[4]]    = (pitches[event[4]] or 0) + 1
-					if event[4] > highest_pitch then
-						highest_pitch = event[4]
-					end
-					if event[4] < lowest_pitch then
-						lowest_pitch = event[4]
-					end
-				end
-				channels_this_track[event[3]] = true
-				channels_total[event[3]] = true
-			elseif event[1] == 'note_off' then
-				local finish_time = event[2] -- 4.7
-				if finish_time > nticks then
-					nticks = finish_time
-				end
-			elseif event[1] == 'patch_change' then
-				patch_changes_this_track[event[3]] = event[4]
-				patch_changes_total[event[4]] = true
-			elseif event[1] == 'control_change' then
-				if event[4] == 0 then  -- bank select MSB
-					bank_select_msb = event[5]
-				elseif event[4] == 32 then  -- bank select LSB
-					bank_select_lsb = event[5]
-				end
-				if bank_select_msb >= 0 and bank_select_lsb >= 0 then
-					table.insert(bank_select,{bank_select_msb,bank_select_lsb})
-					bank_select_msb = -1
-					bank_select_lsb = -1
-				end
-			elseif event[1] == 'sysex_f0' then
-				if sysex2midimode[event[3]] then
-				table.insert(general_midi_mode,sysex2midimode[event[3]]) -- 5.0
-				end
-			end
-			if is_a_score then
-				if event[2] > nticks then
-					nticks = event[2]
-				end
-			else
-				nticks = nticks + event[2]
-			end
+			M.stats_add(acc, event)
 		end
-		if lowest_pitch == 128 then
-			lowest_pitch = 0
-		end
-		table.insert(channels_by_track, sorted_keys(channels_this_track))
-		table.insert(patch_changes_by_track, patch_changes_this_track) -- 4.2
-		table.insert(pitch_range_by_track, {lowest_pitch,highest_pitch})
-		pitch_range_sum = pitch_range_sum + highest_pitch - lowest_pitch
-		i = i + 1
 	end
+	return M.stats_result(acc)
+end
 
-	return {
-		bank_select=bank_select,
-		channels_by_track=channels_by_track,
-		channels_total=sorted_keys(channels_total),
-		general_midi_mode=general_midi_mode,
-		ntracks=#opus_or_score-1,
-		nticks=nticks,
-		num_notes_by_channel=num_notes_by_channel,
-		patch_changes_by_track=patch_changes_by_track,
-		patch_changes_total=sorted_keys(patch_changes_total),
-		percussion=percussion,
-		pitches=pitches,
-		pitch_range_by_track=pitch_range_by_track,
-		pitch_range_sum=pitch_range_sum,
-		ticks_per_quarter=ticks_per_quarter
-	}
+function M.score2index(score)  -- 6.9
+	local score_index = { score_type = M.score_type(score) }
+	if score_index.score_type ~= 'opus' then
+		for i = 2,#score do
+			score_index[i] = index_track(score[i])
+		end
+	end
+	return { score = score, score_index = score_index }
 end
 
 function M.segment(...)
@@ -1493,6 +1932,11 @@ function M.segment(...)
 		endt = args[1]['end_time']    -- 4.1
 		tracks = args[1]['tracks']
 	end
+	local index = nil
+	if type(score) == 'table' and score.score_index then  -- 6.9
+		index = score.score_index
+		score = score.score
+	end
 	if not score == nil or type(score) ~= 'table' or #score < 2 then
 		return {1000, {},}
 	end
@@ -1500,7 +1944,10 @@ function M.segment(...)
 	if not endt  then endt  = 1000000000 end
 	if not tracks then tracks = {0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15} end
 	local new_score = {score[1],}
-	local my_type = M.score_type(score)
+	local my_type
+	if index then my_type = index.score_type
+	else my_type = M.score_type(score)
+	end
 	if my_type == '' then
 		return new_score
 	end
@@ -1522,7 +1969,11 @@ function M.segment(...)
 			local set_tempo_num = 500000 -- recentest tempochange 6.3
 			local set_tempo_time = 0
 			local earliest_note_time = endt
-			for k,event in ipairs(score[i]) do
+			if index then  -- 6.9
+				new_track, set_tempo_num, channel2patch_num,
+				  channel2cc_num, channel2cc_val =
+				  indexed_segment(index[i], score[i], start, endt)
+			else for k,event in ipairs(score[i]) do
 				if event[1] == 'control_change' then  -- 6.5
 					local cc_time = channel2cc_time[event[3]] or 0
 					if event[2]<=start and event[2]>=cc_time then
@@ -1548,7 +1999,7 @@ function M.segment(...)
 						earliest_note_time = event[2]
 					end
 				end
-			end
+			end end
 			if #new_track > 0 then
 				new_track[#new_track+1] = ({'set_tempo', start, set_tempo_num})
 				for k,c in ipairs(sorted_keys(channel2patch_num)) do -- 4.3
@@ -1783,7 +2234,9 @@ MIDI.lua - Reading, writing and manipulating MIDI data
 
 This module offers functions:  concatenate_scores(), grep(),
 merge_scores(), mix_scores(), midi2opus(), midi2score(), opus2midi(),
-opus2score(), play_score(), score2midi(), score2opus(), score2stats(),
+new_stats(), opus2score(), play_score(), scan(), score2index(),
+score2midi(), score2opus(), score2stats(), stats_add(), stats_merge(),
+stats_result(),
 score_type(), segment(), timeshift() and to_millisecs(),
 where "midi" means the MIDI-file bytes (as can be put in a .mid file,
 or piped into aplaymidi), and "opus" and "score" are list-structures
@@ -1844,6 +2297,9 @@ and the same tempo.
 Mixing score-tracks is trivial (just insert all the events into one array).
 Mixing opus-tracks is only slightly harder,
 but it's common enough that a dedicated function is useful.
+The tracks are merged, not sorted, so that events at the same time
+remain in the order of the tracks, and within each track in their
+original order.
 
 =item I<mix_scores> (array_of_scores)
 
@@ -1865,6 +2321,12 @@ then opus2score()
 Translates MIDI into an "opus".  For a description of the
 "opus" format, see opus2midi()
 
+If the optional C module C-MIDI is installed, midi2opus uses it to
+decode the tracks, which is many times faster.  The opus is exactly
+the same either way; any track which C-MIDI finds unusual
+(for example, if it would provoke a warning)
+is handed back to the pure-Lua decoder.
+
 =item I<midi2score> (midi_in_string_form)
 
 Translates MIDI into a "score", using midi2opus() then opus2score()
@@ -1909,10 +2371,45 @@ Converts the "score" to midi, and feeds it into 'aplaymidi -'.
 If Lua's I<posix> module is installed, the aplaymidi process will
 be run in the background.
 
+=item I<scan> (midi_in_string_form, {include={'note_on'}, on_event=f})
+
+Decodes MIDI like midi2opus(), but without building the opus.
+The tracks are decoded one at a time, and each event
+(in the same form as in an "opus") is passed to the function
+I<on_event>(event, track_num, ticks) where I<ticks> is the absolute
+time of the event since the start of its track.
+The optional arrays I<include> or I<exclude> list the
+event-names which are wanted, or not wanted;
+unwanted MIDI events are skipped during decoding
+without ever becoming tables.
+The I<end_track> events are passed on as they are.
+If I<on_event> returns I<false> the scan stops.
+For example, to count the notes:
+
+ local n = 0
+ MIDI.scan(midi, {include={'note_on'}, on_event = function(e)
+    if e[5] > 0 then n = n + 1 end
+ end })
+
+I<scan> returns the I<ticks> from the MIDI header,
+and the number of tracks scanned.
+
 =item I<score_type> (opus_or_score)
 
 Returns a string, either 'opus' or 'score' or ''
 
+=item I<score2index> (a_score)
+
+Returns an index of the score, which can be given to segment()
+in place of the score itself.  In each track, the index holds the events
+in time-order, and every 64 events a checkpoint of the set_tempo,
+patch_change and control_change state which segment() restores,
+so that segment() can then find its window in a time proportional to
+the log of the length of the score plus the size of the window,
+instead of scanning every event.  This is worthwhile if many segments
+are to be cut from the same long score.  The score must not be modified
+while its index is in use.
+
 =item I<score2midi> (a_score)
 
 Translates a "score" into MIDI, using score2opus() then opus2midi()
@@ -1962,6 +2459,38 @@ Returns a table of some basic stats about the score, like:
  pitch_range_by_track (table, by track, of two-member-arrays),
  pitch_range_sum (sum over tracks of the pitch_ranges)
 
+=item I<new_stats> (ticks_per_quarter)
+
+=item I<stats_add> (accumulator, event, track)
+
+=item I<stats_merge> (accumulator, other_accumulator)
+
+=item I<stats_result> (accumulator)
+
+These calculate the same stats as score2stats(), but one event at a time,
+so that they can be fed, for example, by scan() without any score
+or opus being built.
+I<new_stats> returns an empty accumulator.
+I<stats_add> adds one event, from a score or an opus;
+I<track> is any value identifying the track, such as the I<track_num>
+which scan() supplies, and when it changes a new track is begun.
+I<stats_merge> adds I<other_accumulator> into I<accumulator>
+as further tracks, in a time which does not depend on the number of events,
+so that a large collection of MIDI files can be
+processed in parallel shards and the results merged.
+The merged I<nticks> is the larger of the two, and a bank_select
+split between two accumulators is not counted.
+I<stats_result> returns a table like that of score2stats(),
+and may be called at any time.  For example:
+
+ local acc = MIDI.new_stats()
+ for i,midi in ipairs(midis) do
+    MIDI.scan(midi, {on_event = function (event, track_num)
+       MIDI.stats_add(acc, event, i..':'..track_num)
+    end})
+ end
+ local stats = MIDI.stats_result(acc)
+
 =item I<segment> (score, start_time, end_time, tracks)
 
 =item I<segment> {score, start_time=100, end_time=2000, tracks={3,4,5}}
@@ -1970,6 +2499,7 @@ Returns a "score" which is a segment of the one supplied
 as the argument, beginning at "start_time" ticks and ending
 at "end_time" ticks (or at the end if "end_time" is not supplied).
 If the array "tracks" is specified, only those tracks will be returned.
+The "score" may also be an index as returned by score2index().
 
 =item I<timeshift> (score, shift, start_time, from_time, tracks)
 
@@ -2124,6 +2654,12 @@ The test script used during development is
 http://www.pjb.com.au/comp/lua/test_mi.lua
 which requires the DataDumper module.
 
+The optional C module is in
+http://www.pjb.com.au/comp/lua/C-MIDI.c
+and can be compiled, for example, with
+B<cc -O2 -shared -fPIC -I/usr/include/lua5.3 C-MIDI.c -o C-MIDI.so>
+and then installed in your LUA_CPATH.
+
 You should be able to install the luaposix module with:
 B<sudo luarocks install luaposix>
 
@@ -10,6 +10,9 @@ local M = {} -- public interface
 M.Version = 'VERSION'  -- function deepcopy is now local
 M.VersionDate = 'DATESTAMP'
 -- 20150425 1.08 function deepcopy is now local; works with lua5.3
+-- 20261017 1.10 new_stepper and new_ensemble, with optional C-RungeKutta
+local prv = {} -- private C functions, if C-RungeKutta is installed
+pcall(function() require('C-RungeKutta')({}, prv, M) end)
 
 -- Example usage:
 -- local RK = require 'RungeKutta'
@@ -262,6 +265,157 @@ function M.rk4_auto_midpoint()
 	return t+halfdt, y2
 end
 
+------------------------------ steppers ------------------------------
+
+local LuaStepper = {}  -- used if C-RungeKutta is not installed
+LuaStepper.__index = LuaStepper
+function LuaStepper:get(a)
+	if not a then a = {} end
+	for i = 1,#self.y do a[i] = self.y[i] end
+	return a
+end
+function LuaStepper:set(a)
+	if #a ~= #self.y then error('RungeKutta stepper:set wrong length', 2) end
+	for i = 1,#a do self.y[i] = a[i] end
+	return self
+end
+function LuaStepper:step(t, dt, nsteps)
+	local algorithm = M[self.method]
+	for istep = 1,(nsteps or 1) do t, self.y = algorithm(self.y,self.dydt,t,dt) end
+	return t
+end
+function LuaStepper:auto(t, dt, epsilon, nsteps)
+	for istep = 1,(nsteps or 1) do
+		local t0 = t
+		t, dt, self.y = M.rk4_auto(self.y, self.dydt, t, dt, epsilon)
+		local dummy; dummy, self.y_midpoint = M.rk4_auto_midpoint()
+		self.t_midpoint = t0 + 0.5*dt
+	end
+	return t, dt
+end
+function LuaStepper:midpoint(a)
+	if not a then a = {} end
+	for i = 1,#self.y_midpoint do a[i] = self.y_midpoint[i] end
+	return self.t_midpoint, a
+end
+
+function M.new_stepper(dydt, y, method)
+	if type(dydt) ~= 'function' then
+		warn("RungeKutta.new_stepper: 1st arg must be a function\n")
+		return false
+	end
+	if type(y) ~= 'table' or #y < 1 then
+		warn("RungeKutta.new_stepper: 2nd arg must be an array\n")
+		return false
+	end
+	method = method or 'rk4'
+	if method ~= 'rk2' and method ~= 'rk4' and
+	  method ~= 'rk4_classical' and method ~= 'rk4_ralston' then
+		warn("RungeKutta.new_stepper: unknown method "..tostring(method).."\n")
+		return false
+	end
+	if prv.new_stepper then return prv.new_stepper(dydt, y, method) end
+	local stepper = { method=method, y={}, t_midpoint=0, y_midpoint={} }
+	for i = 1,#y do stepper.y[i] = y[i] end
+	stepper.dydt = function(t, y)  -- dydt may fill in f, or return a table
+		local f = {}
+		local returned = dydt(t, y, f)
+		if type(returned) == 'table' then return returned end
+		return f
+	end
+	return setmetatable(stepper, LuaStepper)
+end
+
+local LuaEnsemble = {}  -- used if C-RungeKutta is not installed
+LuaEnsemble.__index = LuaEnsemble
+function LuaEnsemble:get(k, a)
+	if not k then
+		local all = {}
+		for k = 1,self.nsystems do all[k] = self:get(k) end
+		return all
+	end
+	if not a then a = {} end
+	local offset = (k-1) * self.dim
+	for i = 1,self.dim do a[i] = self.y[offset+i] end
+	return a
+end
+function LuaEnsemble:set(k, a)
+	if #a ~= self.dim then error('RungeKutta ensemble:set wrong length', 2) end
+	local offset = (k-1) * self.dim
+	for i = 1,self.dim do self.y[offset+i] = a[i] end
+	return self
+end
+function LuaEnsemble:step(t, dt, nsteps)
+	local algorithm = M[self.method]
+	for istep = 1,(nsteps or 1) do t, self.y = algorithm(self.y,self.dydt,t,dt) end
+	return t
+end
+function LuaEnsemble:size()
+	return self.nsystems, self.dim
+end
+
+function M.new_ensemble(dydt, ys, method, threads)
+	local code, is_source
+	if type(dydt) == 'string' then
+		code = dydt ; is_source = true
+		local chunk = (_VERSION == 'Lua 5.1' and loadstring or load)(dydt, '=dydt')
+		if chunk then dydt = chunk() end
+		if type(dydt) ~= 'function' then
+			warn("RungeKutta.new_ensemble: 1st arg must return a function\n")
+			return false
+		end
+	elseif type(dydt) ~= 'function' then
+		warn("RungeKutta.new_ensemble: 1st arg must be a function\n")
+		return false
+	end
+	if type(ys) ~= 'table' or type(ys[1]) ~= 'table' or #ys[1] < 1 then
+		warn("RungeKutta.new_ensemble: 2nd arg must be an array of arrays\n")
+		return false
+	end
+	local dim = #ys[1]
+	for k = 2,#ys do
+		if type(ys[k]) ~= 'table' or #ys[k] ~= dim then
+			warn("RungeKutta.new_ensemble: system "..k.." is not of size "..dim.."\n")
+			return false
+		end
+	end
+	method = method or 'rk4'
+	if method ~= 'rk2' and method ~= 'rk4' and
+	  method ~= 'rk4_classical' and method ~= 'rk4_ralston' then
+		warn("RungeKutta.new_ensemble: unknown method "..tostring(method).."\n")
+		return false
+	end
+	threads = threads or 1
+	if prv.new_ensemble then
+		if threads ~= 1 and not code then
+			-- each thread needs its own copy of dydt, without upvalues
+			local i = 1
+			while debug.getupvalue(dydt, i) do
+				if debug.getupvalue(dydt, i) ~= '_ENV' then
+					warn("RungeKutta.new_ensemble: dydt has upvalues, "
+					  .. "so it can only run in one thread\n")
+					threads = 1 ; break
+				end
+				i = i + 1
+			end
+			if threads ~= 1 then code = string.dump(dydt) end
+		end
+		return prv.new_ensemble(dydt, ys, method, threads, code, is_source)
+	end
+	local nsystems = #ys
+	local ensemble = { method=method, nsystems=nsystems, dim=dim, y={} }
+	for k = 1,nsystems do
+		for i = 1,dim do ensemble.y[(k-1)*dim+i] = ys[k][i] end
+	end
+	ensemble.dydt = function(t, y)
+		local f = {}
+		local returned = dydt(t, y, f, nsystems, dim, 1)
+		if type(returned) == 'table' then return returned end
+		return f
+	end
+	return setmetatable(ensemble, LuaEnsemble)
+end
+
 ------------------------ EXPORT_OK routines ----------------------
 
 function M.rk4_ralston (yn, dydt, t, dt)
@@ -520,6 +674,74 @@ of their chronological order. Sorry about this.  For example,
 I<rk4_auto_midpoint> returns t, y where these were the
 values at the midpoint of the previous call to I<rk4_auto>.
 
+=item I<new_stepper>( dydt, y, method )
+
+For big systems over many timesteps, I<new_stepper> returns a stepper,
+which holds the array I<y> of values, and does the timesteps itself,
+re-using all its arrays, so that it creates no tables at all.
+The I<method> is 'rk2', 'rk4' (the default), 'rk4_classical'
+or 'rk4_ralston'.  I<y> must be an array (1...n), not a dictionary.
+The function I<dydt> is called as I<dydt(t, y, f)>, where the
+array I<f> is to be filled in with the derivatives;
+the stepper re-uses the same two tables I<y> and I<f> on every call.
+A I<dydt> which returns a new table, as for I<rk4>, also works.
+
+ local stepper = RK.new_stepper(dydt, y)
+ t = stepper:step(t, dt, 1000)  -- do 1000 timesteps of dt
+ t, dt = stepper:auto(t, dt, epsilon, 100) -- or 100 steps like rk4_auto
+ t, dt = stepper:auto(t, dt, errors)       -- or just one
+ t_midpoint, y_midpoint = stepper:midpoint() -- like rk4_auto_midpoint
+ y = stepper:get()     -- returns the current values as a new array
+ stepper:get(y)        -- or copies them into the array y
+ stepper:set(y)        -- sets the current values
+
+If the optional C module I<C-RungeKutta> is installed,
+the stepper keeps its values in contiguous arrays in C,
+and does all the arithmetic of the timesteps in C,
+with the same formulae in the same order as I<rk2>, I<rk4>,
+I<rk4_classical>, I<rk4_ralston> and I<rk4_auto>.
+Only I<dydt> remains in Lua.
+
+=item I<new_ensemble>( dydt, ys, method, threads )
+
+For parameter sweeps, where the same system of I<dim> equations
+is to be integrated from many different initial conditions,
+I<new_ensemble> returns an ensemble of I<nsystems> systems,
+which are integrated in lock-step by fixed timesteps.
+I<ys> is an array of the I<nsystems> initial arrays, all of length I<dim>.
+The I<method> is 'rk2', 'rk4' (the default), 'rk4_classical'
+or 'rk4_ralston'.
+
+I<dydt> is called just once per stage for all the systems, as
+I<dydt(t, y, f, nsystems, dim, first)>, where I<y> and I<f> are
+arrays of I<nsystems*dim> values, system after system,
+so that I<y[(k-1)*dim + i]> is the I<i>th value of the I<k>th system,
+which is system number I<first+k-1> of the ensemble.
+It should fill in I<f>, but may instead return a new array.
+Any parameters which vary from system to system are most easily
+carried as extra values in I<y>, whose derivatives are zero.
+
+ local ensemble = RK.new_ensemble(dydt, ys, 'rk4_classical')
+ t = ensemble:step(t, dt, 1000)  -- do 1000 timesteps of dt
+ y5   = ensemble:get(5)    -- returns the values of system 5
+ ys   = ensemble:get()     -- returns an array of all the systems
+ ensemble:set(5, y5)       -- sets the values of system 5
+ nsystems, dim = ensemble:size()
+
+If the optional C module I<C-RungeKutta> is installed,
+all the systems are held in one contiguous array,
+and all the arithmetic is done in C.
+Then, if I<threads> is greater than 1 (or 0, meaning one per processor),
+the systems are divided into that many slices, each of which is
+integrated in its own thread, with its own I<lua_State>
+into which I<dydt> has been loaded.
+So, I<dydt> must not use any upvalues (local variables from outside it),
+nor any globals, except those of the standard libraries;
+if it has upvalues, a warning is given and only one thread is used.
+Instead of a function, I<dydt> may be given as Lua source,
+which returns the function; this is run once in each I<lua_State>,
+and so can set up any tables that I<dydt> needs.
+
 =back
 
 =head1 CALLER-SUPPLIED FUNCTIONS
@@ -612,6 +834,13 @@ Or, the source is available in
 http://cpansearch.perl.org/src/PJB/Math-RungeKutta-1.08/lua/
 for you to install by hand in your LUA_PATH
 
+The optional C module I<C-RungeKutta.c> can be compiled with
+
+ cc -O3 -shared -fPIC -pthread -I/usr/include/lua5.3 C-RungeKutta.c \
+   -o C-RungeKutta.so
+
+and installed as I<C-RungeKutta.so> in your LUA_CPATH
+
 =head1 AUTHOR
 
 Peter J Billam, http://www.pjb.com.au/comp/contact.html
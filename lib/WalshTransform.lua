@@ -8,6 +8,8 @@
 local M = {} -- public interface
 M.Version = 'VERSION'
 M.VersionDate = 'DATESTAMP'
+local prv = {} -- private C functions, if C-WalshTransform is installed
+pcall(function() require('C-WalshTransform')({}, prv, M) end)
 
 --------------------- infrastructure ----------------------
 local function warn(str)
@@ -42,8 +44,8 @@ local function jw2jh(n)
 end
 -------------------------------------------------------
 
-function M.fht(a)
-	local i; local mr = {}; for i=1,#a do mr[i] = a[i] end
+local function lua_fht(mr)  -- in place
+	local i
 	local k = 1
 	local n = #mr
 	local l = n
@@ -69,8 +71,17 @@ function M.fht(a)
 	end
 end
 
-function M.fhtinv(a)
+function M.fht(a)
+	if prv.transform then  -- C-WalshTransform, unless a is unusual
+		local mr = prv.transform(a, 'fht')
+		if mr then return mr end
+	end
 	local i; local mr = {}; for i=1,#a do mr[i] = a[i] end
+	return lua_fht(mr)
+end
+
+local function lua_fhtinv(mr)  -- in place
+	local i
 	local k = 1;
 	local n = #mr;
 	local l = n;
@@ -96,9 +107,18 @@ function M.fhtinv(a)
 	end
 end
 
-function M.fwt(a) -- might be easier to Hadamard transform and shuffle results
+function M.fhtinv(a)
+	if prv.transform then  -- C-WalshTransform, unless a is unusual
+		local mr = prv.transform(a, 'fhtinv')
+		if mr then return mr end
+	end
 	local i; local mr = {}; for i=1,#a do mr[i] = a[i] end
-	local n = #mr; local nr = {}
+	return lua_fhtinv(mr)
+end
+
+local function lua_fwt(mr, nr)  -- in place; nr is scratch
+	local i
+	local n = #mr
 	local k; local l; local nl; local nk; local kp1;
 
 	local m = 0  -- will be log2(n)
@@ -146,9 +166,18 @@ function M.fwt(a) -- might be easier to Hadamard transform and shuffle results
 	return mr
 end
 
-function M.fwtinv(a)
+function M.fwt(a) -- might be easier to Hadamard transform and shuffle results
+	if prv.transform then  -- C-WalshTransform, unless a is unusual
+		local mr = prv.transform(a, 'fwt')
+		if mr then return mr end
+	end
 	local i; local mr = {}; for i=1,#a do mr[i] = a[i] end
-	local n = #mr; local nr = {}
+	return lua_fwt(mr, {})
+end
+
+local function lua_fwtinv(mr, nr)  -- in place; nr is scratch
+	local i
+	local n = #mr
 	local k; local l; local nl; local nk; local kp1;
 	local m = 0;  -- log2($n)
 	local tmp = 1; while tmp < n do
@@ -195,7 +224,16 @@ function M.fwtinv(a)
 	return mr
 end
 
-function M.logical_convolution(a, b)
+function M.fwtinv(a)
+	if prv.transform then  -- C-WalshTransform, unless a is unusual
+		local mr = prv.transform(a, 'fwtinv')
+		if mr then return mr end
+	end
+	local i; local mr = {}; for i=1,#a do mr[i] = a[i] end
+	return lua_fwtinv(mr, {})
+end
+
+function M.logical_convolution(a, b, workspace)
 	if type(a) ~= 'table' then
 		warn("WalshTransform.logical_convolution 1st arg must be a table\n")
 		return nil
@@ -207,16 +245,35 @@ function M.logical_convolution(a, b)
 		warn("WalshTransform.logical_convolution args must be the same size\n")
 		return nil
 	end
+	if prv.convolution then  -- C-WalshTransform, unless a or b is unusual
+		local mr = prv.convolution(a, b, workspace)
+		if mr then return mr end
+	end
+	if type(workspace) == 'table' then  -- a buffer from new_buffer in Lua
+		if workspace.n ~= #a or workspace.count < 2 then error(
+		  'WalshTransform.logical_convolution workspace must be new_buffer(#a,2)', 2)
+		end
+		local x = workspace[1];  local y = workspace[2];  local i
+		lua_fwt(workspace:set(1, a)[1], workspace.nr)
+		if b == a then
+			for i = 1,#x do x[i] = x[i]*x[i] end
+		else
+			lua_fwt(workspace:set(2, b)[2], workspace.nr)
+			for i = 1,#x do x[i] = x[i]*y[i] end
+		end
+		lua_fwtinv(x, workspace.nr)
+		return workspace:get(1)
+	end
 	local Fa = M.fwt(a);  local Fb = M.fwt(b);
 	return M.fwtinv(M.product(Fa, Fb));
 end
 
-function M.logical_autocorrelation(mr)
-	return M.logical_convolution(mr,mr)
+function M.logical_autocorrelation(mr, workspace)
+	return M.logical_convolution(mr, mr, workspace)
 end
 
-function M.power_spectrum(mr)
-	return M.fwt(M.logical_convolution(mr, mr) )
+function M.power_spectrum(mr, workspace)
+	return M.fwt(M.logical_convolution(mr, mr, workspace) )
 end
 
 function M.walsh2hadamard(mr)
@@ -239,6 +296,57 @@ function M.hadamard2walsh(mr)
 	return w;
 end
 
+------------------------ buffers of vectors ---------------------------
+
+local LuaBuffer = {}  -- used if C-WalshTransform is not installed
+LuaBuffer.__index = LuaBuffer
+function LuaBuffer:set(i, a)
+	if #a ~= self.n then error('WalshTransform buffer:set wrong length', 2) end
+	local v = self[i]
+	for j = 1,self.n do v[j] = a[j] end
+	return self
+end
+function LuaBuffer:get(i, a)
+	if not a then a = {} end
+	local v = self[i]
+	for j = 1,self.n do a[j] = v[j] end
+	return a
+end
+local function lua_batch(transform)
+	return function (self, i)
+		if i then self[i] = transform(self[i], self.nr); return self end
+		for i = 1,self.count do self[i] = transform(self[i], self.nr) end
+		return self
+	end
+end
+LuaBuffer.fht    = lua_batch(lua_fht)
+LuaBuffer.fhtinv = lua_batch(lua_fhtinv)
+LuaBuffer.fwt    = lua_batch(lua_fwt)
+LuaBuffer.fwtinv = lua_batch(lua_fwtinv)
+
+function M.new_buffer(n, count)
+	if not count then count = 1 end
+	if type(n) ~= 'number' or n < 2 or n ~= math.floor(n) then
+		return nil, "WalshTransform.new_buffer: n="..tostring(n)
+		  .." but must be power of 2"
+	end
+	local tmp = n; while tmp % 2 == 0 do tmp = tmp / 2 end
+	if tmp ~= 1 then
+		return nil, "WalshTransform.new_buffer: n="..tostring(n)
+		  .." but must be power of 2"
+	end
+	if type(count) ~= 'number' or count < 1 then
+		return nil, "WalshTransform.new_buffer: count must be positive"
+	end
+	if prv.new_buffer then return prv.new_buffer(n, count) end
+	local buffer = {n=n, count=count, nr={}}
+	for i = 1,count do
+		local v = {}; for j = 1,n do v[j] = 0.0 end
+		buffer[i] = v
+	end
+	return setmetatable(buffer, LuaBuffer)
+end
+
 ------------------------ EXPORT_OK stuff ---------------------------
 
 function M.biggest(k, a)
@@ -439,6 +547,34 @@ The argument I<F> is the list of values to be inverse-transformed.
 The number of values must be a power of 2.
 I<fwtinv> returns a list I<f> of the inverse Walsh transform.
 
+If the optional C module I<C-WalshTransform> is installed,
+I<fht>, I<fhtinv>, I<fwt> and I<fwtinv> do their arithmetic in C,
+which is about ten times faster, with identical results.
+
+=item I<new_buffer>(n, count)
+
+To transform many vectors of the same length without creating
+any Lua tables, I<new_buffer> returns a buffer of I<count> vectors
+(default 1) each of I<n> values, all zero, where I<n> must be a power of 2.
+If C-WalshTransform is installed these are contiguous doubles in C.
+If I<n> or I<count> is invalid, I<new_buffer> returns I<nil>
+and an error message.
+The buffer has the methods:
+
+ buffer:set(i, f)   -- copies the list f into the i'th vector
+ f = buffer:get(i)  -- returns the i'th vector as a new list
+ buffer:get(i, f)   -- or copies it into the existing list f
+ buffer:fht()       -- transforms all the vectors in place
+ buffer:fwt(i)      -- or just the i'th vector
+ buffer:fhtinv() buffer:fwtinv()
+
+I<set> and the transforms return the buffer, so they can be chained:
+
+ local buffer = WT.new_buffer(4096, 100)
+ for i = 1,100 do buffer:set(i, blocks[i]) end
+ buffer:fwt()
+ local FW = buffer:get(1)
+
 =item I<walsh2hadamard>(F)
 
 The argument I<F> is a Walsh transform;
@@ -449,21 +585,30 @@ I<walsh2hadamard> returns a list of the corresponding Hadamard transform.
 The argument I<F> is a Hadamard transform;
 I<hadamard2walsh> returns a list of the corresponding Walsh transform.
 
-=item I<logical_convolution(x, y)>
+=item I<logical_convolution(x, y, workspace)>
 
 The arguments are references to two arrays of values I<x> and I<y>
 which must both be of the same size which must be a power of 2.
 I<logical_convolution> returns a list of the logical (or dyadic) convolution
 of the two sets of values.  See the MATHEMATICS section ...
 
-=item I<logical_autocorrelation(x)>
+The optional I<workspace> is a buffer from I<new_buffer(#x, 2)>.
+The transforms and the product are then done in place in the workspace,
+without any intermediate lists, and the result is also left in its
+first vector; so when correlating many long sequences the same
+workspace can be re-used for each call.
+If C-WalshTransform is installed this is done in C anyway,
+with or without the I<workspace>.
+
+=item I<logical_autocorrelation(x, workspace)>
 
 The argument is a list of values I<x>;
 the number of values must be a power of 2.
 I<logical_autocorrelation> returns a list of the logical (or dyadic)
 autocorrelation of the set of values.  See the MATHEMATICS section ...
+The optional I<workspace> is as for I<logical_convolution>.
 
-=item I<power_spectrum(x)>
+=item I<power_spectrum(x, workspace)>
 
 The argument is a list of values I<x>;
 the number of values must be a power of 2.
@@ -608,6 +753,13 @@ Or, the source is available in
 http://cpansearch.perl.org/src/PJB/Math-WalshTransform-1.18/lua/
 for you to install by hand in your LUA_PATH
 
+The optional C module is in
+http://www.pjb.com.au/comp/lua/C-WalshTransform.c
+and can be compiled, for example, with
+B<cc -O3 -shared -fPIC -I/usr/include/lua5.3 C-WalshTransform.c -o C-WalshTransform.so>
+and then installed in your LUA_CPATH.
+The B<-O3> lets the compiler vectorise the butterflies.
+
 =head1 AUTHOR
 
 Peter J Billam, www.pjb.com.au/comp/contact.html
@@ -8,8 +8,10 @@
 -- given in Rorabaugh's "Digital Filter Designer's Handbook", pp.287-291.
 
 local M = {} -- public interface
-M.Version = '2.0'
-M.VersionDate = '02aug2017'
+M.Version = '2.4'
+M.VersionDate = '17oct2026'
+local prv = {} -- private C functions, if C-digitalfilter is installed
+pcall(function() require('C-digitalfilter')({}, prv, M) end)  -- 2.4
 
 ------------------------------ private ------------------------------
 local function warn(...)
@@ -305,6 +307,54 @@ function M.new_filter_section (A012B012, option)
 	end
 end
 
+local function lua_filter_buffer (filter_funcs, samples, format)
+	-- 2.4 the same as C-digitalfilter's filter_buffer, but slower;
+	-- filter_funcs is one per-sample closure for each channel
+	local nchannels = #filter_funcs
+	local function not_whole_frames(n)
+		if n % nchannels == 0 then return false end
+		return string.format(
+		 "filter_buffer: %d samples are not a whole number of %d-channel frames",
+		 n, nchannels)
+	end
+	if type(samples) == 'table' then
+		local msg = not_whole_frames(#samples)
+		if msg then return nil, msg end
+		local filtered = {}
+		for i = 1,#samples do
+			filtered[i] = filter_funcs[(i-1)%nchannels + 1](samples[i])
+		end
+		return filtered
+	elseif type(samples) ~= 'string' then
+		return nil, "filter_buffer: samples must be a string or an array"
+	end
+	if not format then format = 's16' end
+	local fmt
+	if     format == 'float' then fmt = 'f'
+	elseif format == 's16'   then fmt = 'h'
+	else return nil,
+	  "filter_buffer: format must be 'float' or 's16', not '"..format.."'"
+	end
+	if not string.unpack then
+		return nil, "filter_buffer: strings need C-digitalfilter or Lua5.3"
+	end
+	local size = string.packsize(fmt)
+	local msg = not_whole_frames(math.floor(#samples/size))
+	if msg then return nil, msg end
+	local filtered = {}
+	for i = 1, #samples-size+1, size do
+		local ichannel = math.floor((i-1)/size) % nchannels + 1
+		local v = filter_funcs[ichannel](string.unpack(fmt, samples, i))
+		if fmt == 'h' then
+			v = math.floor(v + 0.5)
+			if v > 32767 then v = 32767 elseif v < -32768 then v = -32768
+			elseif v ~= v then v = 0 end
+		end
+		filtered[#filtered+1] = string.pack(fmt, v)
+	end
+	return table.concat(filtered)
+end
+
 ------------------------------ public ------------------------------
 
 function M.new_digitalfilter (option)
@@ -322,22 +372,75 @@ function M.new_digitalfilter (option)
 	if type(option['shape']) ~= 'string' then   --Constantinides p. 56
 		return nil, "new_digitalfilter: option['shape'] must be a string"
 	end
+	local nchannels = option['channels'] or 1   -- option may be re-used
+	if type(nchannels) ~= 'number' or nchannels < 1
+	  or nchannels ~= math.floor(nchannels) then
+		return nil, "new_digitalfilter: option['channels'] must be a positive integer"
+	end
+	local inital_gain = 1.0
+	if option['filtertype'] == 'chebyschev' and 0 == option['order']%2 then
+		-- 2.0 chebyschev of even order starts one ripple BENEATH unity gain!
+		local ripple = option['ripple'] or 1
+		inital_gain = 1 / 10 ^ (0.05*ripple)
+	end
+	local function option2A012B012s(option)
+		local A012B012s = {}
+		-- freq_sections(option)  returns { {a012b012}, {a012b012} ... }
+		for i, a012b012 in ipairs(M.freq_sections(option)) do
+			A012B012s[i] = freq_a012b012_to_zm1_A012B012(a012b012,option)
+		end
+		return A012B012s
+	end
+	if prv.new_cascade then   -- 2.4 C-digitalfilter runs the sections
+		local cascade = prv.new_cascade(option2A012B012s(option),
+		  inital_gain, nchannels)
+		local filter_sample = prv.filter_sample
+		local filter_buffer = prv.filter_buffer
+		local filter_func = function (...)  -- one signal for each channel
+			return filter_sample(cascade, ...)
+		end
+		local reconfig_func = function(option)
+			cascade = prv.new_cascade(option2A012B012s(option),
+			  inital_gain, nchannels)
+		end
+		local buffer_func = function (samples, format)
+			return filter_buffer(cascade, samples, format)
+		end
+		return filter_func, reconfig_func, buffer_func
+	end
+	if nchannels > 1 then   -- 2.4 in Lua, a separate filter for each channel
+		local channel_option = {}
+		for k,v in pairs(option) do channel_option[k] = v end
+		channel_option['channels'] = 1
+		local channel_funcs   = {}
+		local channel_reconfs = {}
+		for i = 1,nchannels do
+			channel_funcs[i], channel_reconfs[i] =
+			  M.new_digitalfilter(channel_option)
+		end
+		local filter_func = function (...)
+			local frame = {...}
+			for i = 1,nchannels do frame[i] = channel_funcs[i](frame[i]) end
+			return table.unpack(frame, 1, nchannels)
+		end
+		local reconfig_func = function(option)
+			for i = 1,nchannels do channel_reconfs[i](option) end
+		end
+		local buffer_func = function (samples, format)
+			return lua_filter_buffer(channel_funcs, samples, format)
+		end
+		return filter_func, reconfig_func, buffer_func
+	end
 	local section_funcs  = {}  -- array of functions
 	local function option2sectionfuncs(option)
 		section_funcs  = {}   -- put together a chain of filter_sections
-		local section_a012b012s = M.freq_sections(option)
-		-- freq_sections(option)  returns { {a012b012}, {a012b012} ... }
-		for i, a012b012 in ipairs(section_a012b012s) do
-			local A012B012=freq_a012b012_to_zm1_A012B012(a012b012,option)
+		for i, A012B012 in ipairs(option2A012B012s(option)) do
 			section_funcs[i] = M.new_filter_section(A012B012, option)
 		end
 	end
 	option2sectionfuncs(option)
 	local filter_func = nil
-	if option['filtertype'] == 'chebyschev' and 0 == option['order']%2 then
-		-- 2.0 chebyschev of even order starts one ripple BENEATH unity gain!
-		local ripple = option['ripple'] or 1
-		local inital_gain = 1 / 10 ^ (0.05*ripple)
+	if inital_gain ~= 1.0 then
 		filter_func = function (signal) -- executes chain of filter_sections
 			for i, section in ipairs(section_funcs) do
 				-- signal = section_funcs[i](signal)
@@ -355,7 +458,10 @@ function M.new_digitalfilter (option)
 		end
 	end
 	local reconfig_func = function(option) option2sectionfuncs(option) end
-	return filter_func, reconfig_func
+	local buffer_func = function (samples, format)  -- 2.4
+		return lua_filter_buffer({filter_func}, samples, format)
+	end
+	return filter_func, reconfig_func, buffer_func
 end
 
 return M
@@ -465,6 +571,10 @@ The 'Q' is only necessary for 'bandpass' and 'bandstop' shapes,
 and specifies the I<quality> of the pole.
 High 'Q' gives the filter a narrower resonance.
 
+The 'channels' option, default 1, sets the number of independent
+channels which go through the same filter in lock-step, for example 2
+for stereo; see I<new_digitalfilter>.
+
 =back
 
 =head1 FILTER TYPES
@@ -515,9 +625,38 @@ The argument I<options> is a table, with keys
 If an error is detected, I<new_digitalfilter> returns I<nil>
 and an error message, so it can be used with I<assert>.
 
-It is hoped that some future version of I<new_digitalfilter>
-will return also a second closure,
-allowing the 'freq' parameter to be varied during use.
+I<new_digitalfilter> also returns a second closure,
+I<reconfig(options)>, which redesigns the filter with new options,
+for example to vary the 'freq' parameter during use,
+and a third closure, I<buffer_filter(samples, format)>,
+which filters a whole buffer of samples in one call:
+
+ local my_filter, reconfig, buffer_filter = DF.new_digitalfilter(options)
+ local filtered_pcm = buffer_filter(pcm, 's16')
+
+The I<samples> can be an array of numbers,
+in which case a new array is returned,
+or a string of native-endian floats (I<format> 'float')
+or of 16-bit integers (I<format> 's16', the default),
+as rendered by I<fluidsynth.render_block>,
+in which case a string in the same format is returned.
+The 's16' samples are rounded and clipped.
+The per-sample closure and I<buffer_filter> share the same filter-state,
+so they can be used alternately on the same signal.
+
+If the 'channels' option is greater than 1, the per-sample closure takes
+one signal-value for each channel and returns one filtered-value for each,
+and the I<samples> given to I<buffer_filter> are interleaved frames,
+one sample for each channel, as in the stereo output of
+I<fluidsynth.render_block>; their number must be a multiple of 'channels'.
+Each channel has its own filter-state.
+
+If the optional C module I<C-digitalfilter> is installed,
+the filter-sections are run in C, which is several times faster,
+and I<buffer_filter> many times faster again;
+with many channels, several channels at a time go through each
+filter-section as one SSE or AVX vector.
+Otherwise, I<buffer_filter> needs Lua5.3 or later to handle strings.
 
 =back
 
@@ -550,6 +689,14 @@ or:
 
  # luarocks install http://www.pjb.com.au/comp/lua/digitalfilter-2.1-0.rockspec
 
+The optional C module is in
+http://www.pjb.com.au/comp/lua/C-digitalfilter.c
+and can be compiled, for example, with
+B<cc -O2 -shared -fPIC -I/usr/include/lua5.3 C-digitalfilter.c -o C-digitalfilter.so>
+and then installed in your LUA_CPATH.
+Adding B<-march=native> lets it filter four channels at a time with AVX,
+instead of two with SSE2.
+
 The test script used during development is
 www.pjb.com.au/comp/lua/test_digitalfilter.lua
 
@@ -559,6 +706,8 @@ Peter J Billam, http://www.pjb.com.au/comp/contact.html
 
 =head1 CHANGES
 
+ 20261017 2.4 the 'channels' option filters many channels in lock-step
+ 20261017 2.4 optional C-digitalfilter, and the buffer_filter closure
  20170803 2.1 the 'type' option changed to 'filtertype'
  20170802 2.0 chebyschev even orders start at the bottom of their ripple
  20170731 1.4 chebyschev filters added, but even orders not the right shape
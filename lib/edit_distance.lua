@@ -9,8 +9,10 @@
 -- MM.foo()
 
 local M = {} -- public interface
-M.Version = '1.0'
-M.VersionDate = '15jan2021'
+M.Version = '1.1'
+M.VersionDate = '17oct2026'
+local prv = {} -- private C functions, if C-edit_distance is installed
+pcall(function() require('C-edit_distance')({}, prv, M) end)
 
 ------------------------------ private ------------------------------
 function warn(...)
@@ -39,18 +41,71 @@ local function utf8get (s, i)
 	return utf8.char(utf8.codepoint(s, utf8.offset(s, i)))
 end
 
+local function codepoints (s, cps)  -- decodes s into the array cps
+	local n = 0
+	for p, c in utf8.codes(s) do n = n+1 ; cps[n] = c end
+	for i = n+1, #cps do cps[i] = nil end
+	return cps, n
+end
+
+-- The symmetric-delete index: every word, and every string made by
+-- deleting one character from it, is hashed, and the hash maps to the
+-- number of the word in all_words (or to an array of such numbers).
+-- Two words within edit-distance 1 of each other always have such a
+-- string in common, so looking up the query and its own one-deletions
+-- finds all the candidates, which are then checked by bitparallel_osa.
+-- The hashes are polynomial, h = h*HASH_P + codepoint, wrapping round
+-- in 64-bit integers; a collision only adds a candidate, never loses one.
+local HASH_P = 1000003
+local hash_pow = { [0] = 1 }
+local function hash_powers (n)
+	for i = #hash_pow+1, n do hash_pow[i] = hash_pow[i-1] * HASH_P end
+end
+local pre = { [0] = 0 } ; local suf = {}
+-- calls found(h) for the hash of cps[1..n] and of each one-deletion
+local function deletion_hashes (cps, n, found)
+	hash_powers(n)
+	for i = 1, n do pre[i] = pre[i-1] * HASH_P + cps[i] end
+	suf[n+1] = 0
+	for i = n, 1, -1 do suf[i] = cps[i] * hash_pow[n-i] + suf[i+1] end
+	found(pre[n])
+	for i = 1, n do found(pre[i-1] * hash_pow[n-i] + suf[i+1]) end
+end
+local function word_hash (cps, n)   -- the hash of the whole word
+	local h = 0
+	for i = 1, n do h = h * HASH_P + cps[i] end
+	return h
+end
+
 -- should make a copy separating the words by their lengths
 -- how does ispell do it ? www.lasr.cs.ucla.edu/geoff/ispell.html
 -- but lasr.cs.ucla.edu is unpingable :-(
 -- aptitude search wamerican ; aptitude search iamerican ...
 words_arrays = false
 words_dicts  = false
+local all_words      = {}  -- every word, in the order of the word_file
+local deletion_index = {}  -- hash -> word-number, or array of them
+local alphabet       = {}  -- every codepoint used in the words
+local compiled       = false  -- or a dictionary from load_compiled
 local function load_words (word_file)
 	if not word_file then word_file = "/usr/share/dict/words" end
 	local wf = io.open(word_file)
 	if not wf then return nil, "can't open "..word_file end
+	compiled     = false
 	words_arrays = {}
 	words_dicts  = {}
+	all_words      = {}
+	deletion_index = {}
+	alphabet       = {}
+	local cps = {} ; local id
+	local function add (h)
+		local ids = deletion_index[h]
+		if not ids then deletion_index[h] = id
+		elseif type(ids) == 'number' then
+			if ids ~= id then deletion_index[h] = { ids, id } end
+		elseif ids[#ids] ~= id then ids[#ids+1] = id
+		end
+	end
 	while true do
 		local line = wf:read("l")
 		if not line then break end
@@ -63,23 +118,236 @@ local function load_words (word_file)
 		end
 		table.insert(words_arrays[len], line)
 		words_dicts[len][line] = true
--- if len == 4 and string.match(line, "^ev") then
+		id = #all_words + 1 ; all_words[id] = line
+		local n ; cps, n = codepoints(line, cps)
+		for i = 1, n do alphabet[cps[i]] = true end
+		deletion_hashes(cps, n, add)
 	end
 	wf:close()
--- print("load_words: words_dicts[4]['ever'] = ", words_dicts[4]['ever'])
+	local a = {}   -- as an array, in a reproducible order
+	for c in pairs(alphabet) do a[#a+1] = c end
+	table.sort(a) ; alphabet = a
+	return true
+end
+
+-- A compiled dictionary holds the words sorted by their length (and
+-- then in the order of the word_file), and the deletion_index as a
+-- sorted array of hashes, each with the number of its word; see the
+-- layout in C-edit_distance.c. It is written in the native byte-order,
+-- so that C-edit_distance can mmap it and use it just as it is.
+local MAGIC = 'LUAEDIX1'
+local function compile_words (word_file, compiled_file)
+	local ok, msg = load_words(word_file)
+	if not ok then return nil, msg end
+	local nwords = #all_words
+	local len = {} ; local maxlen = 0
+	for id, word in ipairs(all_words) do
+		local l = utf8.len(word) ; len[id] = l
+		if l > maxlen then maxlen = l end
+	end
+	local bucket_first = {}  -- 0-based, indexed by length+1
+	for l = 1, maxlen+2 do bucket_first[l] = 0 end
+	for id = 1, nwords do
+		local l = len[id] + 2 ; bucket_first[l] = bucket_first[l] + 1
+	end
+	for l = 2, maxlen+2 do
+		bucket_first[l] = bucket_first[l] + bucket_first[l-1]
+	end
+	local newid = {} ; local next_id = {} ; local text = {}
+	for l = 1, maxlen+1 do next_id[l] = bucket_first[l] end
+	for id = 1, nwords do
+		local l = len[id] + 1
+		newid[id] = next_id[l] ; next_id[l] = next_id[l] + 1
+		text[newid[id]+1] = all_words[id]
+	end
+	local word_off = { 0 } ; local off = 0
+	for i = 1, nwords do off = off + #text[i] ; word_off[i+1] = off end
+	local hashes = {}
+	for h in pairs(deletion_index) do hashes[#hashes+1] = h end
+	table.sort(hashes)
+	local hash_id = {} ; local nhash = 0 ; local hash_list = {}
+	for i, h in ipairs(hashes) do
+		local ids = deletion_index[h]
+		if type(ids) == 'number' then
+			nhash = nhash+1 ; hash_list[nhash] = h ; hash_id[nhash] = newid[ids]
+		else
+			local a = {}
+			for k, id in ipairs(ids) do a[k] = newid[id] end
+			table.sort(a)
+			for k, id in ipairs(a) do
+				nhash = nhash+1 ; hash_list[nhash] = h ; hash_id[nhash] = id
+			end
+		end
+	end
+	-- written beside it and renamed over it, because another process
+	-- may have the old one mapped, and truncating it would kill that
+	local tmp_file = compiled_file..'.tmp'
+	local cf = io.open(tmp_file, 'wb')
+	if not cf then return nil, "can't open "..tmp_file end
+	local function write_array (fmt, a, n)  -- in chunks of 1024
+		for i = 1, n, 1024 do
+			local j = math.min(i+1023, n)
+			cf:write(string.pack('='..string.rep(fmt, j-i+1),
+			  table.unpack(a, i, j)))
+		end
+	end
+	local nalpha = #alphabet
+	cf:write(MAGIC, string.pack('=I4I4I4I4I4I4',
+	  0x01020304, nwords, maxlen, nalpha, nhash, off))
+	write_array('I4', bucket_first, maxlen+2)
+	write_array('I4', word_off, nwords+1)
+	write_array('I4', alphabet, nalpha)
+	local size = 32 + 4*(maxlen+2 + nwords+1 + nalpha)
+	if size % 8 ~= 0 then cf:write(string.rep('\0', 8 - size % 8)) end
+	write_array('i8', hash_list, nhash)
+	write_array('I4', hash_id, nhash)
+	for i = 1, nwords, 1024 do
+		cf:write(table.concat(text, '', i, math.min(i+1023, nwords)))
+	end
+	local ok, msg = cf:close()
+	if ok then ok, msg = os.rename(tmp_file, compiled_file) end
+	if not ok then os.remove(tmp_file) ; return nil, msg end
+	return true
+end
+
+-- used if C-edit_distance is not installed: the file is read into a
+-- string, and the arrays are indexed with string.unpack
+local LuaCompiled = {}
+LuaCompiled.__index = LuaCompiled
+local function map_compiled (compiled_file)
+	local cf = io.open(compiled_file, 'rb')
+	if not cf then return nil, "can't open "..compiled_file end
+	local data = cf:read('a') ; cf:close()
+	if #data < 32 or string.sub(data, 1, 8) ~= MAGIC or
+	  string.unpack('=I4', data, 9) ~= 0x01020304 then
+		return nil, compiled_file.." is not a compiled dictionary"
+	end
+	local d = { data = data }
+	d.n, d.maxlen, d.nalpha, d.nhash, d.textsize =
+	  string.unpack('=I4I4I4I4I4', data, 13)
+	d.bucket_first = 33    -- the offsets, 1-based, of each array
+	d.word_off = d.bucket_first + 4*(d.maxlen+2)
+	d.alpha    = d.word_off + 4*(d.n+1)
+	d.hash     = d.alpha + 4*d.nalpha
+	d.hash     = d.hash + (8 - (d.hash-1) % 8) % 8
+	d.hash_id  = d.hash + 8*d.nhash
+	d.text     = d.hash_id + 4*d.nhash
+	if d.text + d.textsize - 1 > #data then
+		return nil, compiled_file.." is not a compiled dictionary"
+	end
+	return setmetatable(d, LuaCompiled)
+end
+function LuaCompiled:lower_bound (h)   -- the first index with hash >= h
+	local lo = 0 ; local hi = self.nhash
+	while lo < hi do
+		local mid = (lo + hi) // 2
+		if string.unpack('=i8', self.data, self.hash + 8*mid) < h then
+			lo = mid + 1
+		else hi = mid
+		end
+	end
+	return lo
+end
+function LuaCompiled:lookup (h, ids, seen)
+	local data = self.data
+	local i = self:lower_bound(h)
+	while i < self.nhash and string.unpack('=i8',data,self.hash+8*i) == h do
+		local id = string.unpack('=I4', data, self.hash_id + 4*i) + 1
+		if not seen[id] then seen[id] = true ; ids[#ids+1] = id end
+		i = i + 1
+	end
+end
+function LuaCompiled:find (word, h)
+	local data = self.data
+	local i = self:lower_bound(h)
+	while i < self.nhash and string.unpack('=i8',data,self.hash+8*i) == h do
+		local id = string.unpack('=I4', data, self.hash_id + 4*i) + 1
+		if self:word(id) == word then return true end
+		i = i + 1
+	end
+	return false
+end
+function LuaCompiled:word (id)
+	local first, last = string.unpack('=I4I4', self.data, self.word_off+4*(id-1))
+	return string.sub(self.data, self.text+first, self.text+last-1)
+end
+function LuaCompiled:nwords () return self.n end
+function LuaCompiled:alphabet ()
+	local a = {}
+	for i = 1, self.nalpha do
+		a[i] = string.unpack('=I4', self.data, self.alpha + 4*(i-1))
+	end
+	return a
+end
+function LuaCompiled:words_of_length (len)
+	local words = {}
+	if len < 0 or len > self.maxlen then return words end
+	local first, last = string.unpack('=I4I4',self.data,self.bucket_first+4*len)
+	for id = first+1, last do words[#words+1] = self:word(id) end
+	return words
+end
+function LuaCompiled:close () self.data = '' ; self.n = 0 ; self.nhash = 0 end
+
+local function load_compiled (compiled_file)
+	local map = prv.map or map_compiled
+	local d, msg = map(compiled_file)
+	if not d then return nil, msg end
+	words_arrays = false
+	words_dicts  = false
+	all_words      = {}
+	deletion_index = {}
+	alphabet       = d:alphabet()
+	compiled       = d
 	return true
 end
+local function ensure_loaded ()
+	if not compiled and not words_arrays then assert(load_words()) end
+end
+
+-- Hyyro's bit-parallel version of Myers' algorithm, with Hyyro's
+-- extension for transpositions, giving the optimal-string-alignment
+-- distance between the pattern (whose bitmasks peq were made by
+-- pattern_masks, of length m <= 63) and the codepoints of text.
+-- This equals damerau_levenshtein if either is 1 or less.
+local function pattern_masks (cps, m, peq)
+	for c in pairs(peq) do peq[c] = nil end
+	for i = 1, m do peq[cps[i]] = (peq[cps[i]] or 0) | (1 << (i-1)) end
+	return peq
+end
+local function bitparallel_osa (peq, m, text)
+	local high = 1 << (m-1)
+	local vp = (1 << m) - 1 ; local vn = 0
+	local d0 = 0 ; local pm_prev = 0
+	local score = m
+	for p, c in utf8.codes(text) do
+		local pm = peq[c] or 0
+		d0 = (((~d0) & pm) << 1) & pm_prev
+		d0 = d0 | ((((pm & vp) + vp) ~ vp) | pm | vn)
+		local hp = vn | ~(d0 | vp)
+		local hn = d0 & vp
+		if hp & high ~= 0 then score = score + 1
+		elseif hn & high ~= 0 then score = score - 1
+		end
+		hp = (hp << 1) | 1
+		hn = hn << 1
+		vp = hn | ~(d0 | hp)
+		vn = d0 & hp
+		pm_prev = pm
+	end
+	return score
+end
 
 ------------------------------ public ------------------------------
 
 function M.test_load_words()
-	if not words_arrays then load_words() end
+	if not compiled and not words_arrays then load_words() end
+	if compiled then return compiled:words_of_length(2) end
 	return words_arrays[2]
 end
 function M.damerau_levenshtein (a, b, speedup)
 	-- https://en.wikipedia.org/wiki/Damerau%E2%80%93Levenshtein_distance
-	local len_a = utf8.len(a)
-	local len_b = utf8.len(b)
+	local ca, len_a = codepoints(a, {})  -- decoded once, not in the loop
+	local cb, len_b = codepoints(b, {})
 	local da = {}
 	local maxdist = len_a + len_b
 -- print("a = ",a,"  b =",b, "  maxdist = ", maxdist)
@@ -98,10 +366,10 @@ function M.damerau_levenshtein (a, b, speedup)
 	for i = 1, len_a do
 		local db = 0
 		for j = 1, len_b do
-			local k = da[utf8get(b,j)] or 0
+			local k = da[cb[j]] or 0
 			local db_tmp = db
 			local cost
-			if utf8get(a,i) == utf8get(b,j) then
+			if ca[i] == cb[j] then
 				cost = 0
 				db = j
 			else
@@ -114,45 +382,117 @@ function M.damerau_levenshtein (a, b, speedup)
 				d[k-1][db_tmp-1] + i-k-1 + 1 + j-db_tmp-1 -- transposition
 			)
 			if speedup and d[i][j] > len_a then return 2 end
-			da[utf8get(a,i)] = i
 		end
+		da[ca[i]] = i   -- after the j loop, as in the algorithm below
 	end
 	return d[len_a][len_b]
 end
 
 function M.is_a_word (word)  -- case-insensitive ? not so easy ...
-	if not words_arrays or not words_dicts then assert(load_words()) end
+	ensure_loaded()
+	if compiled then
+		local cps, n = codepoints(word, {})
+		return compiled:find(word, word_hash(cps, n))
+	end
 	local len = utf8.len(word)
-	return  words_dicts[len][word] ~= nil
+	return  words_dicts[len] ~= nil and words_dicts[len][word] ~= nil
 end
-function M.candidates (word)
-	if not words_arrays or not words_dicts then assert(load_words()) end
+function M.load_words (word_file)  -- default is /usr/share/dict/words
+	return load_words(word_file)
+end
+function M.compile_words (word_file, compiled_file)
+	return compile_words(word_file, compiled_file)
+end
+function M.load_compiled (compiled_file)
+	return load_compiled(compiled_file)
+end
+
+function M.candidates (word, maxdist)
+	ensure_loaded()
+	maxdist = maxdist or 1
 	local len = utf8.len(word)
-	if words_dicts[len][word] then return word end  -- if match return string
-	local typos = {}  -- contains damerau_levenshtein==1
-	for i,dictword in pairs(words_arrays[len]) do
-		if M.damerau_levenshtein (dictword, word, true) == 1 then
-			-- could speed this up with a specialised function for 1
-			table.insert(typos, dictword)
+	local cps, m = codepoints(word, {})
+	if compiled then
+		if compiled:find(word, word_hash(cps, m)) then return word end
+	elseif words_dicts[len] and words_dicts[len][word] then return word
+	end
+	local ids = {} ; local seen = {}
+	local lookup
+	if compiled then
+		lookup = function (h) compiled:lookup(h, ids, seen) end
+	else
+		lookup = function (h)
+			local found = deletion_index[h]
+			if not found then return end
+			if type(found) == 'number' then
+				if not seen[found] then seen[found] = true ; ids[#ids+1] = found end
+			else
+				for i, id in ipairs(found) do
+					if not seen[id] then seen[id] = true ; ids[#ids+1] = id end
+				end
+			end
 		end
 	end
-	if len > 1 then
-		for i,dictword in pairs(words_arrays[len-1]) do
-			if M.damerau_levenshtein (dictword, word, true) == 1 then
-				-- could speed this up with a specialised for 1 deletion
-				table.insert(typos, dictword)
+	deletion_hashes(cps, m, lookup)
+	if maxdist >= 2 then   -- also look up every string one edit away
+		local s = {}
+		local function variant (n) deletion_hashes(s, n, lookup) end
+		for j = 1, m do   -- deletions
+			for i = 1, j-1 do s[i] = cps[i] end
+			for i = j+1, m do s[i-1] = cps[i] end
+			variant(m-1)
+		end
+		for i = 1, m do s[i] = cps[i] end
+		for j = 1, m-1 do  -- transpositions
+			s[j], s[j+1] = cps[j+1], cps[j] ; variant(m)
+			s[j], s[j+1] = cps[j], cps[j+1]
+		end
+		for j = 1, m do    -- substitutions
+			for k, c in ipairs(alphabet) do
+				if c ~= cps[j] then s[j] = c ; variant(m) end
 			end
+			s[j] = cps[j]
+		end
+		for j = 1, m+1 do  -- insertions
+			for i = 1, j-1 do s[i] = cps[i] end
+			for i = j, m do s[i+1] = cps[i] end
+			for k, c in ipairs(alphabet) do s[j] = c ; variant(m+1) end
 		end
 	end
-	if len < #words_arrays then
-		for i,dictword in pairs(words_arrays[len+1]) do
-			if M.damerau_levenshtein (dictword, word, true) == 1 then
-				-- could speed this up with a specialised for 1 insertion
-				table.insert(typos, dictword)
+	local peq = m >= 1 and m <= 63 and pattern_masks(cps, m, {})
+	local typos = {} ; local dist = {} ; local rank = {}
+	-- a compiled dictionary numbers its words by length, then in the
+	-- order of the word_file, so the ranks come out in the same order
+	local nwords = compiled and compiled:nwords() or #all_words
+	for i, id in ipairs(ids) do
+		local dictword = compiled and compiled:word(id) or all_words[id]
+		local d
+		if peq then
+			d = bitparallel_osa(peq, m, dictword)
+			-- damerau_levenshtein can be less, but only above 1
+			if d == maxdist+1 and d > 2 then
+				d = M.damerau_levenshtein(dictword, word)
+			end
+		else
+			d = M.damerau_levenshtein(dictword, word)
+		end
+		if d >= 1 and d <= maxdist then
+			typos[#typos+1] = dictword ; dist[dictword] = d
+			local dl = utf8.len(dictword) - len
+			if dl == 0 then rank[dictword] = id
+			elseif dl == -1 then rank[dictword] = id + nwords
+			elseif dl == 1 then rank[dictword] = id + 2*nwords
+			elseif dl == -2 then rank[dictword] = id + 3*nwords
+			else rank[dictword] = id + 4*nwords
 			end
 		end
 	end
-	return typos -- return an array of typos with damerau_levenshtein==1
+	-- the nearest first, and in the same order as the word_file
+	table.sort(typos, function (a, b)
+		if dist[a] ~= dist[b] then return dist[a] < dist[b] end
+		return rank[a] < rank[b]
+	end)
+	return typos -- an array of words with damerau_levenshtein <= maxdist
 end
 
 return M
@@ -221,6 +561,71 @@ so I have tried to use dictionaries ...
     return d[length(a), length(b)]
 
 
+=head1 FUNCTIONS
+
+=over 3
+
+=item I<damerau_levenshtein>(a, b)
+
+Returns the Damerau-Levenshtein distance between the strings I<a> and I<b>,
+which may be in utf8.
+
+=item I<is_a_word>(word)
+
+Returns true if I<word> is in the dictionary.
+
+=item I<candidates>(word, maxdist)
+
+If I<word> is in the dictionary, returns I<word>.
+Otherwise returns an array of the dictionary words within a
+Damerau-Levenshtein distance of I<maxdist> (1, the default, or 2),
+the nearest first.
+
+When the dictionary is loaded, every word, and every string made by
+deleting one character from it, is hashed into an index.
+Any two words within distance 1 of each other have such a string in common,
+so I<candidates> only has to look up the I<word> and its one-deletions,
+and check the few words it finds, with Hyyro's bit-parallel algorithm.
+For I<maxdist> 2, it also looks up every string one edit away from I<word>,
+which takes a few milliseconds.
+
+=item I<load_words>(word_file)
+
+Loads the dictionary, one word per line, and builds the index.
+The default I<word_file> is I</usr/share/dict/words>,
+which is loaded automatically by the first call to
+I<is_a_word> or I<candidates>.
+
+=item I<compile_words>(word_file, compiled_file)
+
+Loads the I<word_file> as I<load_words> does,
+and writes the words, sorted by length, and the index into the
+binary I<compiled_file>, which is in the byte-order of this machine.
+It only needs to be done once, when the I<word_file> changes, eg:
+
+ lua -e "require('edit_distance').compile_words(nil,'/var/tmp/words.edx')"
+
+Returns true, or nil and an error message.
+
+=item I<load_compiled>(compiled_file)
+
+Uses the dictionary and index written by I<compile_words>,
+instead of loading and indexing a I<word_file>.
+If the optional C helper I<C-edit_distance> is installed,
+the I<compiled_file> is mapped read-only into memory,
+which takes well under a millisecond, costs no memory of its own,
+and is shared between all the processes that use it;
+otherwise the file is read into one string.
+I<C-edit_distance> can be compiled with, eg:
+
+ cc -O2 -shared -fPIC -I/usr/include/lua5.3 \
+   C-edit_distance.c -o C-edit_distance.so
+
+and installed next to your other Lua C modules.
+Returns true, or nil and an error message.
+
+=back
+
 =head1 ARGUMENTS
 
 =over 3
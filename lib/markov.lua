@@ -6,8 +6,8 @@
 ---------------------------------------------------------------------
 
 local M = {} -- public interface
-M.Version = '1.0'
-M.VersionDate = '27jan2018'
+M.Version = '1.1'
+M.VersionDate = '17oct2026'
 
 ------------------------------ private ------------------------------
 function warn(...)
@@ -24,8 +24,6 @@ math.randomseed(os.time())
 -- require 'DataDumper'
 local stats  = false
 
-function prefix (...) return table.concat({...}, " ") end
-
 -- local NOWORD = "\n"
 local NOWORD = ""
 
@@ -81,53 +79,162 @@ or, if that doesn't work:
 	end
 end
 
+-- The words are interned: each distinct word gets an integer id, and
+-- the states are numbered too. The state of the last two words is
+-- looked up by the number id(w4)*WORDS + id(w3), the state of the last
+-- three by state2*WORDS + id(w2), and so on, so no strings are made
+-- either in training or in generating. These numbers stay below 2^53,
+-- so they are exact even in Lua 5.1, as long as there are fewer than
+-- WORDS distinct words and 2^(53-24) states of each length.
+local WORDS = 16777216   -- 2^24
+
+-- Each state has either the number count*WORDS + id, if it has only
+-- ever been followed by one word, or an array { total, id1, count1,
+-- id2, count2, ... }; position[state] then finds the successors
+-- already in that array, once it gets longer than LINEAR.
+local LINEAR = 16
+local function new_statetab ()
+	return { succ = {}, position = {}, alias = {} }
+end
+local function total (tab, s)
+	local list = tab.succ[s]
+	if not list then return 0 end
+	if type(list) == 'number' then return math.floor(list / WORDS) end
+	return list[1]
+end
+local function add_successor (tab, s, id)
+	local list = tab.succ[s]
+	if not list then tab.succ[s] = WORDS + id ; return end
+	if type(list) == 'number' then
+		local old = list % WORDS ; local count = (list - old) / WORDS
+		if old == id then tab.succ[s] = list + WORDS
+		else tab.succ[s] = { count+1, old, count, id, 1 }
+		end
+		return
+	end
+	list[1] = list[1] + 1
+	local n = #list
+	local pos = tab.position[s]
+	if pos then
+		local i = pos[id]
+		if i then list[i] = list[i] + 1 ; return end
+	else
+		for i = 2, n, 2 do
+			if list[i] == id then list[i+1] = list[i+1] + 1 ; return end
+		end
+	end
+	list[n+1] = id ; list[n+2] = 1
+	if pos then pos[id] = n+2
+	elseif n+2 > LINEAR then
+		pos = {}
+		for i = 2, n+2, 2 do pos[list[i]] = i+1 end
+		tab.position[s] = pos
+	end
+end
+
+-- Vose's alias method: an array of { id, probability, alias, ... }
+-- with one triple per successor, so that choosing one takes two
+-- random numbers whatever the length of the list.
+local function new_alias (list)
+	local n = (#list - 1) / 2
+	local alias = {} ; local small = {} ; local large = {}
+	for i = 1, n do
+		local p = list[2*i+1] * n / list[1]
+		alias[3*i-2] = list[2*i] ; alias[3*i-1] = p ; alias[3*i] = i
+		if p < 1 then small[#small+1] = i else large[#large+1] = i end
+	end
+	while #small > 0 and #large > 0 do
+		local s = table.remove(small) ; local l = large[#large]
+		alias[3*s] = l
+		local p = alias[3*l-1] - (1 - alias[3*s-1])
+		alias[3*l-1] = p
+		if p < 1 then large[#large] = nil ; small[#small+1] = l end
+	end
+	for k, i in ipairs(large) do alias[3*i-1] = 1 end
+	for k, i in ipairs(small) do alias[3*i-1] = 1 end  -- rounding error
+	return alias
+end
+local function choose (tab, s)   -- weighted by the counts
+	local list = tab.succ[s]
+	if type(list) == 'number' then return list % WORDS end
+	local alias = tab.alias[s]
+	if not alias then
+		alias = new_alias(list) ; tab.alias[s] = alias
+	end
+	local i = math.random(#alias / 3)
+	if math.random() < alias[3*i-1] then return alias[3*i-2] end
+	return alias[3*alias[3*i]-2]
+end
+
 function M.new_markov (arg)
 	local allwords
 	if  type(arg) == 'function' then allwords = arg
 	elseif type(arg) == 'table' then
 		local i = 0
-		allwords = function (arg) ; i = i + 1 ; return arg[i] end
+		allwords = function () ; i = i + 1 ; return arg[i] end
 	end
 	local input_words = 0
 	local found = {0,0,0,0}
 
-	local statetab_1 = {}   -- indexed by the current word only
-	local statetab_2 = {}   -- indexed by the last two words
-	local statetab_3 = {}   -- indexed by the last three words
-	local statetab_4 = {}   -- indexed by the last four words
-	function insert (w1, w2, w3, w4, value)
-		local list1 = statetab_1[w4]
-		if list1 == nil then statetab_1[w4] = {value}
-		else              list1[#list1 + 1] = value
-		end
-		local p2 = prefix(w3, w4)
-		local list2 = statetab_2[p2]
-		if list2 == nil then statetab_2[p2] = {value}
-		else              list2[#list2 + 1] = value
-		end
-		local p3 = prefix(w2, w3, w4)
-		local list3 = statetab_3[p3]
-		if list3 == nil then statetab_3[p3] = {value}
-		else              list3[#list3 + 1] = value
-		end
-		local p4 = prefix(w1, w2, w3, w4)
-		local list4 = statetab_4[p4]
-		if list4 == nil then statetab_4[p4] = {value}
-		else              list4[#list4 + 1] = value
-		end
+	local word_id = {}     -- interned: the id of each word,
+	local id_word = {}     -- and the word of each id
+	local function intern (word)
+		local id = word_id[word]
+		if id then return id end
+		id = #id_word + 1
+		if id >= WORDS then die("markov: more than 2^24 different words") end
+		word_id[word] = id ; id_word[id] = word
+		return id
+	end
+	local state_2 = {}  -- the state of the last two words, by number
+	local state_3 = {}  -- the state of the last three words
+	local state_4 = {}  -- the state of the last four words
+	local nstates = {0,0,0}
+	local function state (states, i, prev, w, create)
+		if not prev then return nil end
+		local key = prev * WORDS + w
+		local s = states[key]
+		if s or not create then return s end
+		s = nstates[i] + 1 ; nstates[i] = s ; states[key] = s
+		if s >= 536870912 then die("markov: more than 2^29 states") end
+		return s
+	end
+	local statetab_1 = new_statetab()   -- indexed by the current word only
+	local statetab_2 = new_statetab()   -- indexed by the last two words
+	local statetab_3 = new_statetab()   -- indexed by the last three words
+	local statetab_4 = new_statetab()   -- indexed by the last four words
+	local s1, s2, s3, s4   -- the current states
+	local function move (w1, w2, w3, w4, create)
+		s1 = w4
+		s2 = state(state_2, 1, s1, w3, create)
+		s3 = state(state_3, 2, s2, w2, create)
+		s4 = state(state_4, 3, s3, w1, create)
+	end
+	local function insert (value)
+		add_successor(statetab_1, s1, value)
+		add_successor(statetab_2, s2, value)
+		add_successor(statetab_3, s3, value)
+		add_successor(statetab_4, s4, value)
 	end
 
 	-- build table
-	local w1,w2,w3,w4 = NOWORD, NOWORD, NOWORD, NOWORD   -- initialise
+	local noword = intern(NOWORD)
+	local w1,w2,w3,w4 = noword, noword, noword, noword   -- initialise
+	move(w1, w2, w3, w4, true)
 	for nextword in allwords do
-		insert(w1, w2, w3, w4, nextword)
-		w1 = w2 ; w2 = w3 ; w3 = w4 ; w4 = nextword
+		local id = intern(nextword)
+		insert(id)
+		w1 = w2 ; w2 = w3 ; w3 = w4 ; w4 = id
+		move(w1, w2, w3, w4, true)
 		input_words = input_words + 1
 	end
-	insert(w1, w2, w3, w4, NOWORD)
+	insert(noword)
+	statetab_1.position = {} ; statetab_2.position = {}
+	statetab_3.position = {} ; statetab_4.position = {}
 
 	-- generate text
-	w1 = NOWORD ; w2 = NOWORD ; w3 = NOWORD ; w4 = NOWORD  -- reinitialise
+	w1 = noword ; w2 = noword ; w3 = noword ; w4 = noword  -- reinitialise
+	move(w1, w2, w3, w4, false)
 	local seeds = {}
 	return function (opt, ...)
 		if opt == 'stats' then
@@ -141,10 +248,12 @@ function M.new_markov (arg)
 			seeds = {...}
 			for i = 1, #seeds do
 				seeds[i] = tostring(seeds[i])
-				if statetab_1[seeds[i]] then
-					w1 = w2 ; w2 = w3 ; w3 = w4 ; w4 = seeds[i]
+				local id = word_id[seeds[i]]
+				if id then
+					w1 = w2 ; w2 = w3 ; w3 = w4 ; w4 = id
 				end
 			end
+			move(w1, w2, w3, w4, false)
 			return nil
 		end
 		if #seeds > 0 then  -- still some seeds left; regurgitate the seed
@@ -152,28 +261,25 @@ function M.new_markov (arg)
 			return w
 		end
 		local nextword
-		local list2 = statetab_2[prefix(w3,w4)]
-		local list3 = statetab_3[prefix(w2,w3,w4)]
-		local list4 = statetab_4[prefix(w1,w2,w3,w4)]
-		if list4 and #list4 > 1 then
-			nextword = list4[math.random(#list4)]  -- choose a random word
+		if s4 and total(statetab_4, s4) > 1 then
+			nextword = choose(statetab_4, s4)  -- choose a random word
 			found[4] = found[4] + 1
-		elseif list3 and #list3 > 1 then
-			nextword = list3[math.random(#list3)]  -- choose a random word
+		elseif s3 and total(statetab_3, s3) > 1 then
+			nextword = choose(statetab_3, s3)  -- choose a random word
 			found[3] = found[3] + 1
-		elseif list2 and #list2 > 1 then
-			nextword = list2[math.random(#list2)]
+		elseif s2 and total(statetab_2, s2) > 1 then
+			nextword = choose(statetab_2, s2)
 			found[2] = found[2] + 1
 		else
-			local list1 = statetab_1[w4]
-			if not list1 then return end
-			nextword = list1[math.random(#list1)]
+			if total(statetab_1, s1) == 0 then return end
+			nextword = choose(statetab_1, s1)
 			found[1] = found[1] + 1
 		end
 		-- if nextword ~= NOWORD then io.stdout:write(nextword, " ") end
 		-- if it's a NOWORD, we should try the next one ...
 		w1 = w2 ; w2 = w3 ; w3 = w4 ; w4 = nextword
-		return nextword
+		move(w1, w2, w3, w4, false)
+		return id_word[nextword]
 	end
 end
 
@@ -214,6 +320,14 @@ then 0.15 of the time that item is chosen,
 and the other 0.85 of the time the next list is consulted.
 The default behaviour is I<r = 0.0>, which works well.
 
+Each distinct word is stored only once, and given an integer id;
+the N=2, N=3 and N=4 states are looked up by numbers made from those ids,
+and each state keeps its following words as (id, count) pairs,
+from which one is chosen, weighted by its count, by Vose's alias method.
+So no strings are made while training or generating,
+and a large corpus takes much less memory than a table of strings would.
+There may be up to 2^24 different words.
+
 =head1 FUNCTIONS
 
 The API only contains one function:
@@ -6,8 +6,10 @@
 ---------------------------------------------------------------------
 
 local M = {} -- public interface
-M.Version = '1.0'
-M.VersionDate = '1aug2016'
+M.Version = '1.2'
+M.VersionDate = '17oct2026'
+local prv = {} -- private C functions, if C-rbm is installed
+pcall(function() require('C-rbm')({}, prv, M) end)
 
 -- Translation of   ~/lua/restricted_boltzmann_machines/rbm_shorter.py
 -- See  https://en.wikipedia.org/wiki/Restricted_Boltzmann_machine
@@ -235,6 +237,138 @@ local function gaussn(stddev) -- using the Box-Muller rules
 	end
 end
 
+local function training_options(rbm, num_examples)
+	local batch_size = math.floor(rbm.batch_size or num_examples)
+	if batch_size < 1 or batch_size > num_examples then
+		batch_size = num_examples
+	end
+	return batch_size, rbm.momentum or 0.0, rbm.cd_k or 1
+end
+
+------------- using the contiguous matrices of C-rbm --------------
+-- each matrix is a C userdata, so that each epoch of training
+-- allocates nothing; the states are sampled in C as logistic is done
+
+local function seed()  -- the C sampling takes its seed from math.random
+	return math.random(2147483646)
+end
+
+local function c_train(rbm, data, max_epochs)
+	local started = prv.now()
+	local num_examples = #data
+	local num_visible = #rbm.weights ; local num_hidden = #rbm.weights[1]
+	local batch_size, momentum, cd_k = training_options(rbm, num_examples)
+	local threads = rbm.threads or 0
+	data = prv.matrix_from(data, true)  -- insert bias unit 1, without deepcopy
+	local weights = prv.matrix_from(rbm.weights)
+	local velocity
+	if momentum > 0 then velocity = prv.new_matrix(num_visible,num_hidden) end
+	-- each mini-batch is a view of some rows of the data, and the batches
+	-- of the same size share their working matrices
+	local batches = {} ; local work = {}
+	for first = 1, num_examples, batch_size do
+		local n = math.min(batch_size, num_examples-first+1)
+		if not work[n] then work[n] = {
+			pos_hidden_probs  = prv.new_matrix(n, num_hidden),
+			hidden_states     = prv.new_matrix(n, num_hidden),
+			neg_visible_probs = prv.new_matrix(n, num_visible),
+			neg_hidden_probs  = prv.new_matrix(n, num_hidden),
+		} end
+		batches[#batches+1] = {data=prv.rows(data,first,n), n=n, work=work[n]}
+	end
+	local err = 0.0
+	for epoch = 1,max_epochs do
+		err = 0.0
+		for i_batch,batch in ipairs(batches) do
+			local w = batch.work
+			-- the positive CD phase
+			prv.gemm(w.pos_hidden_probs, batch.data, weights,
+			  false, false, 1.0, 0.0, threads)
+			prv.logistic(w.pos_hidden_probs, w.hidden_states, seed())
+			-- the negative CD phase, with cd_k steps of Gibbs sampling
+			for step = 1,cd_k do
+				prv.gemm(w.neg_visible_probs, w.hidden_states, weights,
+				  false, true, 1.0, 0.0, threads)
+				prv.set_column(prv.logistic(w.neg_visible_probs), 1, 1.0)
+				prv.gemm(w.neg_hidden_probs, w.neg_visible_probs, weights,
+				  false, false, 1.0, 0.0, threads)
+				if step < cd_k then
+					prv.logistic(w.neg_hidden_probs, w.hidden_states, seed())
+				else
+					prv.logistic(w.neg_hidden_probs)
+				end
+			end
+			-- update the weights in place, by the pos and neg associations
+			local rate = rbm.learning_rate / batch.n
+			if velocity then
+				prv.gemm(velocity, batch.data, w.pos_hidden_probs,
+				  true, false, rate, momentum, threads)
+				prv.gemm(velocity, w.neg_visible_probs, w.neg_hidden_probs,
+				  true, false, 0.0-rate, 1.0, threads)
+				prv.add(weights, velocity)
+			else
+				prv.gemm(weights, batch.data, w.pos_hidden_probs,
+				  true, false, rate, 1.0, threads)
+				prv.gemm(weights, w.neg_visible_probs, w.neg_hidden_probs,
+				  true, false, 0.0-rate, 1.0, threads)
+			end
+			if epoch == max_epochs then
+				err = err + prv.sqdiff(batch.data, w.neg_visible_probs)
+			end
+		end
+	end
+	prv.to_table(weights, 1, rbm.weights)
+	local per_second = num_examples * max_epochs / (prv.now() - started)
+	warn('train: after ',max_epochs,' iterations error was ',err,
+	  string.format(', at %.0f examples/sec', per_second))
+	return err, per_second
+end
+
+local function c_vis2hid(rbm, data)
+	-- as in vis2hid, the data has no bias units, so uses the first #data[1]
+	-- rows of the weights, and the bias units in col=1 are skipped
+	local num_examples = #data
+	local weights = prv.matrix_from(rbm.weights, false, #data[1])
+	data = prv.matrix_from(data)
+	local hidden_probs  = prv.new_matrix(num_examples, #rbm.weights[1])
+	local hidden_states = prv.new_matrix(num_examples, #rbm.weights[1])
+	prv.gemm(hidden_probs, data, weights,
+	  false, false, 1.0, 0.0, rbm.threads or 0)
+	prv.logistic(hidden_probs, hidden_states, seed())
+	return prv.to_table(hidden_states, 2, nil, true)
+end
+
+local function c_hid2vis(rbm, data)
+	local num_examples = #data
+	data = prv.matrix_from(data, true)  -- insert bias unit 1
+	local weights = prv.matrix_from(rbm.weights)
+	local visible_probs  = prv.new_matrix(num_examples, #rbm.weights)
+	local visible_states = prv.new_matrix(num_examples, #rbm.weights)
+	prv.gemm(visible_probs, data, weights,
+	  false, true, 1.0, 0.0, rbm.threads or 0)
+	prv.logistic(visible_probs, visible_states, seed())
+	return prv.to_table(visible_states, 2, nil, true)
+end
+
+local function c_daydream(rbm, num_samples)
+	local num_visible = #rbm.weights ; local num_hidden = #rbm.weights[1]
+	local weights = prv.matrix_from(rbm.weights)
+	local samples = prv.new_matrix(num_samples, num_visible)
+	local hidden_probs   = prv.new_matrix(num_samples, num_hidden)
+	local hidden_states  = prv.new_matrix(num_samples, num_hidden)
+	local visible_states = prv.new_matrix(num_samples, num_visible)
+	prv.set_column(prv.uniform(samples, seed()), 1, 1.0)  -- bias unit
+	prv.gemm(hidden_probs, samples, weights,
+	  false, false, 1.0, 0.0, rbm.threads or 0)
+	prv.logistic(hidden_probs, hidden_states, seed())
+	prv.set_column(hidden_states, 1, 1.0)  -- restore the bias unit to 1
+	local visible_probs = samples  -- the samples are not needed any more
+	prv.gemm(visible_probs, hidden_states, weights,
+	  false, true, 1.0, 0.0, rbm.threads or 0)
+	prv.logistic(visible_probs, visible_states, seed())
+	return prv.to_table(visible_states, 2, nil, true) -- remove bias unit
+end
+
 ------------------------------ public ------------------------------
 function M.new_rbm(arg)
 	local num_visible = arg[1] or arg['num_visible']
@@ -244,6 +378,10 @@ function M.new_rbm(arg)
 	rbm.num_visible   = num_visible
 	rbm.num_hidden    = num_hidden
 	rbm.learning_rate = arg['learning_rate'] or 0.1
+	rbm.batch_size    = arg['batch_size']  -- nil means all the data
+	rbm.momentum      = arg['momentum'] or 0.0
+	rbm.cd_k          = arg['cd_k'] or 1
+	rbm.threads       = arg['threads'] or 0
 	if labels and #labels ~= num_visible then
 		die('new_rbm: labels array must have ',num_visible,' elements')
 	end
@@ -268,48 +406,87 @@ end
 
 function M.train(rbm, data, max_epochs)
 	if not max_epochs then max_epochs = 1000 end
-	num_examples = #data
-	data = deepcopy(data) -- I think we need to deepcopy before the insert ...
+	if prv.gemm then return c_train(rbm, data, max_epochs) end
+	local started = os.clock()
+	local num_examples = #data
+	local batch_size, momentum, cd_k = training_options(rbm, num_examples)
+	-- insert bias unit 1; the rows are copied once, the batches just refer
+	local biased = {}
+	for i,t in ipairs(data) do
+		local row = {1.0} ; for j,v in ipairs(t) do row[j+1] = v end
+		biased[i] = row
+	end
+	local velocity
+	if momentum > 0 then
+		velocity = {}
+		for irow,vrow in ipairs(rbm.weights) do
+			velocity[irow] = {}
+			for icol,vcol in ipairs(vrow) do velocity[irow][icol] = 0.0 end
+		end
+	end
 	local err = 0.0
-	for i,t in ipairs(data) do table.insert(t,1,1.0) end -- insert bias unit 1
 	for epoch = 1,max_epochs do
-		-- Clamp to the data and sample from the hidden units. 
-		-- (This is the "positive CD phase", aka the reality phase.)
-		-- pjb: "activation" seems to mean "activation energy" ie: "energy"
-		local pos_hidden_activations = np_dot(data, rbm.weights) -- matrix mul
-	 	local pos_hidden_probs = logistic(pos_hidden_activations)
-	 	local pos_hidden_states = gt_rand(pos_hidden_probs)
-		local pos_associations = np_dot(transpose(data), pos_hidden_probs)
-		-- Reconstruct the visible units and sample again from the hidden units
-		-- (This is the "negative CD phase", aka the daydreaming phase.)
-		local neg_visible_activations = np_dot(
-		  pos_hidden_states, transpose(rbm.weights))
-		local neg_visible_probs = logistic(neg_visible_activations)
-		for i,t in ipairs(neg_visible_probs) do t[1] = 1.0 end -- bias unit=1
-		local neg_hidden_activations = np_dot(neg_visible_probs, rbm.weights)
-		local neg_hidden_probs = logistic(neg_hidden_activations)
-		-- Again, we're using the activation *probabilities*, not the states
-		local neg_associations = np_dot(
-		  transpose(neg_visible_probs), neg_hidden_probs)
-        for irow,vrow in ipairs(rbm.weights) do   -- Update weights
-            for icol,vcol in ipairs(vrow) do
-				rbm.weights[irow][icol] = rbm.weights[irow][icol] +
-				  rbm.learning_rate * (pos_associations[irow][icol]
-				   - neg_associations[irow][icol]) / num_examples
-			end
-        end
 		err = 0.0
-        for irow,vrow in ipairs(data) do   -- calculate error terms
-            for icol,vcol in ipairs(vrow) do err = err + (
-				  data[irow][icol] - neg_visible_probs[irow][icol]) ^ 2
+		for first = 1, num_examples, batch_size do
+			local data = {}  -- this mini-batch
+			for i = first, math.min(first+batch_size-1, num_examples) do
+				data[#data+1] = biased[i]
 			end
-        end
-
+			-- Clamp to the data and sample from the hidden units. 
+			-- (This is the "positive CD phase", aka the reality phase.)
+			-- pjb: "activation" seems to mean "activation energy" ie: "energy"
+			local pos_hidden_activations = np_dot(data, rbm.weights) -- matrix mul
+		 	local pos_hidden_probs = logistic(pos_hidden_activations)
+		 	local pos_hidden_states = gt_rand(pos_hidden_probs)
+			local pos_associations = np_dot(transpose(data), pos_hidden_probs)
+			-- Reconstruct the visible units and sample again from the hidden units
+			-- (This is the "negative CD phase", aka the daydreaming phase.)
+			-- With cd_k > 1 this is repeated, from the sampled hidden units
+			local transposed_weights = transpose(rbm.weights)
+			local neg_visible_probs, neg_hidden_probs
+			for step = 1,cd_k do
+				local neg_visible_activations = np_dot(
+				  pos_hidden_states, transposed_weights)
+				neg_visible_probs = logistic(neg_visible_activations)
+				for i,t in ipairs(neg_visible_probs) do t[1] = 1.0 end -- bias unit
+				local neg_hidden_activations = np_dot(neg_visible_probs,rbm.weights)
+				neg_hidden_probs = logistic(neg_hidden_activations)
+				if step < cd_k then pos_hidden_states = gt_rand(neg_hidden_probs) end
+			end
+			-- Again, we're using the activation *probabilities*, not the states
+			local neg_associations = np_dot(
+			  transpose(neg_visible_probs), neg_hidden_probs)
+			local batch_examples = #data
+	        for irow,vrow in ipairs(rbm.weights) do   -- Update weights
+	            for icol,vcol in ipairs(vrow) do
+					if velocity then
+						velocity[irow][icol] = momentum * velocity[irow][icol] +
+						  rbm.learning_rate * (pos_associations[irow][icol]
+						   - neg_associations[irow][icol]) / batch_examples
+						rbm.weights[irow][icol] = rbm.weights[irow][icol] +
+						  velocity[irow][icol]
+					else
+						rbm.weights[irow][icol] = rbm.weights[irow][icol] +
+						  rbm.learning_rate * (pos_associations[irow][icol]
+						   - neg_associations[irow][icol]) / batch_examples
+					end
+				end
+	        end
+	        for irow,vrow in ipairs(data) do   -- calculate error terms
+	            for icol,vcol in ipairs(vrow) do err = err + (
+					  data[irow][icol] - neg_visible_probs[irow][icol]) ^ 2
+				end
+	        end
+		end
 	end
-	warn('train: after ',max_epochs,' iterations error was ',err)
+	local per_second = num_examples * max_epochs / (os.clock() - started)
+	warn('train: after ',max_epochs,' iterations error was ',err,
+	  string.format(', at %.0f examples/sec', per_second))
+	return err, per_second
 end
 
 function M.vis2hid(rbm, data)
+	if prv.gemm then return c_vis2hid(rbm, data) end
 	-- find the activations and then the probabilities of the hidden units
 	-- we write this out in full so as to skip the bias units in col=1
 	local hidden_activations = {}
@@ -340,6 +517,7 @@ function M.vis2hid(rbm, data)
 end
 
 function M.hid2vis(rbm, data)
+	if prv.gemm then return c_hid2vis(rbm, data) end
     local num_examples = #data
 	data = deepcopy(data) -- I think we need to deepcopy before the insert ...
     for i,t in ipairs(data) do table.insert(t,1,1.0) end -- insert bias unit 1
@@ -360,6 +538,7 @@ function M.hid2vis(rbm, data)
 end
 
 function M.daydream(rbm, num_samples)
+	if prv.gemm then return c_daydream(rbm, num_samples) end
 	-- Create a matrix, where each row is to be a sample of the
 	-- visible units (with an extra bias unit)
 	local samples = {}
@@ -522,7 +701,8 @@ The rules are quoted from Geoff Hinton's C<guideTR.pdf>
 =over 3
 
 =item I<rbm = new_rbm{num_visible, num_hidden, learning_rate=0.1,
- labels={'Potter','Avatar','LOTR3','Gladiator','Titanic','Glitter'}}>
+ labels={'Potter','Avatar','LOTR3','Gladiator','Titanic','Glitter'},
+ batch_size=100, momentum=0.5, cd_k=1, threads=0}>
 
 This creates a new Recursive Boltzmann Machine,
 which will study I<num_visible> variables and
@@ -534,16 +714,41 @@ If the I<learning_rate> is not given it defaults to 0.1
 The I<labels> refer to the visible variables;
 therefore, there should be I<num_visible> labels in the list.
 
+The I<batch_size>, I<momentum>, I<cd_k> and I<threads> control
+the training, and are stored in the C<rbm>, so they can be changed
+between calls to I<train>.
+If I<batch_size> is given, each epoch works through the training data
+in mini-batches of that many examples, and the weights are updated
+after each mini-batch; by default the whole of the training data
+is one batch.
+If I<momentum> is given, each update of the weights is that fraction
+of the previous update, plus the new contribution; it defaults to 0.
+I<cd_k> is the number of steps of Gibbs sampling in the negative phase
+of the Contrastive Divergence; it defaults to 1, that is, CD-1.
+I<threads> is the number of threads over which C-rbm splits the big
+matrix products; the default 0 means as many as there are processors.
+
 =item I<train(rbm, training_data, max_epochs)>
 
 This trains the weights in your new Recursive Boltzmann Machine
 on a 2D array of I<training_data>, each element of which is an array of
 I<num_visible> numbers.
 
-The function returns nothing, since the weights are stored inside the C<rbm>
+The weights are stored inside the C<rbm>.
+The function returns the reconstruction error of the last epoch,
+and the number of examples per second that it achieved,
+which are also reported on I<stderr>.
 
 If the I<max_epochs> is not given it defaults to 1000
 
+If the optional C module I<C-rbm> is installed, then I<train>,
+I<vis2hid>, I<hid2vis> and I<daydream> copy the tables into
+contiguous matrices of doubles, and do all their arithmetic in C,
+with a cache-blocked matrix product, and updating the weights in place,
+which for a few hundred units and a thousand examples is about
+a hundred times faster.  The arguments and the results,
+and I<rbm.weights>, are still the same Lua tables.
+
 =item I<new_hidden = vis2hid(rbm, visible_data)>
 
 This uses the trained weights to derive the hidden variables from the 
@@ -573,6 +778,13 @@ into a list of the labels
 This module is available at
 L<http://www.pjb.com.au/comp/lua/rbm.html>
 
+The optional C module is I<C-rbm.c>, which can be compiled with
+something like
+
+ cc -O3 -shared -fPIC -pthread -I/usr/include/lua5.3 C-rbm.c -o C-rbm.so
+
+and installed as I<C-rbm.so> somewhere in your I<package.cpath>
+
 =head1 AUTHOR
 
 Peter J Billam, L<http://www.pjb.com.au/comp/contact.html>
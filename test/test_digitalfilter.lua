@@ -304,6 +304,106 @@ for order = 3,7 do
 	  samplerate,order,elapsed))
 end
 
+------------------------------------------------ whole buffers
+local option = {
+	filtertype  = 'chebyschev',
+	shape       = 'lowpass',
+	order       = 6,
+	freq        = cutoff_freq,
+	samplerate  = samplerate,
+	ripple      = 1.0,
+}
+local my_sinewave  = new_sinewave(cutoff_freq, samplerate)
+local samples = {}
+for i = 1,samplerate do samples[i] = 10000 * my_sinewave() end
+local sample_filter = DF.new_digitalfilter(option)
+local _, _, buffer_filter = DF.new_digitalfilter(option)
+local x = os.clock()
+local filtered = buffer_filter(samples)
+elapsed = os.clock() - x
+ok(elapsed < 0.2, string.format(
+  '%d-sample buffer chebyschev order 6 took %g sec', samplerate, elapsed))
+local maxdiff = 0.0
+for i = 1,#samples do
+	local diff = math.abs(filtered[i] - sample_filter(samples[i]))
+	if diff > maxdiff then maxdiff = diff end
+end
+ok(#filtered == #samples and maxdiff < 1.0e-6,
+  'buffer_filter(array) = the closure, to within '..tostring(maxdiff))
+local _, _, buffer_filter = DF.new_digitalfilter(option)
+local s16, err = buffer_filter(string.rep('\0\0', 1000), 's16')
+ok(s16 and #s16 == 2000 and not string.find(s16, '[^%z]'),
+  "buffer_filter(silence, 's16') returns silence")
+local _, _, buffer_filter = DF.new_digitalfilter(option)
+if string.pack then   -- the pure-Lua strings need Lua5.3
+	local pieces = {}
+	for i = 1,1000 do pieces[i] = string.pack('f', samples[i]) end
+	local floats = buffer_filter(table.concat(pieces), 'float')
+	local y = string.unpack('f', floats, 4*999+1)
+	ok(#floats == 4000 and eq(y, filtered[1000], 0.01),
+	  "buffer_filter(floats, 'float') agrees with buffer_filter(array)")
+end
+local rc, msg = buffer_filter('', 'mp3')
+ok(rc == nil and string.find(msg, 'format'),
+  "buffer_filter(s, 'mp3') returns nil, '"..tostring(msg).."'")
+
+------------------------------------------------ many channels
+local nchannels = 8
+option['channels'] = nchannels
+local frames = {}
+for i = 1,4410*nchannels do
+	frames[i] = 10000 * math.sin(i * (1 + i%nchannels) * 0.001)
+end
+local _, _, buffer_filter = DF.new_digitalfilter(option)
+local filtered = buffer_filter(frames)
+option['channels'] = 1
+local channel_filters = {}
+for i = 1,nchannels do channel_filters[i]=DF.new_digitalfilter(option) end
+maxdiff = 0.0
+for i = 1,#frames do
+	local y = channel_filters[(i-1)%nchannels + 1](frames[i])
+	if math.abs(filtered[i] - y) > maxdiff then maxdiff = math.abs(filtered[i]-y) end
+end
+ok(#filtered == #frames and maxdiff < 1.0e-6, nchannels..
+  '-channel buffer_filter = one closure per channel, within '..maxdiff)
+option['channels'] = 3
+local frame_filter, _, buffer_filter = DF.new_digitalfilter(option)
+local y1,y2,y3 = frame_filter(1.0, 0.0, -1.0)
+ok(y1 and eq(y1, -y3, 1.0e-12) and y2 == 0.0,
+  '3-channel filter returns one value for each channel')
+local rc, msg = buffer_filter({1,2,3,4})
+ok(rc == nil and string.find(msg, 'frames'),
+  "4 samples, 3 channels returns nil, '"..tostring(msg).."'")
+option['channels'] = nil
+
+-- throughput in samples/sec/channel, against one Lua closure per channel
+local have_C = package.loaded['C-digitalfilter']
+package.loaded['digitalfilter'] = nil ; package.loaded['C-digitalfilter'] = nil
+package.preload['C-digitalfilter'] = function() error('pure Lua please') end
+local pure_DF = require 'digitalfilter'
+package.preload['C-digitalfilter'] = nil
+package.loaded['C-digitalfilter'] = have_C
+for i,nchannels in ipairs({8,16,32}) do
+	local nframes = 20000
+	local frames = {}
+	for i = 1,nframes*nchannels do frames[i] = math.sin(i) end
+	option['channels'] = 1
+	local channel_filters = {}
+	for i = 1,nchannels do channel_filters[i]=pure_DF.new_digitalfilter(option) end
+	local x = os.clock()
+	for i = 1,#frames do channel_filters[(i-1)%nchannels + 1](frames[i]) end
+	local closures_rate = nframes / (os.clock() - x)
+	option['channels'] = nchannels
+	local _, _, buffer_filter = DF.new_digitalfilter(option)
+	x = os.clock()
+	buffer_filter(frames)
+	local buffer_rate = nframes / (os.clock() - x)
+	ok(buffer_rate > closures_rate or not have_C, string.format(
+	  '%d channels: %.3g samples/sec/channel, Lua closures %.3g',
+	  nchannels, buffer_rate, closures_rate))
+end
+option['channels'] = nil
+
 -- os.exit()
 
 --------------------------------- plot some frequency responses ...
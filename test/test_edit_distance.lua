@@ -55,6 +55,7 @@ ok(ED.damerau_levenshtein("gloop", "gl0op") == 1, "substitution")
 ok(ED.damerau_levenshtein("gloop", "glop")  == 1, "deletion")
 ok(ED.damerau_levenshtein("gloop","gloopx") == 1, "addition")
 ok(ED.damerau_levenshtein("CA", "ABC")      == 2, "addition and exchange")
+ok(ED.damerau_levenshtein("eros", "uroos")  == 2, "no false exchange")
 ok(ED.is_a_word('ever'), "ever is a word")
 ok(not ED.is_a_word('xvfr'), "xvfr is not a word")
 ok(ED.candidates('ever') == 'ever', "candidates() thinks ever is a word")
@@ -62,6 +63,15 @@ local t = ED.candidates('evex')
 ok(type(t) == 'table',
   "candidates('evex') returns {'"..table.concat(t, "','").."'}"
 )
+local t2 = ED.candidates('evex', 2)
+local nearest_first = type(t2) == 'table' and #t2 >= #t
+for i = 1, #t do
+	if t2[i] ~= t[i] then nearest_first = false end
+end
+for i = #t+1, #t2 do
+	if ED.damerau_levenshtein(t2[i], 'evex') ~= 2 then nearest_first = false end
+end
+ok(nearest_first, "candidates('evex', 2) adds "..(#t2-#t).." at distance 2")
 t = ED.candidates('oo')
 ok(type(t) == 'table',
   "candidates('oo') returns {'"..table.concat(t, "','").."'}"
@@ -72,6 +82,20 @@ ok(type(t) == 'table',
 )
 t = ED.candidates('xvfr')
 ok(type(t) == 'table' and #t == 0, "candidates('xvfr') returns {}")
+local compiled_file = os.tmpname()
+local before = { ED.candidates('evex'), ED.candidates('evex', 2) }
+ok(ED.compile_words(nil, compiled_file), "compile_words writes "..compiled_file)
+ok(ED.load_compiled(compiled_file), "load_compiled maps "..compiled_file)
+local after = { ED.candidates('evex'), ED.candidates('evex', 2) }
+local same = ED.is_a_word('ever') and not ED.is_a_word('xvfr')
+for k = 1, 2 do
+	if #after[k] ~= #before[k] then same = false end
+	for i = 1, #before[k] do
+		if after[k][i] ~= before[k][i] then same = false end
+	end
+end
+ok(same, "the compiled dictionary gives the same candidates")
+os.remove(compiled_file)
 summary()
 -- for i,v in ipairs(ED.test_load_words()) do print(v) end
 
@@ -188,6 +188,31 @@ if detailed then
 	end
 end
 
+-- ----------------- test M.evol population mode --------------------
+M.ec = 0.0000000000000001
+M.ed = 0.00000000001
+for k,options in ipairs({ {mu=2, lambda=10},
+  {mu=3, lambda=12, plus=false, workers=3} }) do
+	x  = {3.456, 1.234, -2.345, 4.567}
+	sm = {.8, .4, .6, 1.2}
+	returns = {M.evol(x, sm, minimise, contain, 10, options)}
+	fail1 = 0
+	for k,v in ipairs(returns[1]) do
+		if math.abs(v) > 0.0001 then
+			if detailed then warn("v = "..tostring(v).."\n") end
+			fail1 = fail1 + 1
+		end
+	end
+	local mode = '(mu+lambda)'
+	if options.plus == false then
+		if pcall(require, 'posix') then mode = '(mu,lambda) with 3 workers'
+		else mode = '(mu,lambda) (posix is not installed, so no workers)'
+		end
+	end
+	ok (fail1 == 0 and returns[4] and math.abs(returns[3]-1.0) < 0.00000001,
+	  "evol in "..mode.." population mode")
+end
+
 -- ----------------- test M.select_evol --------------------
 x  = {3.456, 1.234, -2.345, 4.567}
 sm = {.8, .4, .6, 1.2}
@@ -608,6 +608,10 @@ ok(equals(score10, correct_segment) and equals(score2, orig_score2),
 local score10 = MIDI.segment{score2, start_time=5000, end_time=15000}
 ok(equals(score10, correct_segment) and equals(score2, orig_score2),
  'segment {score, start_time=5000, end_time=15000}')
+local score2_index = MIDI.score2index(score2)
+local score10 = MIDI.segment(score2_index, 5000, 15000)
+ok(equals(score10, correct_segment) and equals(score2, orig_score2),
+ 'segment (score2index(score), start_time, end_time)')
 
 -- warn('score10='..DataDumper(score10))
 -- warn('correct_segment='..DataDumper(correct_segment))
@@ -638,6 +642,24 @@ s1=table2sortedarray(stats)
 s2=table2sortedarray(correct_stats)
 ok(equals(s1,s2) and equals(merge1,correct_merge1),'score2stats')
 
+local acc1 = MIDI.new_stats(merge1[1])
+local acc2 = MIDI.new_stats(merge1[1])
+for i = 2,#merge1 do
+	local acc = acc1 ; if i > 3 then acc = acc2 end
+	for k,event in ipairs(merge1[i]) do MIDI.stats_add(acc, event, i) end
+end
+s1=table2sortedarray(MIDI.stats_result(MIDI.stats_merge(acc1, acc2)))
+ok(equals(s1,s2), 'new_stats, stats_add, stats_merge and stats_result')
+
+local acc = MIDI.new_stats()
+local ticks = MIDI.scan(correct_midi1, {on_event = function(event, track_num)
+	MIDI.stats_add(acc, event, track_num)
+end})
+acc.ticks_per_quarter = ticks
+s1=table2sortedarray(MIDI.stats_result(acc))
+s2=table2sortedarray(MIDI.score2stats(MIDI.midi2opus(correct_midi1)))
+ok(equals(s1,s2), 'stats_add fed by scan')
+
 local seq_midi = MIDI.opus2midi(seq_opus)
 --local f = assert(io.open('t.mid', 'wb'))
 --f:write(seq_midi)
@@ -646,5 +668,80 @@ local seq_midi = MIDI.opus2midi(seq_opus)
 local seq_opus2 = MIDI.midi2opus(seq_midi)
 ok(equals(seq_opus2, seq_opus), 'set_sequence_number encode and decode')
 
+-- if C-MIDI is installed, its midi2opus must agree with the pure Lua
+package.loaded['MIDI'] = nil ; package.loaded['C-MIDI'] = nil
+package.preload['C-MIDI'] = function() error('pure Lua please') end
+local pure_MIDI = require 'MIDI'
+local odd_midi = string.gsub(correct_midi1, '\255\81\3', '\255\81\2', 1)
+local all_same = true
+for i,m in ipairs({correct_midi1, seq_midi, odd_midi,
+  string.sub(correct_midi1, 1, -5), string.sub(correct_midi1, 1, 40)}) do
+	if not equals(MIDI.midi2opus(m), pure_MIDI.midi2opus(m)) then
+		all_same = false
+	end
+end
+ok(all_same, 'midi2opus same with and without C-MIDI')
+
+local scanned = {}
+local ticks, ntracks = MIDI.scan(correct_midi1, {exclude={'end_track'},
+  on_event = function(event, track_num) scanned[#scanned+1] = event end})
+local unscanned = {}
+for i = 2,#opus2 do for j,event in ipairs(opus2[i]) do
+	if event[1] ~= 'text_event' or event[3] ~= '' then -- EOT magic
+		unscanned[#unscanned+1] = event
+	end
+end end
+local notes_on = 0
+MIDI.scan(correct_midi1, {include={'note_on'},
+  on_event = function(event) notes_on = notes_on + 1 end})
+local n_on = 0
+for i,event in ipairs(unscanned) do
+	if event[1] == 'note_on' then n_on = n_on + 1 end
+end
+ok(ticks == opus2[1] and ntracks == #opus2-1 and equals(scanned, unscanned)
+  and notes_on == n_on, 'scan')
+
+if arg[1] == '-b' then   -- the benchmarks:  lua test_mi.lua -b
+	local function bench(what, n, f)
+		local t0 = os.clock() ; f() ; local t = os.clock() - t0
+		print(string.format('# %s: %d events in %.2f sec, %.0f events/sec',
+		  what, n, t, n/t))
+	end
+	local big_track = {}
+	for i = 1,500000 do
+		if i % 100 == 0 then
+			big_track[i] = {'control_change', 24*i, i%16, 7, i%128}
+		else
+			big_track[i] = {'note', 24*i, 20+i%50, i%16, 30+i%60, 100}
+		end
+	end
+	local big_score = {96, big_track}
+	local big_opus  = MIDI.score2opus(big_score)
+	bench('opus2midi',  #big_opus[2], function() MIDI.opus2midi(big_opus) end)
+	bench('score2midi', #big_opus[2], function() MIDI.score2midi(big_score) end)
+	local big_index
+	bench('score2index', #big_track, function()
+		big_index = MIDI.score2index(big_score)
+	end)
+	local tracks = {}
+	for itrack = 1,64 do
+		local track = {}
+		for i = 1,8000 do
+			track[i] = {'note', 10*i + itrack%7, 8, itrack%16, 40+i%40, 100}
+		end
+		tracks[itrack] = MIDI.score2opus({96, track})[2]
+	end
+	bench('mix_opus_tracks of 64 tracks', 64*16000, function()
+		MIDI.mix_opus_tracks(tracks)
+	end)
+	local function bench_segments(what, score)
+		local t0 = os.clock()
+		for i = 1,50 do MIDI.segment(score, 200000*i, 200000*i+5000) end
+		print(string.format('# 50 segments, %s: %.3f msec per segment',
+		  what, 20*(os.clock()-t0)))
+	end
+	bench_segments('unindexed', big_score)
+	bench_segments('indexed', big_index)
+end
 
 os.exit()
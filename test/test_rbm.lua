@@ -0,0 +1,199 @@
+#!/usr/bin/lua
+-- ----------------------------------------------------------------- --
+--      This Lua5 script is Copyright (c) 2026, Peter J Billam       --
+--                        www.pjb.com.au                             --
+--                                                                   --
+--   This script is free software; you can redistribute it and/or    --
+--          modify it under the same terms as Lua5 itself.           --
+-- ----------------------------------------------------------------- --
+local Version = '1.0  for Lua5'
+local VersionDate  = '17oct2026';
+local Synopsis = [[
+lua test_rbm.lua
+]]
+--------------------------- infrastructure ----------------
+local Test = 15 ; local i_test = 0; local Failed = 0;
+function ok(b,s)
+	i_test = i_test + 1
+	if b then
+		io.write('ok '..i_test..' - '..s.."\n")
+	else
+		io.write('not ok '..i_test..' - '..s.."\n")
+		Failed = Failed + 1
+	end
+end
+local function same_shape(a, nrows, ncols)
+	if type(a) ~= 'table' or #a ~= nrows then return false end
+	for i,row in ipairs(a) do
+		if #row ~= ncols then return false end
+		for j,v in ipairs(row) do
+			if v ~= 0 and v ~= 1 then return false end
+		end
+	end
+	return true
+end
+local function equal(a, b, eps)   -- arrays of arrays
+	if #a ~= #b then return false end
+	for i = 1,#a do
+		if #a[i] ~= #b[i] then return false end
+		for j = 1,#a[i] do
+			local x = a[i][j] ; local y = b[i][j]
+			if math.abs(x-y) > (eps or 0) * math.max(1, math.abs(x)) then
+				return false
+			end
+		end
+	end
+	return true
+end
+--------------------------- infrastructure ----------------
+local RBM = require 'rbm'
+local has_C, c_rbm = pcall(require, 'C-rbm')
+
+local training_data = {
+	{1,1,1,0,0,0}, {1,0,1,0,0,0}, {1,1,1,0,0,0},
+	{0,0,1,1,1,0}, {0,0,1,1,0,0}, {0,0,1,1,1,0}
+}
+local labels = {'Potter','Avatar','LOTR3','Gladiator','Titanic','Glitter'}
+local r = RBM.new_rbm({ 6, 2, labels=labels })
+ok(#r.weights == 7 and #r.weights[1] == 3, "new_rbm makes a 7x3 weights")
+local err = RBM.train(r, training_data, 500)
+ok(type(err) == 'number' and err >= 0, "train returns the error, "..err)
+local hidden_states = RBM.vis2hid(r, { {0,0,0,1,1,0}, {1,1,0,0,0,0} })
+ok(same_shape(hidden_states, 2, 2), "vis2hid returns 2x2 binary states")
+local visible_states = RBM.hid2vis(r, hidden_states)
+ok(same_shape(visible_states, 2, 6), "hid2vis returns 2x6 binary states")
+ok(same_shape(RBM.daydream(r, 5), 5, 6), "daydream returns 5 samples")
+ok(table.concat(RBM.vis2labels(r, {0,0,0,1,1,0}),',') == 'Gladiator,Titanic',
+  "vis2labels")
+
+-- if C-rbm is installed, it must agree with pure Lua.  The sampling uses
+-- different random numbers, so the weights are made large enough that
+-- every probability is exactly 0 or 1, and the states are the same.
+-- (vis2hid has no bias unit, so its data must begin with a 1.)
+package.loaded['rbm'] = nil ; package.loaded['C-rbm'] = nil
+package.preload['C-rbm'] = function() error('pure Lua please') end
+local pure_RBM = require 'rbm'
+local function saturated(options, rbm_module)
+	options[1] = 6 ; options[2] = 3
+	local rbm = rbm_module.new_rbm(options)
+	for i = 1,7 do
+		for j = 1,4 do
+			if i == 1 and j == 1 then rbm.weights[i][j] = 1.0e5
+			elseif i == 1 or j == 1 then
+				rbm.weights[i][j] = ((i+j) % 2 == 0) and 1000 or -1000
+			else rbm.weights[i][j] = 0.01 * (i - 2*j)
+			end
+		end
+	end
+	return rbm
+end
+local option_sets = {
+	{ name = 'the defaults' },
+	{ name = 'batch_size=4', batch_size = 4 },
+	{ name = 'momentum=0.9', momentum = 0.9 },
+	{ name = 'cd_k=3', cd_k = 3 },
+	{ name = 'threads=2', threads = 2 },
+	{ name = 'all of them', batch_size = 2, momentum = 0.5, cd_k = 2,
+	  threads = 2 },
+}
+for i,options in ipairs(option_sets) do
+	local c   = saturated(options, RBM)
+	local lua = saturated(options, pure_RBM)
+	local c_err   = RBM.train(c, training_data, 20)
+	local lua_err = pure_RBM.train(lua, training_data, 20)
+	local same = math.abs(c_err - lua_err) <= 1.0e-9 * math.max(1, c_err)
+	  and equal(c.weights, lua.weights, 1.0e-9)
+	  and equal(RBM.vis2hid(c, { training_data[1], training_data[2] }),
+	    pure_RBM.vis2hid(lua, { training_data[1], training_data[2] }))
+	  and equal(RBM.hid2vis(c, { {0,1,1}, {1,0,1} }),
+	    pure_RBM.hid2vis(lua, { {0,1,1}, {1,0,1} }))
+	  and equal(RBM.daydream(c, 4), pure_RBM.daydream(lua, 4))
+	if has_C then
+		ok(same, "train with "..options.name.." same with and without C-rbm")
+	else
+		ok(same, "train with "..options.name.." (C-rbm is not installed)")
+	end
+end
+
+-- with moderate weights the probabilities are not 0 or 1, so the C
+-- logistic is compared with the Lua formula, and the states it samples
+-- must turn up about as often as their probabilities say
+local function sigmoid(x) return 1.0/(1.0+math.exp(0.0-x)) end
+if has_C then
+	local prv = {} ; c_rbm({}, prv, {})
+	local xs = {} ; local row = {}
+	for j = 1,25 do row[j] = (j-13) * 0.5 end   -- -6 .. 6
+	xs[1] = row
+	local m = prv.logistic(prv.matrix_from(xs))
+	local probs = prv.to_table(m, 1)
+	local expected = { {} }
+	for j = 1,25 do expected[1][j] = sigmoid(row[j]) end
+	ok(equal(probs, expected, 1.0e-12), "C logistic agrees with the Lua formula")
+else
+	ok(true, "C logistic (C-rbm is not installed)")
+end
+local function moderate(rbm_module)
+	local rbm = rbm_module.new_rbm({ 6, 3 })
+	for i = 1,7 do
+		for j = 1,4 do rbm.weights[i][j] = 0.25 * (i - 2*j + 1) end
+	end
+	return rbm
+end
+local N = 4000
+local v = {1,0,1,1,0,1}   -- vis2hid has no bias unit, as above
+local rows = {} ; for k = 1,N do rows[k] = v end
+local function frequencies_ok(rbm_module)
+	local rbm = moderate(rbm_module)
+	local states = rbm_module.vis2hid(rbm, rows)
+	for j = 1,3 do
+		local sum = 0.0
+		for i = 1,#v do sum = sum + v[i]*rbm.weights[i][j+1] end
+		local p = sigmoid(sum)
+		local n = 0
+		for k = 1,N do n = n + states[k][j] end
+		-- five standard deviations, so it should never fail by chance
+		if math.abs(n/N - p) > 5*math.sqrt(p*(1-p)/N) then return false end
+	end
+	return true
+end
+if has_C then
+	ok(frequencies_ok(RBM), "C vis2hid samples states with their probabilities")
+else
+	ok(true, "C vis2hid sampling (C-rbm is not installed)")
+end
+ok(frequencies_ok(pure_RBM), "Lua vis2hid samples states with their probabilities")
+
+if Failed == 0 then print("passed all tests :-)")
+elseif Failed == 1 then print("failed 1 test")
+else print("failed "..Failed.." tests")
+end
+
+--[[
+__END__
+
+=pod
+
+=head1 NAME
+
+test_rbm.lua - Lua script to test rbm.lua
+
+=head1 SYNOPSIS
+
+ lua test_rbm.lua
+
+=head1 DESCRIPTION
+
+This script tests rbm.lua, and if C-rbm is installed,
+checks that it gives the same results as the pure Lua.
+
+=head1 AUTHOR
+
+Peter J Billam, http://www.pjb.com.au/comp/contact.html
+
+=head1 SEE ALSO
+
+ http://www.pjb.com.au/
+
+=cut
+
+]]
@@ -50,7 +50,7 @@ function equal(x, y)  -- unused here
     return true
 end
 -- use Test::Simple tests => 6;
-local Test = 12 ; local i_test = 0; local Failed = 0;
+local Test = 17 ; local i_test = 0; local Failed = 0;
 function ok(b,s)
     i_test = i_test + 1
     if b then
@@ -191,6 +191,107 @@ for k, mode in ipairs({'epsilon','errors'}) do
 
 end
 
+-- the stepper must give the same answers as the functions
+function dydt_fill(t, y, f)  -- fills in f, returns nothing
+	f[1] = y[2]
+	f[2] = 0.0 - y[1]
+end
+local all_agree = true
+for i=1,4 do
+	local n = 16 ; local dt = twopi / n
+	y = {0,1}; t=0
+	for j=1, n do t, y = algorithms[i](y, dydt, t, dt) end
+	local stepper = RK.new_stepper(dydt_fill, {0,1}, algnames[i])
+	local ts = stepper:step(0, dt, n)
+	if math.abs(ts-t) > eps or not equal(stepper:get(), y) then
+		all_agree = false
+	end
+end
+ok(all_agree, 'new_stepper:step agrees with rk2, rk4, rk4_classical, rk4_ralston')
+
+all_agree = true
+for k, epsilon in ipairs({ .0001, {.01, .0001} }) do
+	y = {0,1}; t = 0; dt = 0.1
+	local stepper = RK.new_stepper(dydt, {0,1})  -- returns a new table
+	local ts = 0 ; local dts = 0.1
+	for j=1, 20 do
+		local t0 = t
+		t, dt, y = RK.rk4_auto(y, dydt, t, dt, epsilon)
+		local dummy; dummy, y_midpoint = RK.rk4_auto_midpoint()
+		ts, dts = stepper:auto(ts, dts, epsilon)
+		local ts_mid, ys_mid = stepper:midpoint()
+		if math.abs(ts-t) > eps or math.abs(dts-dt) > eps
+		  or not equal(stepper:get(), y) or not equal(ys_mid, y_midpoint)
+		  or math.abs(ts_mid - (t0+0.5*dt)) > eps then
+			all_agree = false
+		end
+	end
+	ts, dts = stepper:auto(ts, dts, epsilon, 10)
+	for j=1, 10 do t, dt, y = RK.rk4_auto(y, dydt, t, dt, epsilon) end
+	if math.abs(ts-t) > eps or not equal(stepper:get(), y) then
+		all_agree = false
+	end
+end
+ok(all_agree, 'new_stepper:auto and midpoint agree with rk4_auto')
+
+local stepper = RK.new_stepper(dydt_fill, {0,1}, 'rk4_classical')
+stepper:set({1,2})
+local a = {} ; stepper:get(a)
+ok(equal(a, {1,2}) and equal(stepper:get(), {1,2}), 'new_stepper get and set')
+
+-- an ensemble of oscillators, with their frequencies in y[3]
+function dydt_ensemble(t, y, f, nsystems, dim, first)
+	for k = 0, nsystems-1 do
+		local j = k*dim
+		f[j+1] = y[j+3] * y[j+2]
+		f[j+2] = 0.0 - y[j+3] * y[j+1]
+		f[j+3] = 0.0
+	end
+end
+function dydt_one(t, y)
+	return { y[3]*y[2], 0.0-y[3]*y[1], 0.0 }
+end
+local ys = {}
+for k = 1,10 do ys[k] = { 0, 1, 0.5 + 0.1*k } end
+all_agree = true
+for i = 1,4 do
+	local dt = twopi / 50
+	local ensemble = RK.new_ensemble(dydt_ensemble, ys, algnames[i])
+	local te = ensemble:step(0, dt, 50)
+	for k = 1,10 do
+		y = ys[k]; t = 0
+		for j = 1,50 do t, y = algorithms[i](y, dydt_one, t, dt) end
+		if math.abs(te-t) > eps or not equal(ensemble:get(k), y) then
+			all_agree = false
+		end
+	end
+end
+ok(all_agree, 'new_ensemble:step agrees with rk2, rk4, rk4_classical, rk4_ralston')
+
+local dydt_source = [[
+	return function (t, y, f, nsystems, dim, first)
+		for k = 0, nsystems-1 do
+			local j = k*dim
+			f[j+1] = y[j+3] * y[j+2]
+			f[j+2] = 0.0 - y[j+3] * y[j+1]
+			f[j+3] = 0.0
+		end
+	end
+]]
+local e1 = RK.new_ensemble(dydt_ensemble, ys, 'rk4', 1)
+local e3 = RK.new_ensemble(dydt_ensemble, ys, 'rk4', 3)
+local es = RK.new_ensemble(dydt_source,   ys, 'rk4', 4)
+e1:set(2, {1,0,2}) ; e3:set(2, {1,0,2}) ; es:set(2, {1,0,2})
+local t1 = e1:step(0, 0.1, 30)
+all_agree = math.abs(e3:step(0, 0.1, 30) - t1) < eps
+  and math.abs(es:step(0, 0.1, 30) - t1) < eps
+for k = 1,10 do
+	if not equal(e3:get(k), e1:get(k)) or not equal(es:get(k), e1:get(k)) then
+		all_agree = false
+	end
+end
+ok(all_agree, 'new_ensemble in threads agrees with new_ensemble in one')
+
 --[[
 __END__
 
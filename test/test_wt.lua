@@ -102,6 +102,57 @@ local y2 = {0.74390625, 0.0025, 0.330625, 0.15015625, 0.06890625,
  0.1225, 1.1025, 0.23765625, 0.47265625, 0.25}
 ok (equal(y,y2), "power_spectrum");
 
+local buffer = M.new_buffer(1024, 3)
+buffer:set(1, f):set(2, H):set(3, W)
+buffer:fht(1):fhtinv(2):fwt(3)
+ok(equal(buffer:get(1), H) and equal(buffer:get(2), f)
+  and equal(buffer:get(3), M.fwt(W)), "buffer of vectors transformed in place")
+buffer:fwtinv()
+ok(equal(buffer:get(3), W), "buffer batch inverse Walsh transform")
+local rc, msg = M.new_buffer(1000)
+ok(rc == nil and msg, "new_buffer(1000) returns nil, "..tostring(msg))
+local workspace = M.new_buffer(8, 2)
+ok(equal(M.logical_convolution(f1, f2, workspace), lc1)
+  and equal(workspace:get(1), lc1), "Logical Convolution in a workspace")
+ok(equal(M.logical_autocorrelation(f1, workspace),
+  M.logical_convolution(f1, f1)), "Logical Autocorrelation in a workspace")
+
+-- if C-WalshTransform is installed, it must agree exactly with pure Lua
+for k,v in pairs(package.loaded) do
+	if string.find(k, 'WalshTransform$') then package.loaded[k] = nil end
+end
+package.preload['C-WalshTransform'] = function() error('pure Lua please') end
+local pure_M = require 'Math.WalshTransform'
+local all_same = true
+for i,a in ipairs({f, {0,2,2,0}, {1,-3,7,2,0,0,5,-9}, {0.5,-1}}) do
+	for j,transform in ipairs({'fht','fhtinv','fwt','fwtinv'}) do
+		local x = M[transform](a)
+		local y = pure_M[transform](a)
+		for i = 1,#a do
+			if x[i] ~= y[i] or tostring(x[i]) ~= tostring(y[i]) then
+				all_same = false
+			end
+		end
+	end
+end
+local workspace = M.new_buffer(8, 2)
+local pure_workspace = pure_M.new_buffer(8, 2)
+for i,a in ipairs({f1, {1,-3,7,2,0,0,5,-9}}) do
+	local results = {
+		M.logical_convolution(a, f2), pure_M.logical_convolution(a, f2),
+		M.logical_convolution(a, f2, workspace),
+		pure_M.logical_convolution(a, f2, pure_workspace),
+		M.logical_autocorrelation(a, workspace),
+		pure_M.logical_autocorrelation(a, pure_workspace),
+	}
+	for j = 1,#results,2 do
+		for i = 1,#a do
+			if results[j][i] ~= results[j+1][i] then all_same = false end
+		end
+	end
+end
+ok(all_same, "transforms identical with and without C-WalshTransform")
+
 --[[
 __END__
 